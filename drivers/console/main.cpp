@@ -7,7 +7,10 @@
 #include "consolebattle.h"
 #include "scriptasset.h"
 #include "varbinder.h"
+#include "bundle.h"
 #include "consoleboard.h"
+#include "savefile.h"
+#include "autosave.h"
 
 #include "../platform.h"
 
@@ -200,18 +203,23 @@ static void PrintEdges(const std::vector<DirEdge>& edges) {
 
 static bool ProcessMenu(const std::string& s, const std::string& dir, ZoneDriver& zd)
 {
-	std::filesystem::path path = SavePath(dir, "save");
+	std::filesystem::path path = SavePath(dir, "save", true, ".lurps");
 
 	if (s == "/s" || s == "/c") {
 		fmt::print("Saving to '{}'...\n", path.string());
-		std::ofstream stream = OpenSaveStream(path);
-		zd.save(stream);
+		SaveFile::save(path, zd);
 	}
 	if (s == "/l" || s == "/c") {
 		fmt::print("Loading from '{}'...\n", path.string());
-		ScriptBridge loader;
-		loader.loadLUA(path.string());
-		zd.load(loader);
+		if (!SaveFile::load(path, zd))
+			fmt::print("Load failed.\n");
+	}
+	if (s == "/x") {
+		// Human readable Lua version of the save, for debugging.
+		std::filesystem::path luaPath = SavePath(dir, "save");
+		fmt::print("Exporting to '{}'...\n", luaPath.string());
+		std::ofstream stream = OpenSaveStream(luaPath);
+		zd.save(stream);
 	}
 	if (s == "/q") {
 		return true;
@@ -249,8 +257,10 @@ static int SelectEdge(const Value& v, const std::vector<DirEdge>& edges)
 
 static void ConsoleZoneDriver(ScriptAssets& assets, ScriptBridge& bridge, EntityID zone, std::string dir, uint32_t seed)
 {
+	AutoSave autoSave(SavePath(dir, "autosave", true, ".lurps"));
 	ZoneDriver driver(assets, bridge, zone);
 	driver.mapData.random.setSeed(seed);
+	driver.setAutoSave(&autoSave);
 
 	while (!driver.isGameOver()) {
 
@@ -277,11 +287,11 @@ static void ConsoleZoneDriver(ScriptAssets& assets, ScriptBridge& bridge, Entity
 			std::vector<DirEdge> edges = driver.dirEdges();
 
 			PrintRoomDesc(driver.currentZone(), driver.currentRoom());
-			PrintInventory(assets.getInventory(player));
+			PrintInventory(driver.getInventory(player));
 			PrintContainers(driver, containerVec);
 			PrintInteractions(interactionVec, assets);
 			PrintEdges(edges);
-			fmt::print("Menu: (/s)ave (/l)oad (/c)ycle (/q)uit\n");
+			fmt::print("Menu: (/s)ave (/l)oad (/c)ycle e(/x)port (/q)uit\n");
 
 			fmt::print("> ");
 			Value v = Value::ParseValue(ReadString());
@@ -446,6 +456,7 @@ int main(int argc, const char* argv[])
 		fmt::print("  --noTest          Do not run tests\n");
 		fmt::print("  --win             Automatically win all battles\n");
 		fmt::print("  --board		    Run in board game mode\n");
+		fmt::print("  --compile         Compile the game to a bundle (faster loading) and exit\n");
 	}
 
 	bool debugSave = cmdl[{ "-s", "--debugSave" }];
@@ -453,6 +464,7 @@ int main(int argc, const char* argv[])
 	bool doScan = !cmdl[{ "--noScan" }];
 	bool runTests = !cmdl[{ "--noTest" }];
 	bool boardGame = cmdl[{ "--board" }];
+	bool compile = cmdl[{ "--compile" }];
 
 	if (cmdl[{ "--win" }])
 		gWinAllBattles = true;
@@ -501,7 +513,20 @@ int main(int argc, const char* argv[])
 		}
 		Globals::debugSave = debugSave;
 
-		if (boardGame) {
+		if (compile) {
+			if (gameFile.empty()) {
+				fmt::print("--compile requires a game file.\n");
+				rc = 1;
+			}
+			else {
+				ScriptBridge bridge;
+				if (bridge.compileCSA(gameFile))
+					fmt::print("Compiled '{}' to '{}'\n", gameFile, Bundle::path(gameFile).string());
+				else
+					rc = 1;
+			}
+		}
+		else if (boardGame) {
 			ConsoleBoardDriver(gameDir);
 		}
 		else {
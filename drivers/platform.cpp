@@ -11,6 +11,11 @@
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 #include <shlobj_core.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 namespace lurp {
@@ -146,11 +151,11 @@ std::vector<std::filesystem::path> ScanGameFiles()
     return gameFiles;
 }
 
-std::filesystem::path SavePath(const std::string& dir, const std::string& stem, bool createDirs)
+std::filesystem::path SavePath(const std::string& dir, const std::string& stem, bool createDirs, const std::string& ext)
 {
     std::filesystem::path savePath = OSSavePath();
 
-    std::filesystem::path p = savePath / dir / (stem + ".lua");
+    std::filesystem::path p = savePath / dir / (stem + ext);
     if (createDirs) {
         std::filesystem::create_directories(p.parent_path());
         if (!std::filesystem::exists(p.parent_path())) {
@@ -170,6 +175,63 @@ std::filesystem::path LogPath(const std::string& stem)
 
 #ifdef _WIN32
 
+MappedFile::MappedFile(const std::filesystem::path& path)
+{
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+    _file = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+        return;
+
+    HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping)
+        return;
+    _mapping = mapping;
+
+    _data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (_data)
+        _size = (size_t)size.QuadPart;
+}
+
+MappedFile::~MappedFile()
+{
+    if (_data) UnmapViewOfFile(_data);
+    if (_mapping) CloseHandle((HANDLE)_mapping);
+    if (_file) CloseHandle((HANDLE)_file);
+}
+
+#else
+
+MappedFile::MappedFile(const std::filesystem::path& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            _data = (const uint8_t*)p;
+            _size = (size_t)st.st_size;
+        }
+    }
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (_data) munmap((void*)_data, _size);
+}
+
+#endif
+
+#ifdef _WIN32
+
 std::string OSSavePath()
 {
     PWSTR path = NULL;
@@ -6,12 +6,13 @@
 #include <vector>
 #include <filesystem>
 #include <optional>
+#include <stdint.h>
 
 namespace lurp {
 
 // --- Platform-specific functions ---
 // Given dir="default" and stem="auto" return "c:/user/thedude/Saved Games/default/auto.lua"
-std::filesystem::path SavePath(const std::string& dir, const std::string& stem, bool createDirectories = true);
+std::filesystem::path SavePath(const std::string& dir, const std::string& stem, bool createDirectories = true, const std::string& ext = ".lua");
 std::filesystem::path LogPath(const std::string& stem);
 
 // --- General functions ---
@@ -26,4 +27,26 @@ bool CheckPath(const std::string& path, std::string& cwd);
 
 std::vector<std::filesystem::path> ScanGameFiles();
 
+// Read-only memory map of an entire file. valid() is false if the file
+// doesn't exist, is empty, or can't be mapped.
+class MappedFile {
+public:
+	MappedFile(const std::filesystem::path& path);
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool valid() const { return _data != nullptr; }
+	const uint8_t* data() const { return _data; }
+	size_t size() const { return _size; }
+
+private:
+	const uint8_t* _data = nullptr;
+	size_t _size = 0;
+#ifdef _WIN32
+	void* _file = nullptr;
+	void* _mapping = nullptr;
+#endif
+};
+
 } // namespace lurp
\ No newline at end of file
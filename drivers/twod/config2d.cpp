@@ -90,7 +90,7 @@ void GameConfig2D::load(const lurp::ScriptBridge& bridge)
 		for (lurp::TableIt it(L, -1); !it.done(); it.next()) {
 			if (it.kType() == LUA_TNUMBER && it.vType() == LUA_TTABLE) {
 				GameRegion r;
-				r.name = lurp::ScriptBridge::getField(L, "", 1).str;
+				r.name = lurp::ScriptBridge::getField(L, "", 1).str();
 				r.position = bridge.GetRectField("pos", lurp::Rect{0, 0, 0, 0});
 				r.image = bridge.getStrField("image", "");
 				r.textColor = bridge.GetColorField("fg", r.textColor);
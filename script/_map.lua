@@ -330,29 +330,16 @@ local function CoreTable(e)
     ePrime.items = nil
 
     -- Special values
-    ePrime._src = e -- the original source table, which is used to fall back from a CoreGet
     ePrime._isCoreTable = true -- general debugging check
 
     assert(ePrime.entityID, "Must have an entityID to construct a core table")
-    return setmetatable(ePrime, {
-        __index = function(t, key)
-            -- print("__index", t.entityID, key)
-            -- the core can have a value set to nil, and that
-            -- overrides the default. this necessitates returning
-            -- 'okay' if the core has the value separate from the value
-            local okay, v = CCoreGet(t.entityID, key)
-            if okay then return v end
-            -- if not in the core, return the immutable source value
-            return t._src[key]
-        end,
-        __newindex = function(t, key, value)
-            -- print("__newindex", t.entityID, key, value)
-            CCoreSet(t.entityID, key, value, false)
-        end,
-    })
+    -- __index reads the core, and falls back to the source table 'e'.
+    -- __newindex writes the core. Both are in C: see ScriptBridge::l_CCoreTable
+    return CCoreTable(ePrime, e)
 end
 
-local coreCache = {}
+-- A global, not a local, so that each session (see ScriptBridge) has its own.
+CoreCache = {}
 function Entity(entityID)
     if Entities[entityID] == nil then
         print("[ERROR] Entity '"..entityID.."' not found.")
@@ -360,12 +347,13 @@ function Entity(entityID)
     assert(entityID ~= nil, "entityID required")
     assert(Entities[entityID] ~= nil, "entityID not found")
 
-    local t = coreCache[entityID]
+    if not CoreCache then CoreCache = {} end
+    local t = CoreCache[entityID]
     if not t then
         t = CoreTable(Entities[entityID])
-        coreCache[entityID] = t
+        CoreCache[entityID] = t
     end
-    assert(t._isCoreTable, "coreCache returned table that is not a core table")
+    assert(t._isCoreTable, "CoreCache returned table that is not a core table")
     return t
 end
 
@@ -412,7 +400,7 @@ end
 function ClearScriptEnv()
     --print("ClearScriptEnv", script, player, npc, zone, room)
     assert(script._isCoreTable, "script is not a core table")
-    coreCache[script.entityID] = nil
+    CoreCache[script.entityID] = nil
     script = nil
     player = nil
     npc = nil
@@ -428,5 +416,6 @@ _TestFuncCallbacks = function ()
     CNumItems("none", "none")
     CCoreSet("none", "none", 3, false)
     CCoreGet("none", "none")
+    CCoreTable({ entityID = "none" }, {})
 end
 
@@ -100,5 +100,44 @@ Zone {
             name = "CHEST_02_B",
             items = { "KEY_01"},
         }
+    },
+    Room {
+        entityID = "TEST_ROOM_EVALS",
+        name = "EvalRoom",
+
+        Container { name = "EVAL_CHEST_A", eval = function() return player.evalFlag == true end },
+        Container { name = "EVAL_CHEST_B", eval = function() return room.entityID == "TEST_ROOM_EVALS" end },
+        Container { name = "EVAL_CHEST_C", eval = function() return zone.name == "TestZone2" end },
+        Interaction { name = "EVAL_INTERACTION_A", eval = function() return not player.evalFlag end,
+            next = Script { Text { "Not yet." } } },
+        Interaction { name = "EVAL_INTERACTION_B", eval = function() return room.name == "EvalRoom" end,
+            next = Script { Text { "In the room." } } },
+    }
+}
+Zone {
+    entityID = "TEST_ZONE_3",
+    name = "TestZone3",
+    Room {
+        entityID = "TEST_ROOM_3",
+        name = "Gatehouse",
+        Interaction {
+            entityID = "TEST_GATEKEEPER",
+            required = true,
+            next = Script {
+                Text {
+                    code = function()
+                        player.visits = (player.visits or 0) + 1
+                        player.roll = Rand.random(1, 100)
+                        player:addItem("GOLD")
+                    end,
+                    { s="narrator", "The gatekeeper hands you a coin." },
+                    { s="narrator", "Visit {player.visits}." },
+                },
+                Choices {
+                    { text = "Thank the gatekeeper", code = function() player.polite = true end },
+                    { text = "Walk on" },
+                },
+            }
+        }
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+#include "lua.hpp"
+#include "defs.h"
+
+#include <fmt/core.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <functional>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace lurp {
+
+// The value at the top of the stack, written to 'v'. Returns false if it is the wrong type.
+inline bool SchemaRead(lua_State* L, std::string& v)
+{
+	if (lua_type(L, -1) != LUA_TSTRING) return false;
+	size_t len = 0;
+	const char* s = lua_tolstring(L, -1, &len);
+	v.assign(s, len);
+	return true;
+}
+
+inline bool SchemaRead(lua_State* L, int& v)
+{
+	if (lua_type(L, -1) != LUA_TNUMBER) return false;
+	v = (int)lua_tonumber(L, -1);
+	return true;
+}
+
+inline bool SchemaRead(lua_State* L, bool& v)
+{
+	if (lua_type(L, -1) != LUA_TBOOLEAN) return false;
+	v = lua_toboolean(L, -1) != 0;
+	return true;
+}
+
+// An EntityID is either a string, or an entity table with an entityID.
+inline bool SchemaRead(lua_State* L, EntityID& v)
+{
+	int t = lua_type(L, -1);
+	if (t == LUA_TSTRING) {
+		v = EntityID(lua_tostring(L, -1));
+		return true;
+	}
+	if (t == LUA_TTABLE) {
+		bool ok = lua_getfield(L, -1, "entityID") == LUA_TSTRING;
+		if (ok) v = EntityID(lua_tostring(L, -1));
+		lua_pop(L, 1);
+		return ok;
+	}
+	return false;
+}
+
+// A function is stored as a registry ref. Anything else is ignored, and leaves -1.
+inline bool SchemaReadFunc(lua_State* L, int& ref)
+{
+	if (lua_type(L, -1) == LUA_TFUNCTION) {
+		lua_pushvalue(L, -1);
+		ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	}
+	return true;
+}
+
+// Reads a Lua table into a T in one pass.
+//
+// Each Field is a key and a function that writes the value (at the top of
+// the stack) into the T. read() walks the table once with lua_next, and
+// matches keys by address: Lua interns short strings, so every "name" in a
+// state is the same string object, and the schema holds a reference to each
+// of its keys. There are no string compares, and no lookup per field. Keys
+// that aren't in the schema, like the array part, go to 'other' if it is set.
+//
+// A schema is bound to the lua_State it was created with.
+template<typename T>
+class AssetSchema {
+public:
+	using ReadFunc = bool (*)(lua_State* L, T& t);
+	using OtherFunc = std::function<bool(lua_State* L, T& t)>;
+
+	struct Field {
+		const char* key;
+		ReadFunc read;
+		bool required = false;
+	};
+
+	// 'type', if set, is the value of the "type" key that isType() checks for.
+	AssetSchema(lua_State* L, const char* type, std::initializer_list<Field> fields, OtherFunc other = {});
+	~AssetSchema();
+
+	AssetSchema(const AssetSchema&) = delete;
+	AssetSchema& operator=(const AssetSchema&) = delete;
+
+	// True if the table at -1 has the schema's type.
+	bool isType() const;
+	// Reads the table at -1 into 't'. Throws on a missing required key, or a value of the wrong type.
+	void read(T& t) const;
+
+	// The common field readers, e.g. { "name", S::Value<&Item::name>, true }
+	template<auto M>
+	static bool Value(lua_State* L, T& t) { return SchemaRead(L, t.*M); }
+	template<auto M>
+	static bool Func(lua_State* L, T& t) { return SchemaReadFunc(L, t.*M); }
+
+private:
+	// LUAI_MAXSHORTLEN; longer strings aren't interned.
+	static constexpr size_t kMaxShortLen = 40;
+
+	struct Entry {
+		const char* interned;
+		const char* key;
+		ReadFunc read;
+	};
+
+	std::string keyName() const;
+	void pushKey(int i) const;
+
+	lua_State* L;
+	int _keysRef = LUA_NOREF;	// table of the interned keys, then "type" and the type
+	int _typeIndex = 0;			// index of "type" in the keys table, or 0 if no type
+	std::vector<Entry> _fields;
+	uint64_t _required = 0;		// bit per field
+	OtherFunc _other;
+};
+
+template<typename T>
+AssetSchema<T>::AssetSchema(lua_State* state, const char* type, std::initializer_list<Field> fields, OtherFunc other) :
+	L(state),
+	_other(std::move(other))
+{
+	assert(fields.size() <= 64);
+	lua_createtable(L, (int)fields.size() + 2, 0);
+	for (const Field& f : fields) {
+		assert(strlen(f.key) <= kMaxShortLen);
+		lua_pushstring(L, f.key);
+		const char* interned = lua_tostring(L, -1);
+		lua_rawseti(L, -2, (lua_Integer)_fields.size() + 1);
+
+		if (f.required) _required |= uint64_t(1) << _fields.size();
+		_fields.push_back({ interned, f.key, f.read });
+	}
+	if (type) {
+		_typeIndex = (int)_fields.size() + 1;
+		lua_pushstring(L, "type");
+		lua_rawseti(L, -2, _typeIndex);
+		lua_pushstring(L, type);
+		lua_rawseti(L, -2, _typeIndex + 1);
+	}
+	_keysRef = luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+template<typename T>
+AssetSchema<T>::~AssetSchema()
+{
+	luaL_unref(L, LUA_REGISTRYINDEX, _keysRef);
+}
+
+template<typename T>
+void AssetSchema<T>::pushKey(int i) const
+{
+	lua_rawgeti(L, LUA_REGISTRYINDEX, _keysRef);
+	lua_rawgeti(L, -1, i);
+	lua_remove(L, -2);
+}
+
+template<typename T>
+bool AssetSchema<T>::isType() const
+{
+	assert(_typeIndex > 0);
+	if (lua_type(L, -1) != LUA_TTABLE) return false;
+
+	pushKey(_typeIndex);		// -1 "type", -2 table
+	lua_rawget(L, -2);			// -1 value, -2 table
+	pushKey(_typeIndex + 1);	// -1 type, -2 value, -3 table
+	bool result = lua_rawequal(L, -1, -2) != 0;
+	lua_pop(L, 2);
+	return result;
+}
+
+template<typename T>
+std::string AssetSchema<T>::keyName() const
+{
+	if (lua_type(L, -2) == LUA_TSTRING)
+		return lua_tostring(L, -2);
+	if (lua_type(L, -2) == LUA_TNUMBER)
+		return fmt::format("{}", lua_tointeger(L, -2));
+	return lua_typename(L, lua_type(L, -2));
+}
+
+template<typename T>
+void AssetSchema<T>::read(T& t) const
+{
+	assert(lua_type(L, -1) == LUA_TTABLE);
+	uint64_t found = 0;
+
+	lua_pushnil(L);						// -1 nil, -2 table
+	while (lua_next(L, -2)) {			// -1 value, -2 key, -3 table
+		bool ok = true;
+		size_t i = _fields.size();
+		if (lua_type(L, -2) == LUA_TSTRING) {
+			const char* key = lua_tostring(L, -2);
+			for (i = 0; i < _fields.size() && _fields[i].interned != key; i++) {}
+		}
+		if (i < _fields.size()) {
+			ok = _fields[i].read(L, t);
+			found |= uint64_t(1) << i;
+		}
+		else if (_other) {
+			ok = _other(L, t);
+		}
+		if (!ok) {
+			std::string msg = fmt::format("Unexpected {} for key '{}'", lua_typename(L, lua_type(L, -1)), keyName());
+			lua_pop(L, 2);
+			throw std::runtime_error(msg);
+		}
+		lua_pop(L, 1);					// -1 key, -2 table
+	}
+
+	uint64_t missing = _required & ~found;
+	if (missing) {
+		for (size_t i = 0; i < _fields.size(); i++) {
+			if (missing & (uint64_t(1) << i))
+				throw std::runtime_error(fmt::format("No value for required key '{}'", _fields[i].key));
+		}
+	}
+}
+
+} // namespace lurp
@@ -0,0 +1,85 @@
+#include "autosave.h"
+#include "savefile.h"
+#include "zonedriver.h"
+#include "binio.h"
+
+#include <plog/Log.h>
+
+namespace lurp {
+
+AutoSave::AutoSave(const std::filesystem::path& path, bool compress) :
+	_path(path),
+	_compress(compress),
+	_thread(&AutoSave::run, this)
+{
+}
+
+AutoSave::~AutoSave()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_quit = true;
+	}
+	_cond.notify_all();
+	_thread.join();
+}
+
+void AutoSave::save(const ZoneDriver& driver)
+{
+	BinWriter w;
+	driver.save(w);
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_pending = w.buffer();
+		_hasPending = true;
+	}
+	_cond.notify_all();
+}
+
+void AutoSave::flush()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_cond.wait(lock, [this] { return !_hasPending && !_busy; });
+}
+
+int AutoSave::numWritten() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _nWritten;
+}
+
+int AutoSave::numFailed() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _nFailed;
+}
+
+void AutoSave::run()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true) {
+		_cond.wait(lock, [this] { return _quit || _hasPending; });
+		if (!_hasPending)
+			break;	// quit, and nothing left to write
+
+		std::vector<uint8_t> sections;
+		sections.swap(_pending);
+		_hasPending = false;
+		_busy = true;
+		lock.unlock();
+
+		std::vector<uint8_t> data = SaveFile::encode(sections.data(), sections.size(), _compress);
+		bool ok = SaveFile::writeFile(_path, data);
+		if (!ok)
+			PLOG(plog::error) << "Auto-save to '" << _path.string() << "' failed";
+
+		lock.lock();
+		_busy = false;
+		if (ok) _nWritten++;
+		else _nFailed++;
+		_cond.notify_all();
+	}
+}
+
+} // namespace lurp
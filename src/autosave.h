@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace lurp {
+
+class ZoneDriver;
+
+// Background saving. save() takes an in-memory snapshot of the game state
+// (the binary save sections; see ZoneDriver::save(BinWriter&)) on the calling
+// thread, which is fast. A worker thread then compresses it, writes it to disk,
+// and atomically replaces the old save (SaveFile::writeFile), so the game
+// thread never waits on disk I/O and a crash can't corrupt the previous save.
+class AutoSave {
+public:
+	AutoSave(const std::filesystem::path& path, bool compress = true);
+	~AutoSave();	// finishes any pending write
+
+	AutoSave(const AutoSave&) = delete;
+	AutoSave& operator=(const AutoSave&) = delete;
+
+	// Snapshots the driver and queues the write. If a write is still pending,
+	// the newer snapshot replaces it.
+	void save(const ZoneDriver& driver);
+	// Blocks until all queued saves are on disk.
+	void flush();
+
+	const std::filesystem::path& path() const { return _path; }
+	int numWritten() const;
+	int numFailed() const;
+
+private:
+	void run();
+
+	const std::filesystem::path _path;
+	const bool _compress;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _cond;
+	std::vector<uint8_t> _pending;
+	bool _hasPending = false;
+	bool _busy = false;
+	bool _quit = false;
+	int _nWritten = 0;
+	int _nFailed = 0;
+
+	std::thread _thread;	// last, so it starts after everything else is initialized
+};
+
+} // namespace lurp
@@ -427,9 +427,9 @@ SWCombatant SWCombatant::convert(const lurp::Actor& c, const ScriptAssets& asset
 	r.name = c.name;
 	r.wild = c.wild;
 
-	int fighting = (int) bind.get(c.entityID + "." + "fighting").num;
-	int shooting = (int) bind.get(c.entityID + "." + "shooting").num;
-	int arcane = (int) bind.get(c.entityID + "." + "arcane").num;
+	int fighting = (int) bind.get(VarPath(c.entityID, "fighting")).num();
+	int shooting = (int) bind.get(VarPath(c.entityID, "shooting")).num();
+	int arcane = (int) bind.get(VarPath(c.entityID, "arcane")).num();
 
 	r.fighting = convertFromSkill(fighting);
 	r.shooting = convertFromSkill(shooting);
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+namespace lurp {
+
+// A 4 character tag, for magic numbers and section names: BinTag("LRPB")
+constexpr uint32_t BinTag(const char (&s)[5]) {
+	return uint32_t(uint8_t(s[0])) | (uint32_t(uint8_t(s[1])) << 8) | (uint32_t(uint8_t(s[2])) << 16) | (uint32_t(uint8_t(s[3])) << 24);
+}
+
+// Simple little-endian binary writer. Everything is appended to an in-memory buffer
+// which is then written out in one go.
+class BinWriter {
+public:
+	void u8(uint8_t v) { _buf.push_back(v); }
+	void u32(uint32_t v) {
+		for (int i = 0; i < 4; i++) _buf.push_back(uint8_t(v >> (i * 8)));
+	}
+	void u64(uint64_t v) {
+		for (int i = 0; i < 8; i++) _buf.push_back(uint8_t(v >> (i * 8)));
+	}
+	void i32(int32_t v) { u32(uint32_t(v)); }
+	void f64(double v) {
+		uint64_t u;
+		memcpy(&u, &v, sizeof(u));
+		u64(u);
+	}
+	void boolean(bool b) { u8(b ? 1 : 0); }
+	void str(std::string_view s) {
+		u32(uint32_t(s.size()));
+		write(s.data(), s.size());
+	}
+	void write(const void* data, size_t n) {
+		const uint8_t* p = (const uint8_t*)data;
+		_buf.insert(_buf.end(), p, p + n);
+	}
+
+	// A section is a tag and a size, followed by the contents. Readers can find
+	// a section by tag, and skip the ones they don't know.
+	size_t beginSection(uint32_t tag) {
+		u32(tag);
+		size_t pos = _buf.size();
+		u32(0);
+		return pos;
+	}
+	void endSection(size_t pos) {
+		uint32_t n = uint32_t(_buf.size() - pos - 4);
+		for (int i = 0; i < 4; i++) _buf[pos + i] = uint8_t(n >> (i * 8));
+	}
+
+	size_t size() const { return _buf.size(); }
+	const std::vector<uint8_t>& buffer() const { return _buf; }
+
+private:
+	std::vector<uint8_t> _buf;
+};
+
+// Bounds checked reader over a buffer (typically a memory mapped file).
+// Reading past the end doesn't throw; it sets the error state and returns
+// zero / empty, so a truncated or corrupt file can be detected with a single
+// ok() check once reading is done.
+class BinReader {
+public:
+	BinReader(const uint8_t* data, size_t size) : _data(data), _size(size) {}
+
+	uint8_t u8() {
+		if (!check(1)) return 0;
+		return _data[_pos++];
+	}
+	uint32_t u32() {
+		if (!check(4)) return 0;
+		uint32_t v = 0;
+		for (int i = 0; i < 4; i++) v |= uint32_t(_data[_pos++]) << (i * 8);
+		return v;
+	}
+	uint64_t u64() {
+		if (!check(8)) return 0;
+		uint64_t v = 0;
+		for (int i = 0; i < 8; i++) v |= uint64_t(_data[_pos++]) << (i * 8);
+		return v;
+	}
+	int32_t i32() { return int32_t(u32()); }
+	double f64() {
+		uint64_t u = u64();
+		double v;
+		memcpy(&v, &u, sizeof(v));
+		return v;
+	}
+	bool boolean() { return u8() != 0; }
+
+	// Note the view points into the underlying buffer; it is only valid as long as the buffer is.
+	std::string_view str() {
+		uint32_t n = u32();
+		if (!check(n)) return {};
+		std::string_view sv((const char*)_data + _pos, n);
+		_pos += n;
+		return sv;
+	}
+
+	// Returns the next 'n' bytes (and skips over them), or null if there aren't enough.
+	const uint8_t* bytes(size_t n) {
+		if (!check(n)) return nullptr;
+		const uint8_t* p = _data + _pos;
+		_pos += n;
+		return p;
+	}
+
+	// Read a count that is about to be used to size a container. Each element takes
+	// at least 'minBytes', so a count larger than the remaining data is an error.
+	uint32_t count(size_t minBytes = 1) {
+		uint32_t n = u32();
+		if (_ok && minBytes && size_t(n) > (_size - _pos) / minBytes) _ok = false;
+		return _ok ? n : 0;
+	}
+
+	// Finds the section 'tag' (see BinWriter::beginSection) in this buffer, and
+	// returns a reader over its contents. The returned reader is not ok() if the
+	// section isn't found.
+	BinReader section(uint32_t tag) const {
+		BinReader r(_data, _size);
+		while (r.ok() && !r.done()) {
+			uint32_t t = r.u32();
+			uint32_t n = r.u32();
+			if (!r.check(n)) break;
+			if (t == tag) return BinReader(_data + r._pos, n);
+			r._pos += n;
+		}
+		BinReader missing(nullptr, 0);
+		missing._ok = false;
+		return missing;
+	}
+
+	bool ok() const { return _ok; }
+	bool done() const { return _pos == _size; }
+	size_t pos() const { return _pos; }
+	void fail() { _ok = false; }
+
+private:
+	bool check(size_t n) {
+		if (!_ok || n > _size - _pos) {
+			_ok = false;
+			return false;
+		}
+		return true;
+	}
+
+	const uint8_t* _data;
+	size_t _size;
+	size_t _pos = 0;
+	bool _ok = true;
+};
+
+// De-duplicating string table for binary files. Strings are written once
+// and referenced by index.
+class BinStringTable {
+public:
+	uint32_t add(const std::string& s) {
+		auto it = _map.find(s);
+		if (it != _map.end()) return it->second;
+		uint32_t index = uint32_t(_strings.size());
+		_strings.push_back(s);
+		_map[s] = index;
+		return index;
+	}
+
+	void write(BinWriter& w) const {
+		w.u32(uint32_t(_strings.size()));
+		for (const std::string& s : _strings) w.str(s);
+	}
+
+	static std::vector<std::string_view> read(BinReader& r) {
+		std::vector<std::string_view> strings;
+		uint32_t n = r.count(4);
+		strings.reserve(n);
+		for (uint32_t i = 0; i < n && r.ok(); i++) strings.push_back(r.str());
+		return strings;
+	}
+
+private:
+	std::vector<std::string> _strings;
+	std::unordered_map<std::string, uint32_t> _map;
+};
+
+} // namespace lurp
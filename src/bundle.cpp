@@ -0,0 +1,604 @@
+#include "bundle.h"
+#include "binio.h"
+#include "scriptasset.h"
+#include "SpookyV2.h"
+#include "../drivers/platform.h"
+
+#include <plog/Log.h>
+#include <fmt/core.h>
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <map>
+
+namespace lurp {
+
+static constexpr uint32_t kEndMarker = 0x444e454c;	// "LEND"
+
+class BundleWriter {
+public:
+	BundleWriter(const ConstScriptAssets& csa) : _csa(csa) {}
+
+	BinWriter w;
+	BinStringTable strings;
+
+	void str(const std::string& s) { w.u32(strings.add(s)); }
+	void func(int func) { w.i32(func); }
+	void inventory(const Inventory& inv);
+	void ids(const std::vector<EntityID>& v) {
+		w.u32(uint32_t(v.size()));
+		for (const EntityID& id : v) str(id);
+	}
+
+private:
+	const ConstScriptAssets& _csa;
+};
+
+class BundleReader {
+public:
+	BundleReader(BinReader& r, ConstScriptAssets& csa) : r(r), csa(csa) {}
+
+	BinReader& r;
+	ConstScriptAssets& csa;
+	std::vector<std::string_view> strings;
+	int nFuncs = 0;
+
+	std::string str() {
+		uint32_t i = r.u32();
+		if (i >= strings.size()) {
+			r.fail();
+			return {};
+		}
+		return std::string(strings[i]);
+	}
+	int func() {
+		int32_t i = r.i32();
+		if (i < -1 || i >= nFuncs) {
+			r.fail();
+			return -1;
+		}
+		return i;
+	}
+	// An enum written as a u8. Values past 'last' fail the read.
+	template<typename E>
+	E u8Enum(E last) {
+		uint8_t v = r.u8();
+		if (v > uint8_t(last)) {
+			r.fail();
+			return E(0);
+		}
+		return E(v);
+	}
+	Inventory inventory();
+	std::vector<EntityID> ids() {
+		std::vector<EntityID> v;
+		uint32_t n = r.count(4);
+		v.reserve(n);
+		for (uint32_t i = 0; i < n && r.ok(); i++) v.push_back(str());
+		return v;
+	}
+};
+
+void BundleWriter::inventory(const Inventory& inv)
+{
+	w.u32(uint32_t(inv.items().size()));
+	for (const ItemRef& ref : inv.items()) {
+		// Items are stored by index, so loading doesn't need to look them up by name.
+		size_t index = ref.pItem - _csa.items.data();
+		assert(index < _csa.items.size());
+		w.u32(uint32_t(index));
+		w.i32(ref.count);
+	}
+}
+
+Inventory BundleReader::inventory()
+{
+	Inventory inv;
+	uint32_t n = r.count(8);
+	for (uint32_t i = 0; i < n && r.ok(); i++) {
+		uint32_t index = r.u32();
+		int count = r.i32();
+		if (index >= csa.items.size()) {
+			r.fail();
+			break;
+		}
+		inv.addItem(csa.items[index], count);
+	}
+	return inv;
+}
+
+static void Write(BundleWriter& b, const Script& s)
+{
+	b.str(s.entityID);
+	b.str(s.npc);
+	b.func(s.code);
+	b.w.u32(uint32_t(s.events.size()));
+	for (const Script::Event& e : s.events) {
+		b.str(e.entityID);
+		b.w.u8(uint8_t(e.type));
+	}
+}
+
+static void Read(BundleReader& b, Script& s)
+{
+	s.entityID = b.str();
+	s.npc = b.str();
+	s.code = b.func();
+	uint32_t n = b.r.count(5);
+	s.events.resize(n);
+	for (Script::Event& e : s.events) {
+		e.entityID = b.str();
+		e.type = ScriptType(b.r.u8());
+		// The types ScriptBridge reads as events; anything else is corrupt.
+		if (e.type != ScriptType::kScript && e.type != ScriptType::kText && e.type != ScriptType::kChoices
+			&& e.type != ScriptType::kBattle && e.type != ScriptType::kCallScript)
+		{
+			b.r.fail();
+			e.type = ScriptType::kNone;
+		}
+	}
+}
+
+static void Write(BundleWriter& b, const Text& t)
+{
+	b.str(t.entityID);
+	b.func(t.eval);
+	b.str(t.test);
+	b.func(t.code);
+	b.w.u32(uint32_t(t.lines.size()));
+	for (const Text::Line& line : t.lines) {
+		b.str(line.speaker);
+		b.str(line.text);
+		b.func(line.eval);
+		b.str(line.test);
+		b.func(line.code);
+	}
+}
+
+static void Read(BundleReader& b, Text& t)
+{
+	t.entityID = b.str();
+	t.eval = b.func();
+	t.test = b.str();
+	t.code = b.func();
+	uint32_t n = b.r.count(20);
+	t.lines.resize(n);
+	for (Text::Line& line : t.lines) {
+		line.speaker = b.str();
+		line.text = b.str();
+		line.eval = b.func();
+		line.test = b.str();
+		line.code = b.func();
+	}
+}
+
+static void Write(BundleWriter& b, const Choices& c)
+{
+	b.str(c.entityID);
+	b.w.u8(uint8_t(c.action));
+	b.w.u32(uint32_t(c.choices.size()));
+	for (const Choices::Choice& choice : c.choices) {
+		b.str(choice.text);
+		b.str(choice.next);
+		b.func(choice.eval);
+		b.func(choice.code);
+	}
+}
+
+static void Read(BundleReader& b, Choices& c)
+{
+	c.entityID = b.str();
+	c.action = b.u8Enum(Choices::Action::kPop);
+	uint32_t n = b.r.count(16);
+	c.choices.resize(n);
+	for (Choices::Choice& choice : c.choices) {
+		choice.text = b.str();
+		choice.next = b.str();
+		choice.eval = b.func();
+		choice.code = b.func();
+	}
+}
+
+static void Write(BundleWriter& b, const Item& item)
+{
+	b.str(item.entityID);
+	b.str(item.name);
+	b.str(item.desc);
+	b.w.i32(item.range);
+	b.w.i32(item.armor);
+	b.w.i32(item.ap);
+	b.w.i32(item.damage.n);
+	b.w.i32(item.damage.d);
+	b.w.i32(item.damage.b);
+}
+
+static void Read(BundleReader& b, Item& item)
+{
+	item.entityID = b.str();
+	item.name = b.str();
+	item.desc = b.str();
+	item.range = b.r.i32();
+	item.armor = b.r.i32();
+	item.ap = b.r.i32();
+	item.damage.n = b.r.i32();
+	item.damage.d = b.r.i32();
+	item.damage.b = b.r.i32();
+}
+
+static void Write(BundleWriter& b, const Power& p)
+{
+	b.str(p.entityID);
+	b.str(p.name);
+	b.str(p.effect);
+	b.w.i32(p.cost);
+	b.w.i32(p.range);
+	b.w.i32(p.strength);
+	b.w.boolean(p.region);
+}
+
+static void Read(BundleReader& b, Power& p)
+{
+	p.entityID = b.str();
+	p.name = b.str();
+	p.effect = b.str();
+	p.cost = b.r.i32();
+	p.range = b.r.i32();
+	p.strength = b.r.i32();
+	p.region = b.r.boolean();
+}
+
+static void Write(BundleWriter& b, const Interaction& i)
+{
+	b.str(i.entityID);
+	b.str(i.name);
+	b.str(i.next);
+	b.str(i.npc);
+	b.func(i.eval);
+	b.func(i.code);
+	b.w.boolean(i.required);
+}
+
+static void Read(BundleReader& b, Interaction& i)
+{
+	i.entityID = b.str();
+	i.name = b.str();
+	i.next = b.str();
+	i.npc = b.str();
+	i.eval = b.func();
+	i.code = b.func();
+	i.required = b.r.boolean();
+}
+
+static void Write(BundleWriter& b, const Room& r)
+{
+	b.str(r.entityID);
+	b.str(r.name);
+	b.str(r.desc);
+	b.ids(r.objects);
+}
+
+static void Read(BundleReader& b, Room& r)
+{
+	r.entityID = b.str();
+	r.name = b.str();
+	r.desc = b.str();
+	r.objects = b.ids();
+}
+
+static void Write(BundleWriter& b, const Zone& z)
+{
+	b.str(z.entityID);
+	b.str(z.name);
+	b.ids(z.objects);
+}
+
+static void Read(BundleReader& b, Zone& z)
+{
+	z.entityID = b.str();
+	z.name = b.str();
+	z.objects = b.ids();
+}
+
+static void Write(BundleWriter& b, const Actor& a)
+{
+	b.str(a.entityID);
+	b.str(a.name);
+	b.w.boolean(a.wild);
+	b.w.i32(a.fighting);
+	b.w.i32(a.shooting);
+	b.w.i32(a.arcane);
+	b.inventory(a.inventory);
+	b.ids(a.powers);
+}
+
+static void Read(BundleReader& b, Actor& a)
+{
+	a.entityID = b.str();
+	a.name = b.str();
+	a.wild = b.r.boolean();
+	a.fighting = b.r.i32();
+	a.shooting = b.r.i32();
+	a.arcane = b.r.i32();
+	a.inventory = b.inventory();
+	a.powers = b.ids();
+}
+
+static void Write(BundleWriter& b, const Combatant& c)
+{
+	b.str(c.entityID);
+	b.str(c.name);
+	b.w.boolean(c.wild);
+	b.w.i32(c.count);
+	b.w.i32(c.fighting);
+	b.w.i32(c.shooting);
+	b.w.i32(c.arcane);
+	b.w.i32(c.bias);
+	b.inventory(c.inventory);
+	b.ids(c.powers);
+}
+
+static void Read(BundleReader& b, Combatant& c)
+{
+	c.entityID = b.str();
+	c.name = b.str();
+	c.wild = b.r.boolean();
+	c.count = b.r.i32();
+	c.fighting = b.r.i32();
+	c.shooting = b.r.i32();
+	c.arcane = b.r.i32();
+	c.bias = b.r.i32();
+	c.inventory = b.inventory();
+	c.powers = b.ids();
+}
+
+static void Write(BundleWriter& b, const Battle& battle)
+{
+	b.str(battle.entityID);
+	b.str(battle.name);
+	b.w.u32(uint32_t(battle.regions.size()));
+	for (const swbattle::Region& r : battle.regions) {
+		b.str(r.name);
+		b.w.i32(r.yards);
+		b.w.u8(uint8_t(r.cover));
+	}
+	b.ids(battle.combatants);
+}
+
+static void Read(BundleReader& b, Battle& battle)
+{
+	battle.entityID = b.str();
+	battle.name = b.str();
+	uint32_t n = b.r.count(9);
+	battle.regions.resize(n);
+	for (swbattle::Region& r : battle.regions) {
+		r.name = b.str();
+		r.yards = b.r.i32();
+		r.cover = b.u8Enum(swbattle::Cover::kFullCover);
+	}
+	battle.combatants = b.ids();
+}
+
+static void Write(BundleWriter& b, const Container& c)
+{
+	b.str(c.entityID);
+	b.str(c.name);
+	b.func(c.eval);
+	b.w.boolean(c.locked);
+	b.str(c.key);
+	b.inventory(c.inventory);
+}
+
+static void Read(BundleReader& b, Container& c)
+{
+	c.entityID = b.str();
+	c.name = b.str();
+	c.eval = b.func();
+	c.locked = b.r.boolean();
+	c.key = b.str();
+	c.inventory = b.inventory();
+}
+
+static void Write(BundleWriter& b, const Edge& e)
+{
+	b.str(e.entityID);
+	b.str(e.name);
+	b.w.u8(uint8_t(e.dir));
+	b.str(e.room1);
+	b.str(e.room2);
+	b.str(e.key);
+	b.w.boolean(e.locked);
+}
+
+static void Read(BundleReader& b, Edge& e)
+{
+	e.entityID = b.str();
+	e.name = b.str();
+	e.dir = b.u8Enum(Edge::Dir::kUnknown);
+	e.room1 = b.str();
+	e.room2 = b.str();
+	e.key = b.str();
+	e.locked = b.r.boolean();
+}
+
+static void Write(BundleWriter& b, const CallScript& cs)
+{
+	b.str(cs.entityID);
+	b.str(cs.scriptID);
+	b.str(cs.npc);
+	b.func(cs.code);
+	b.func(cs.eval);
+}
+
+static void Read(BundleReader& b, CallScript& cs)
+{
+	cs.entityID = b.str();
+	cs.scriptID = b.str();
+	cs.npc = b.str();
+	cs.code = b.func();
+	cs.eval = b.func();
+}
+
+template<typename T>
+static void WriteVec(BundleWriter& b, const std::vector<T>& vec)
+{
+	b.w.u32(uint32_t(vec.size()));
+	for (const T& t : vec) Write(b, t);
+}
+
+template<typename T>
+static void ReadVec(BundleReader& b, std::vector<T>& vec)
+{
+	// Every entity has at least an entityID.
+	uint32_t n = b.r.count(4);
+	vec.resize(n);
+	for (size_t i = 0; i < vec.size() && b.r.ok(); i++) Read(b, vec[i]);
+}
+
+/*static*/ std::filesystem::path Bundle::path(const std::string& gameFile)
+{
+	std::filesystem::path p = gameFile;
+	p.replace_extension(".lurpb");
+	return p;
+}
+
+static void HashFile(SpookyHash& spooky, const std::filesystem::path& path)
+{
+	std::ifstream stream(path, std::ios::in | std::ios::binary);
+	std::stringstream buffer;
+	buffer << stream.rdbuf();
+	std::string data = buffer.str();
+
+	std::string name = path.generic_string();
+	spooky.Update(name.data(), name.size());
+	spooky.Update(data.data(), data.size());
+}
+
+/*static*/ uint64_t Bundle::contentHash(const std::vector<std::string>& files)
+{
+	SpookyHash spooky;
+	spooky.Init(kVersion, 0);
+	for (const std::string& f : files) HashFile(spooky, f);
+
+	uint64_t h1 = 0, h2 = 0;
+	spooky.Final(&h1, &h2);
+	return h1;
+}
+
+static std::vector<std::string> ReadSourceFiles(BinReader& r)
+{
+	std::vector<std::string> files;
+	uint32_t n = r.count(4);
+	for (uint32_t i = 0; i < n && r.ok(); i++) files.emplace_back(r.str());
+	return files;
+}
+
+/*static*/ bool Bundle::write(const std::filesystem::path& path, const ConstScriptAssets& csa, const std::vector<std::string>& files)
+{
+	BundleWriter b(csa);
+	WriteVec(b, csa.scripts);
+	WriteVec(b, csa.texts);
+	WriteVec(b, csa.choices);
+	WriteVec(b, csa.items);
+	WriteVec(b, csa.powers);
+	WriteVec(b, csa.interactions);
+	WriteVec(b, csa.rooms);
+	WriteVec(b, csa.zones);
+	WriteVec(b, csa.actors);
+	WriteVec(b, csa.combatants);
+	WriteVec(b, csa.battles);
+	WriteVec(b, csa.containers);
+	WriteVec(b, csa.edges);
+	WriteVec(b, csa.callScripts);
+	b.w.u32(kEndMarker);
+
+	BinWriter funcs;
+	funcs.u32(uint32_t(csa.funcs.size()));
+	for (const FuncPath& fp : csa.funcs) {
+		funcs.u32(b.strings.add(fp.table));
+		funcs.u32(b.strings.add(fp.entityID));
+		funcs.i32(fp.index);
+		funcs.u32(b.strings.add(fp.key));
+	}
+
+	BinWriter header;
+	header.u32(kMagic);
+	header.u32(kVersion);
+	header.u32(uint32_t(files.size()));
+	for (const std::string& f : files) header.str(f);
+	header.u64(contentHash(files));
+	b.strings.write(header);
+
+	std::ofstream stream(path, std::ios::out | std::ios::binary);
+	if (!stream.is_open()) {
+		PLOG(plog::error) << fmt::format("Could not open bundle '{}' for writing", path.string());
+		return false;
+	}
+	stream.write((const char*)header.buffer().data(), header.size());
+	stream.write((const char*)funcs.buffer().data(), funcs.size());
+	stream.write((const char*)b.w.buffer().data(), b.w.size());
+	PLOG(plog::info) << fmt::format("Bundle '{}' written: {} KB, {} functions",
+		path.string(), (header.size() + funcs.size() + b.w.size()) / 1024, csa.funcs.size());
+	return stream.good();
+}
+
+/*static*/ std::vector<std::string> Bundle::sourceFiles(const uint8_t* data, size_t size)
+{
+	BinReader r(data, size);
+	if (r.u32() != kMagic || r.u32() != kVersion)
+		return {};
+	std::vector<std::string> files = ReadSourceFiles(r);
+	return r.ok() ? files : std::vector<std::string>();
+}
+
+/*static*/ bool Bundle::read(const uint8_t* data, size_t size, ConstScriptAssets& csa)
+{
+	BinReader r(data, size);
+	if (r.u32() != kMagic || r.u32() != kVersion)
+		return false;
+	std::vector<std::string> files = ReadSourceFiles(r);
+	if (!r.ok() || files.empty())
+		return false;
+	if (r.u64() != contentHash(files)) {
+		PLOG(plog::info) << "Bundle is out of date.";
+		return false;
+	}
+
+	BundleReader b(r, csa);
+	b.strings = BinStringTable::read(r);
+
+	uint32_t nFuncs = r.count(16);
+	csa.funcs.resize(nFuncs);
+	for (FuncPath& fp : csa.funcs) {
+		fp.table = b.str();
+		fp.entityID = b.str();
+		fp.index = r.i32();
+		fp.key = b.str();
+	}
+	b.nFuncs = (int)nFuncs;
+
+	ReadVec(b, csa.scripts);
+	ReadVec(b, csa.texts);
+	ReadVec(b, csa.choices);
+	// Items must be read before anything with an inventory.
+	ReadVec(b, csa.items);
+	ReadVec(b, csa.powers);
+	ReadVec(b, csa.interactions);
+	ReadVec(b, csa.rooms);
+	ReadVec(b, csa.zones);
+	ReadVec(b, csa.actors);
+	ReadVec(b, csa.combatants);
+	ReadVec(b, csa.battles);
+	ReadVec(b, csa.containers);
+	ReadVec(b, csa.edges);
+	ReadVec(b, csa.callScripts);
+
+	if (r.u32() != kEndMarker || !r.ok() || !r.done()) {
+		PLOG(plog::error) << "Bundle is corrupt.";
+		csa = ConstScriptAssets();
+		return false;
+	}
+	return true;
+}
+
+} // namespace lurp
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "defs.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <filesystem>
+
+namespace lurp {
+
+struct ConstScriptAssets;
+
+// A bundle is a compiled, binary image of the ConstScriptAssets for a game. Loading
+// it skips walking the Lua asset tables and parsing markdown at startup.
+//
+// The game file itself still has to be run: the eval() and code() functions are
+// Lua closures. They are found with the FuncPaths stored in the bundle.
+//
+// Layout (little endian):
+//   header: magic, version, source files, content hash
+//   string table: every string in the bundle, de-duplicated
+//   function table: FuncPath for every function
+//   asset arrays: in ConstScriptAssets order, strings and functions by index
+//   end marker
+struct Bundle {
+	static constexpr uint32_t kMagic = 0x4250524c;	// "LRPB"
+	static constexpr uint32_t kVersion = 2;
+
+	// game/chullu/chullu.lua -> game/chullu/chullu.lurpb
+	static std::filesystem::path path(const std::string& gameFile);
+
+	// Hash of the bundle version and the source files: script/_map.lua, the game
+	// file, and the files it loaded (see LuaBridge::sourceFiles()). A change to
+	// any of them invalidates the bundle.
+	static uint64_t contentHash(const std::vector<std::string>& files);
+
+	// Write the (converted) assets, and the source files they were read from.
+	static bool write(const std::filesystem::path& path, const ConstScriptAssets& csa, const std::vector<std::string>& files);
+
+	// The source files a bundle was written from; empty if it is corrupt.
+	static std::vector<std::string> sourceFiles(const uint8_t* data, size_t size);
+
+	// Read assets from a buffer; typically a MappedFile. Returns false if the data
+	// is corrupt or a source file has changed. The assets still need to be index()ed,
+	// and the functions bound to a ScriptBridge.
+	static bool read(const uint8_t* data, size_t size, ConstScriptAssets& csa);
+};
+
+} // namespace lurp
@@ -0,0 +1,240 @@
+#include "chunkcache.h"
+#include "SpookyV2.h"
+#include "../drivers/platform.h"
+
+#include "lua.hpp"
+
+#include <plog/Log.h>
+#include <fmt/core.h>
+
+#include <fstream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace lurp {
+
+/*static*/ ChunkCache& ChunkCache::instance()
+{
+	static ChunkCache cache;
+	return cache;
+}
+
+ChunkCache::ChunkCache()
+{
+	_dir = SavePath("luac", "", false, "").parent_path();
+}
+
+// Lua runs bytecode without checking it, so the cache must be a directory no
+// one else can write to: owned by this user, and not group or world writable.
+static bool IsPrivateDir(const std::filesystem::path& dir)
+{
+#ifdef _WIN32
+	(void)dir;
+	return true;	// the save path is in the user's profile
+#else
+	struct stat st;
+	if (lstat(dir.string().c_str(), &st) != 0) return false;
+	return S_ISDIR(st.st_mode) && st.st_uid == geteuid() && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+#endif
+}
+
+void ChunkCache::setDir(const std::filesystem::path& dir)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_dir = dir;
+}
+
+std::filesystem::path ChunkCache::dir() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _dir;
+}
+
+void ChunkCache::clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_entries.clear();
+}
+
+int ChunkCache::numCompiled() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _nCompiled;
+}
+
+int ChunkCache::numMemoryHits() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _nMemoryHits;
+}
+
+int ChunkCache::numDiskHits() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _nDiskHits;
+}
+
+/*static*/ uint64_t ChunkCache::hash(const void* data, size_t size)
+{
+	return SpookyHash::Hash64(data, size, kVersion);
+}
+
+std::filesystem::path ChunkCache::cachePath(const std::string& key) const
+{
+	return _dir / fmt::format("{:016x}.luac", hash(key.data(), key.size()));
+}
+
+bool ChunkCache::readEntry(const std::string& key, Entry& entry) const
+{
+	if (_dir.empty() || !IsPrivateDir(_dir)) return false;
+
+	MappedFile file(cachePath(key));
+	if (!file.valid()) return false;
+
+	BinReader r(file.data(), file.size());
+	if (r.u32() != kMagic || r.u32() != kVersion || r.u32() != LUA_VERSION_NUM)
+		return false;
+	if (r.str() != key)
+		return false;	// hash collision
+
+	Entry e;
+	e.mtime = (int64_t)r.u64();
+	e.size = r.u64();
+	e.hash = r.u64();
+	uint32_t n = r.u32();
+	uint32_t sum = r.u32();
+	const uint8_t* bytecode = r.bytes(n);
+	// Lua doesn't check bytecode; a bad chunk can crash it.
+	if (!r.ok() || !bytecode || (uint32_t)hash(bytecode, n) != sum)
+		return false;
+
+	e.bytecode.assign(bytecode, bytecode + n);
+	e.valid = true;
+	entry = std::move(e);
+	return true;
+}
+
+void ChunkCache::writeEntry(const std::string& key, const Entry& e) const
+{
+	if (_dir.empty()) return;
+
+	BinWriter w;
+	w.u32(kMagic);
+	w.u32(kVersion);
+	w.u32(LUA_VERSION_NUM);
+	w.str(key);
+	w.u64((uint64_t)e.mtime);
+	w.u64(e.size);
+	w.u64(e.hash);
+	w.u32((uint32_t)e.bytecode.size());
+	w.u32((uint32_t)hash(e.bytecode.data(), e.bytecode.size()));
+	w.write(e.bytecode.data(), e.bytecode.size());
+
+	// Write and rename, so a reader never sees half a file.
+	std::filesystem::path path = cachePath(key);
+	std::filesystem::path tmp = path;
+	tmp += ".tmp";
+
+	std::error_code ec;
+	if (std::filesystem::create_directories(_dir, ec))
+		std::filesystem::permissions(_dir, std::filesystem::perms::owner_all, std::filesystem::perm_options::replace, ec);
+	if (!IsPrivateDir(_dir)) {
+		PLOG(plog::warning) << fmt::format("Lua cache dir '{}' isn't private; not using it", _dir.string());
+		return;
+	}
+	{
+		std::ofstream stream(tmp, std::ios::out | std::ios::binary);
+		stream.write((const char*)w.buffer().data(), w.size());
+		if (!stream) {
+			PLOG(plog::warning) << fmt::format("Could not write Lua cache file '{}'", tmp.string());
+			stream.close();
+			std::filesystem::remove(tmp, ec);
+			return;
+		}
+	}
+	std::filesystem::rename(tmp, path, ec);
+	if (ec) {
+		PLOG(plog::warning) << fmt::format("Could not rename '{}' to '{}': {}", tmp.string(), path.string(), ec.message());
+		std::filesystem::remove(tmp, ec);
+	}
+}
+
+static int DumpWriter(lua_State*, const void* p, size_t size, void* ud)
+{
+	std::vector<uint8_t>* out = (std::vector<uint8_t>*)ud;
+	const uint8_t* bytes = (const uint8_t*)p;
+	out->insert(out->end(), bytes, bytes + size);
+	return 0;
+}
+
+int ChunkCache::load(lua_State* L, const std::string& path)
+{
+	std::error_code ec;
+	std::filesystem::file_time_type mtime = std::filesystem::last_write_time(path, ec);
+	uint64_t size = ec ? 0 : (uint64_t)std::filesystem::file_size(path, ec);
+	std::string key = ec ? std::string() : std::filesystem::absolute(path, ec).generic_string();
+	if (ec) {
+		// Let Lua report the error.
+		return luaL_loadfile(L, path.c_str());
+	}
+	int64_t ticks = (int64_t)mtime.time_since_epoch().count();
+	std::string chunkName = "@" + path;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	Entry& e = _entries[key];
+	bool current = e.valid && e.mtime == ticks && e.size == size;
+	if (current) {
+		_nMemoryHits++;
+	}
+	else {
+		if (readEntry(key, e) && e.mtime == ticks && e.size == size) {
+			current = true;
+			_nDiskHits++;
+		}
+		else {
+			// The file was touched, changed, or isn't in the cache: check the contents.
+			std::ifstream stream(path, std::ios::in | std::ios::binary);
+			std::stringstream buffer;
+			buffer << stream.rdbuf();
+			std::string src = buffer.str();
+			uint64_t h = hash(src.data(), src.size());
+
+			if (e.valid && e.hash == h) {
+				current = true;
+				_nDiskHits++;
+			}
+			else {
+				int error = luaL_loadbuffer(L, src.data(), src.size(), chunkName.c_str());
+				if (error) {
+					_entries.erase(key);
+					return error;
+				}
+				e.bytecode.clear();
+				lua_dump(L, DumpWriter, &e.bytecode, 0);	// keep debug info, for error messages and FuncInfo
+				e.hash = h;
+				e.valid = true;
+				_nCompiled++;
+			}
+			e.mtime = ticks;
+			e.size = size;
+			writeEntry(key, e);
+			if (!current)
+				return LUA_OK;
+		}
+	}
+
+	int error = luaL_loadbufferx(L, (const char*)e.bytecode.data(), e.bytecode.size(), chunkName.c_str(), "b");
+	if (error) {
+		PLOG(plog::warning) << fmt::format("Cached chunk for '{}' didn't load; compiling", path);
+		lua_pop(L, 1);
+		_entries.erase(key);
+		return luaL_loadfile(L, path.c_str());
+	}
+	return LUA_OK;
+}
+
+} // namespace lurp
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "binio.h"
+
+#include <stdint.h>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern "C" struct lua_State;
+
+namespace lurp {
+
+// Compiled Lua chunks, so files that haven't changed aren't parsed and
+// compiled again. LuaBridge::doFile() loads through the cache.
+//
+// There are two levels. In memory, for the life of the process: every
+// ScriptBridge (and so every save load) runs script/_map.lua again. And on
+// disk, in dir(), so the cache lasts between runs. An entry is found by the
+// source path, and is used if the file's mtime and size match, or failing
+// that, if the hash of its contents does. Lua doesn't check bytecode, so the
+// disk cache is only used if dir() is private to the user.
+//
+// Disk layout (little endian):
+//   header: magic, version, LUA_VERSION_NUM, source path, mtime, size, content hash
+//   bytecode: size, checksum, the lua_dump() of the chunk
+// A cache file that is corrupt, or from a different Lua, is ignored.
+class ChunkCache {
+public:
+	static constexpr uint32_t kMagic = BinTag("LRPC");
+	static constexpr uint32_t kVersion = 1;
+
+	static ChunkCache& instance();
+
+	// Pushes the chunk for the Lua file at 'path', like luaL_loadfile(), and
+	// returns the same error codes.
+	int load(lua_State* L, const std::string& path);
+
+	// An empty dir turns off the disk cache. Defaults to "luac" in the save
+	// path; it is created with owner only permissions.
+	void setDir(const std::filesystem::path& dir);
+	std::filesystem::path dir() const;
+	// Clears the memory cache.
+	void clear();
+
+	int numCompiled() const;
+	int numMemoryHits() const;
+	int numDiskHits() const;
+
+private:
+	ChunkCache();
+
+	struct Entry {
+		bool valid = false;
+		int64_t mtime = 0;
+		uint64_t size = 0;
+		uint64_t hash = 0;
+		std::vector<uint8_t> bytecode;
+	};
+
+	static uint64_t hash(const void* data, size_t size);
+	std::filesystem::path cachePath(const std::string& key) const;
+	bool readEntry(const std::string& key, Entry& e) const;
+	void writeEntry(const std::string& key, const Entry& e) const;
+
+	mutable std::mutex _mutex;
+	std::filesystem::path _dir;
+	std::unordered_map<std::string, Entry> _entries;	// by absolute path
+	int _nCompiled = 0;
+	int _nMemoryHits = 0;
+	int _nDiskHits = 0;
+};
+
+} // namespace lurp
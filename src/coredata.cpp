@@ -2,10 +2,13 @@
 #include "scriptasset.h"
 #include "scriptbridge.h"
 #include "scripthelper.h"
+#include "binio.h"
+#include "util.h"
 
 #include <fmt/core.h>
 #include <fmt/ostream.h>
 #include <algorithm>
+#include <utility>
 
 #define TRACK 0
 
@@ -19,74 +22,171 @@ CoreData::~CoreData()
 {
 }
 
+CoreData::Flag* CoreData::FlagTable::find(const EntityID& entity, const EntityID& path)
+{
+	if (_slots.empty() || path.empty()) return nullptr;
+	Flag& f = _slots[slot(entity, path)];
+	return f.path.empty() ? nullptr : &f;
+}
+
+const CoreData::Flag* CoreData::FlagTable::find(const EntityID& entity, const EntityID& path) const
+{
+	return const_cast<FlagTable*>(this)->find(entity, path);
+}
+
+std::pair<CoreData::Flag*, bool> CoreData::FlagTable::insert(const EntityID& entity, const EntityID& path)
+{
+	assert(!path.empty());
+	if ((_size + 1) * 2 > _slots.size()) grow();
+
+	Flag& f = _slots[slot(entity, path)];
+	if (!f.path.empty()) return { &f, false };
+	f.entity = entity;
+	f.path = path;
+	_size++;
+	return { &f, true };
+}
+
+void CoreData::FlagTable::clear()
+{
+	if (_size == 0) return;
+	for (Flag& f : _slots) f = Flag();
+	_size = 0;
+}
+
+std::vector<const CoreData::Flag*> CoreData::FlagTable::sorted() const
+{
+	std::vector<const Flag*> result;
+	result.reserve(_size);
+	for (const Flag& f : _slots) {
+		if (!f.path.empty()) result.push_back(&f);
+	}
+	std::sort(result.begin(), result.end(), [](const Flag* a, const Flag* b) {
+		if (a->entity != b->entity) return a->entity.str() < b->entity.str();
+		return a->path.str() < b->path.str();
+	});
+	return result;
+}
+
+size_t CoreData::FlagTable::slot(const EntityID& entity, const EntityID& path) const
+{
+	// The table is never full, so this terminates on a match or an empty slot.
+	const size_t mask = _slots.size() - 1;
+	size_t i = hash(entity, path) & mask;
+	while (!_slots[i].path.empty() && !(_slots[i].entity == entity && _slots[i].path == path)) {
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+void CoreData::FlagTable::grow()
+{
+	std::vector<Flag> old;
+	old.swap(_slots);
+	_slots.resize(old.empty() ? 16 : old.size() * 2);
+	for (Flag& f : old) {
+		if (f.path.empty()) continue;
+		_slots[slot(f.entity, f.path)] = std::move(f);
+	}
+}
+
+static const EntityID& ScriptEnvID()
+{
+	static const EntityID scriptEnv(_SCRIPTENV);
+	return scriptEnv;
+}
+
+CoreData::FlagTable& CoreData::table(const EntityID& entity)
+{
+	return CowWrite(entity == ScriptEnvID() ? _scriptEnv : _coreData);
+}
+
+const CoreData::FlagTable& CoreData::table(const EntityID& entity) const
+{
+	return entity == ScriptEnvID() ? *_scriptEnv : *_coreData;
+}
+
 void CoreData::clearScriptEnv()
 {
-	auto start = std::partition_point(_coreData.begin(), _coreData.end(),
-		[](const auto& d) { return d.first.entity < _SCRIPTENV; });
-	auto end = std::partition_point(start, _coreData.end(),
-		[](const auto& d) { return d.first.entity == _SCRIPTENV; });
-	_coreData.erase(start, end);
+	if (_scriptEnv->size()) {
+		_scriptEnv = std::make_shared<FlagTable>();
+		_version++;
+		if (_journaling) _scriptEnvCleared = true;
+	}
 }
 
 void CoreData::dump() const
 {
 	fmt::print("Core Data:\n");
-	for (const auto& d : _coreData) {
-		fmt::print("  {}.{} = ", d.first.entity, d.first.path);
-		d.second.dump();
-		fmt::print("\n");
+	for (const FlagTable* t : { _coreData.get(), _scriptEnv.get() }) {
+		for (const Flag* f : t->sorted()) {
+			fmt::print("  {}.{} = ", f->entity, f->path);
+			f->value.dump();
+			fmt::print("\n");
+		}
 	}
 }
 
-void CoreData::dump(const std::string& scope) const
+void CoreData::dump(const EntityID& scope) const
 {
 	fmt::print("Core Data:\n");
-	for (const auto& d : _coreData) {
-		if (scope != d.first.entity)
+	for (const Flag* f : table(scope).sorted()) {
+		if (scope != f->entity)
 			continue;
-		fmt::print("  {}.{} = ", d.first.entity, d.first.path);
-		d.second.dump();
+		fmt::print("  {}.{} = ", f->entity, f->path);
+		f->value.dump();
 		fmt::print("\n");
 	}
 }
 
-void CoreData::coreSet(const std::string& entity, const std::string& key, Variant val, bool mutableUser)
+void CoreData::coreSet(const EntityID& entity, std::string_view key, Variant val, bool mutableUser)
 {
 	assert(!key.empty());
 
-	if (!mutableUser) {
-		// If the value is unchanged, don't bother setting it
-		const auto it = _coreData.find({ entity, key });
-		if (it != _coreData.end()) {
-			if (it->first.mutableUser) {
-				// the data is now NOT mutable, so we can see if it updates.
-				if (it->second != val) {
-					_coreData.erase(it);
-				}
-			}
-		}
+	EntityID path(key);
+	// Setting the same value is common; don't copy a shared table for it.
+	const Flag* existing = std::as_const(*this).table(entity).find(entity, path);
+	if (existing && existing->value == val)
+		return;
+
+	auto [f, added] = table(entity).insert(entity, path);
+	if (added) {
+		f->mutableUser = mutableUser;
 	}
+	else if (!mutableUser && f->mutableUser && f->value != val) {
+		// the data is now NOT mutable, so we can see if it updates.
+		f->mutableUser = false;
+	}
+	if (added || f->value != val) {
+		f->value = val;
+		_version++;
+		if (_journaling)
+			_dirty.insert(FlagKey(entity, f->path));
+	}
+}
 
-	Flag flag{ entity, key, mutableUser };
-	_coreData[flag] = val;
+std::pair<bool, Variant> CoreData::coreGet(const EntityID& entity, std::string_view key) const
+{
+	// A path that was never interned can't be in the table.
+	return coreGetInterned(entity, EntityID::existing(key));
 }
 
-std::pair<bool, Variant> CoreData::coreGet(const std::string& entity, const std::string& key) const
+std::pair<bool, Variant> CoreData::coreGetInterned(const EntityID& entity, const EntityID& path) const
 {
-	const auto it = _coreData.find({ entity, key });
-	if (it == _coreData.end()) {
+	const Flag* f = table(entity).find(entity, path);
+	if (!f) {
 		return { false, Variant() };
 	}
-	return { true, it->second };
+	return { true, f->value };
 }
 
-bool CoreData::coreBool(const std::string& scope, const std::string& flag, bool defaultValue) const
+bool CoreData::coreBool(const EntityID& scope, const std::string& flag, bool defaultValue) const
 {
-	const auto it = _coreData.find({ scope, flag });
-	if (it == _coreData.end()) {
+	const Flag* f = table(scope).find(scope, EntityID::existing(flag));
+	if (!f) {
 		return defaultValue;
 	}
-	return it->second.asBool();
+	return f->value.asBool();
 }
 
 
@@ -99,10 +199,12 @@ void CoreData::save(std::ostream& stream) const
 	*/
 	fmt::print(stream, "CoreData = {{\n");
 
-	for (const auto& it : _coreData) {
-		if (it.first.mutableUser)
-			continue;
-		fmt::print(stream, "  {{ '{}', '{}', {} }},\n", it.first.entity, it.first.path, it.second.toLuaString());
+	for (const FlagTable* t : { _coreData.get(), _scriptEnv.get() }) {
+		for (const Flag* f : t->sorted()) {
+			if (f->mutableUser)
+				continue;
+			fmt::print(stream, "  {{ '{}', '{}', {} }},\n", f->entity, f->path, f->value.toLuaString());
+		}
 	}
 	fmt::print(stream, "}}\n");
 }
@@ -122,17 +224,122 @@ void CoreData::load(ScriptBridge& loader)
 			lua_pop(L, 1);
 
 			lua_geti(L, -1, 2);
-			std::string path = lua_tostring(L, -1);
+			EntityID path = lua_tostring(L, -1);
 			lua_pop(L, 1);
 
 			lua_geti(L, -1, 3);
 			Variant v = Variant::fromLua(L, -1);
 			lua_pop(L, 1);
 
-			_coreData[{entity, path}] = v;
+			table(entity).insert(entity, path).first->value = v;
 		}
 	}
 	lua_pop(L, 1);
+	_version++;
+}
+
+void CoreData::save(BinWriter& w) const
+{
+	std::vector<const Flag*> flags;
+	for (const FlagTable* t : { _coreData.get(), _scriptEnv.get() }) {
+		for (const Flag* f : t->sorted()) {
+			if (!f->mutableUser)
+				flags.push_back(f);
+		}
+	}
+	w.u32(uint32_t(flags.size()));
+	for (const Flag* f : flags) {
+		w.str(f->entity.str());
+		w.str(f->path.str());
+		f->value.write(w);
+	}
+}
+
+bool CoreData::load(BinReader& r)
+{
+	_coreData = std::make_shared<FlagTable>();
+	_scriptEnv = std::make_shared<FlagTable>();
+
+	uint32_t n = r.count(10);
+	for (uint32_t i = 0; i < n && r.ok(); i++) {
+		EntityID entity(r.str());
+		EntityID path(r.str());
+		Variant v = Variant::read(r);
+		if (path.empty()) {
+			r.fail();
+			break;
+		}
+		table(entity).insert(entity, path).first->value = v;
+	}
+	_version++;
+	_dirty.clear();
+	_scriptEnvCleared = false;
+	return r.ok();
+}
+
+void CoreData::setJournaling(bool on)
+{
+	_journaling = on;
+	_dirty.clear();
+	_scriptEnvCleared = false;
+}
+
+void CoreData::saveChanges(BinWriter& w)
+{
+	std::vector<const Flag*> flags;
+	for (uint64_t key : _dirty) {
+		EntityID entity = EntityID::fromHandle(uint32_t(key >> 32));
+		EntityID path = EntityID::fromHandle(uint32_t(key));
+		const Flag* f = std::as_const(*this).table(entity).find(entity, path);
+		if (f && !f->mutableUser)	// may have been cleared
+			flags.push_back(f);
+	}
+	w.boolean(_scriptEnvCleared);
+	w.u32(uint32_t(flags.size()));
+	for (const Flag* f : flags) {
+		w.str(f->entity.str());
+		w.str(f->path.str());
+		f->value.write(w);
+	}
+	_dirty.clear();
+	_scriptEnvCleared = false;
+}
+
+bool CoreData::loadChanges(BinReader& r)
+{
+	if (r.boolean())
+		_scriptEnv = std::make_shared<FlagTable>();
+
+	uint32_t n = r.count(10);
+	for (uint32_t i = 0; i < n && r.ok(); i++) {
+		EntityID entity(r.str());
+		EntityID path(r.str());
+		Variant v = Variant::read(r);
+		if (path.empty()) {
+			r.fail();
+			break;
+		}
+		Flag* f = table(entity).insert(entity, path).first;
+		f->value = v;
+		f->mutableUser = false;
+	}
+	_version++;
+	return r.ok();
+}
+
+CoreData::Snapshot CoreData::snapshot() const
+{
+	return { _coreData, _scriptEnv };
+}
+
+void CoreData::restore(const Snapshot& snapshot)
+{
+	// Safe: a shared table is never written (see CowWrite)
+	_coreData = std::const_pointer_cast<FlagTable>(snapshot.coreData);
+	_scriptEnv = std::const_pointer_cast<FlagTable>(snapshot.scriptEnv);
+	_version++;
+	_dirty.clear();
+	_scriptEnvCleared = false;
 }
 
 } // namespace lurp
@@ -2,17 +2,22 @@
 
 #include "defs.h"
 #include "iscript.h"
+#include "lurpvariant.h"
 
-#include <map>
+#include <vector>
 #include <string>
 #include <iostream>
 #include <stdint.h>
+#include <memory>
+#include <unordered_set>
 
 namespace lurp{
 
 struct ScriptAssets;
 class ScriptBridge;
 class ScriptHelper;
+class BinWriter;
+class BinReader;
 
 class CoreData : public ICoreHandler
 {
@@ -22,33 +27,96 @@ public:
 
 	void clearScriptEnv();
 	void dump() const;
-	void dump(const std::string& scope) const;
+	void dump(const EntityID& scope) const;
 
-	virtual void coreSet(const std::string& scope, const std::string& flag, Variant val, bool mutableUser);
-	virtual std::pair<bool, Variant> coreGet(const std::string& scope, const std::string& flag) const;
-	bool coreBool(const std::string& scope, const std::string& flag, bool defaultValue) const;
+	virtual void coreSet(const EntityID& scope, std::string_view flag, Variant val, bool mutableUser);
+	virtual std::pair<bool, Variant> coreGet(const EntityID& scope, std::string_view flag) const;
+	// coreGet() with the flag already interned (see VarPath).
+	std::pair<bool, Variant> coreGetInterned(const EntityID& scope, const EntityID& flag) const;
+	bool coreBool(const EntityID& scope, const std::string& flag, bool defaultValue) const;
+	virtual uint64_t coreVersion() const { return _version; }
 
+	// Lua text; a debug format.
 	void save(std::ostream& stream) const;
 	void load(ScriptBridge& loader);
 
+	// Binary (see SaveFile). Loading replaces the current data.
+	void save(BinWriter& w) const;
+	bool load(BinReader& r);
+
+	// Journaling (see Journal). While on, changed flags are tracked, and
+	// saveChanges() writes (and forgets) the changes since the last call.
+	// loadChanges() applies them on top of the current data.
+	void setJournaling(bool on);
+	void saveChanges(BinWriter& w);
+	bool loadChanges(BinReader& r);
+
+	// Copy-on-write snapshot (see ZoneDriver::snapshot). Taking one is O(1);
+	// the next change to a shared table copies it.
+	struct Snapshot;
+	Snapshot snapshot() const;
+	void restore(const Snapshot& snapshot);
+
 private:
+	// Paths are interned in the same table as EntityIDs.
 	struct Flag {
 		EntityID entity;
-		std::string path;
+		EntityID path;
 		bool mutableUser = false;
+		Variant value;
+	};
 
-		bool operator< (const Flag& rhs) const {
-			return entity < rhs.entity || (entity == rhs.entity && path < rhs.path);
-		}
-		bool operator== (const Flag& rhs) const {
-			return entity == rhs.entity && path == rhs.path;
-		}
-		bool operator!= (const Flag& rhs) const {
-			return !(*this == rhs);
+	// Open addressing (linear probing) hash table of Flags. Entries are
+	// never removed individually; clear() empties the table.
+	class FlagTable {
+	public:
+		Flag* find(const EntityID& entity, const EntityID& path);
+		const Flag* find(const EntityID& entity, const EntityID& path) const;
+		// Returns the flag, and true if it was added.
+		std::pair<Flag*, bool> insert(const EntityID& entity, const EntityID& path);
+		void clear();
+		size_t size() const { return _size; }
+		// In order of entity name, then path.
+		std::vector<const Flag*> sorted() const;
+
+	private:
+		static size_t hash(const EntityID& entity, const EntityID& path) {
+			uint64_t h = (uint64_t(entity.handle()) << 32) | path.handle();
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdULL;
+			h ^= h >> 33;
+			return size_t(h);
 		}
+		size_t slot(const EntityID& entity, const EntityID& path) const;
+		void grow();
+
+		std::vector<Flag> _slots;	// empty slots have an empty path
+		size_t _size = 0;
 	};
 
-	std::map<Flag, Variant> _coreData;
+public:
+	struct Snapshot {
+		std::shared_ptr<const FlagTable> coreData;
+		std::shared_ptr<const FlagTable> scriptEnv;
+	};
+
+private:
+	// For writing; copies the table if it is shared with a snapshot.
+	FlagTable& table(const EntityID& entity);
+	const FlagTable& table(const EntityID& entity) const;
+
+	static uint64_t FlagKey(const EntityID& entity, const EntityID& path) {
+		return (uint64_t(entity.handle()) << 32) | path.handle();
+	}
+
+	// Copy-on-write; shared with snapshots.
+	std::shared_ptr<FlagTable> _coreData = std::make_shared<FlagTable>();
+	std::shared_ptr<FlagTable> _scriptEnv = std::make_shared<FlagTable>();	// the _ScriptEnv entity, which is cleared after every script
+	uint64_t _version = 0;
+
+	bool _journaling = false;
+	bool _scriptEnvCleared = false;
+	std::unordered_set<uint64_t> _dirty;	// FlagKey of flags changed since the last saveChanges()
 };
 
 } // namespace lurp
\ No newline at end of file
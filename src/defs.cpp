@@ -1,7 +1,177 @@
 #include "defs.h"
-#include <fmt/core.h>
+#include "debug.h"
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
 
 namespace lurp {
 
+// The intern table. Strings live in fixed size chunks that never move, so
+// lookup() can read them without taking the lock: a handle is only known
+// to a thread after intern() created it.
+//
+// The index from string to handle is lock free to read too, since
+// existing() is on the path of every script property access. It is open
+// addressing; the writer fills a slot with a release store, and grows by
+// publishing a new index. A replaced index is kept, as a reader may still
+// be probing it. Only adding takes the lock.
+struct EntityIDTable {
+	static constexpr uint32_t kChunkBits = 12;
+	static constexpr uint32_t kChunkSize = 1 << kChunkBits;
+	static constexpr uint32_t kMaxChunks = 4096;
+	static constexpr uint32_t kIndexSize = 1024;
+
+	struct Index {
+		explicit Index(uint32_t size) : mask(size - 1), slots(new std::atomic<uint64_t>[size]) {
+			for (uint32_t i = 0; i < size; i++) slots[i].store(0, std::memory_order_relaxed);
+		}
+		const uint32_t mask;
+		std::unique_ptr<std::atomic<uint64_t>[]> slots;	// hash << 32 | handle; 0 is empty
+	};
+
+	EntityIDTable() {
+		for (auto& c : chunks) c.store(nullptr, std::memory_order_relaxed);
+		indices.push_back(std::make_unique<Index>(kIndexSize));
+		index.store(indices.back().get(), std::memory_order_relaxed);
+		add("", 0);
+	}
+	~EntityIDTable() {
+		for (auto& c : chunks) delete[] c.load(std::memory_order_relaxed);
+	}
+
+	static uint32_t hash(std::string_view s) {
+		return (uint32_t)std::hash<std::string_view>()(s);
+	}
+
+	const std::string& str(uint32_t handle) const {
+		const std::string* c = chunks[handle >> kChunkBits].load(std::memory_order_acquire);
+		return c[handle & (kChunkSize - 1)];
+	}
+
+	// Returns the handle, or 0 if 's' isn't interned. Doesn't need the lock.
+	uint32_t find(std::string_view s, uint32_t h) const {
+		const Index* idx = index.load(std::memory_order_acquire);
+		for (uint32_t i = h & idx->mask;; i = (i + 1) & idx->mask) {
+			uint64_t slot = idx->slots[i].load(std::memory_order_acquire);
+			if (slot == 0) return 0;
+			if (uint32_t(slot >> 32) == h && std::string_view(str(uint32_t(slot))) == s) return uint32_t(slot);
+		}
+	}
+
+	// Needs the lock.
+	uint32_t add(std::string_view s, uint32_t h) {
+		uint32_t handle = count;
+		uint32_t chunk = handle >> kChunkBits;
+		if (chunk >= kMaxChunks) {
+			FatalError("Too many EntityIDs");
+		}
+		std::string* c = chunks[chunk].load(std::memory_order_relaxed);
+		if (!c) {
+			c = new std::string[kChunkSize];
+			chunks[chunk].store(c, std::memory_order_release);
+		}
+		c[handle & (kChunkSize - 1)] = s;
+		count++;
+		if (handle == 0) return handle;	// the empty string isn't in the index
+
+		Index* idx = index.load(std::memory_order_relaxed);
+		if (size_t(count) * 2 > size_t(idx->mask) + 1) {
+			indices.push_back(std::make_unique<Index>((idx->mask + 1) * 2));
+			Index* bigger = indices.back().get();
+			for (uint32_t i = 0; i <= idx->mask; i++) {
+				uint64_t slot = idx->slots[i].load(std::memory_order_relaxed);
+				if (slot) insert(*bigger, slot);
+			}
+			index.store(bigger, std::memory_order_release);
+			idx = bigger;
+		}
+		insert(*idx, (uint64_t(h) << 32) | handle);
+		return handle;
+	}
+
+	static void insert(Index& idx, uint64_t slot) {
+		uint32_t i = uint32_t(slot >> 32) & idx.mask;
+		while (idx.slots[i].load(std::memory_order_relaxed))
+			i = (i + 1) & idx.mask;
+		idx.slots[i].store(slot, std::memory_order_release);
+	}
+
+	std::mutex mutex;
+	std::atomic<std::string*> chunks[kMaxChunks];
+	std::atomic<Index*> index;
+	std::vector<std::unique_ptr<Index>> indices;	// current is last
+	uint32_t count = 0;
+};
+
+static EntityIDTable& Table()
+{
+	static EntityIDTable table;
+	return table;
+}
+
+/*static*/ uint32_t EntityID::intern(std::string_view s)
+{
+	if (s.empty()) return 0;
+
+	EntityIDTable& table = Table();
+	uint32_t h = EntityIDTable::hash(s);
+	uint32_t handle = table.find(s, h);
+	if (handle) return handle;
+
+	std::lock_guard<std::mutex> lock(table.mutex);
+	handle = table.find(s, h);	// may have been added since
+	if (handle) return handle;
+	return table.add(s, h);
+}
+
+/*static*/ EntityID EntityID::existing(std::string_view s)
+{
+	EntityID id;
+	if (s.empty()) return id;
+
+	id._handle = Table().find(s, EntityIDTable::hash(s));
+	return id;
+}
+
+/*static*/ const std::string& EntityID::lookup(uint32_t handle)
+{
+	return Table().str(handle);
+}
+
+/*static*/ size_t EntityID::numInterned()
+{
+	EntityIDTable& table = Table();
+	std::lock_guard<std::mutex> lock(table.mutex);
+	return table.count;
+}
+
+void FieldTable::add(const EntityField& f)
+{
+	bool added = _fields.emplace(EntityID(f.name).handle(), &f).second;
+	assert(added);
+	(void)added;
+}
+
+const EntityField* FieldTable::find(const EntityID& name) const
+{
+	if (name.empty()) return nullptr;
+	auto it = _fields.find(name.handle());
+	return it == _fields.end() ? nullptr : it->second;
+}
+
+/*static*/ const FieldTable& FieldTable::empty()
+{
+	static const FieldTable table;
+	return table;
+}
+
+std::pair<bool, Variant> Entity::getVar(const EntityID& k) const
+{
+	const EntityField* f = fields().find(k);
+	if (!f) return { false, Variant() };
+	return { true, f->get(*this) };
+}
 
 } // namespace lurp
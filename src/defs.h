@@ -5,10 +5,79 @@
 
 #include <stdint.h>
 #include <string>
+#include <string_view>
+#include <ostream>
+#include <functional>
+#include <unordered_map>
+#include <fmt/core.h>
 
 namespace lurp {
 
-using EntityID = std::string;
+// An interned entity identifier. Every distinct ID string is stored once, in a
+// global table, and an EntityID is a 32-bit handle to it: copies, compares and
+// hashes are integer operations. Handles are assigned as IDs are first seen
+// (typically at load time) and never released.
+//
+// EntityID converts to and from std::string, so the Lua and save file code
+// can treat it as a string.
+class EntityID {
+public:
+	EntityID() = default;
+	EntityID(const std::string& s) : _handle(intern(s)) {}
+	EntityID(const char* s) : _handle(intern(s)) {}
+	EntityID(std::string_view s) : _handle(intern(s)) {}
+
+	const std::string& str() const { return lookup(_handle); }
+	operator const std::string& () const { return lookup(_handle); }
+	const char* c_str() const { return lookup(_handle).c_str(); }
+	size_t size() const { return lookup(_handle).size(); }
+	bool empty() const { return _handle == 0; }
+	uint32_t handle() const { return _handle; }
+
+	bool operator==(const EntityID& rhs) const { return _handle == rhs._handle; }
+	bool operator!=(const EntityID& rhs) const { return _handle != rhs._handle; }
+	// Note this is the order the IDs were interned, not alphabetical.
+	bool operator<(const EntityID& rhs) const { return _handle < rhs._handle; }
+
+	// Compare to a string without interning it.
+	bool operator==(const std::string& rhs) const { return str() == rhs; }
+	bool operator!=(const std::string& rhs) const { return str() != rhs; }
+	bool operator==(const char* rhs) const { return str() == rhs; }
+	bool operator!=(const char* rhs) const { return str() != rhs; }
+
+	// Returns the EntityID for 's' if it has already been interned, and the
+	// empty EntityID if not. Doesn't add to the table.
+	static EntityID existing(std::string_view s);
+
+	// The handle must come from handle().
+	static EntityID fromHandle(uint32_t handle) {
+		EntityID id;
+		id._handle = handle;
+		return id;
+	}
+
+	// Number of IDs interned; for debugging and memory tracking.
+	static size_t numInterned();
+
+private:
+	static uint32_t intern(std::string_view s);
+	static const std::string& lookup(uint32_t handle);
+
+	uint32_t _handle = 0;	// 0 is the empty string
+};
+
+inline bool operator==(const std::string& lhs, const EntityID& rhs) { return rhs == lhs; }
+inline bool operator!=(const std::string& lhs, const EntityID& rhs) { return rhs != lhs; }
+inline bool operator==(const char* lhs, const EntityID& rhs) { return rhs == lhs; }
+inline bool operator!=(const char* lhs, const EntityID& rhs) { return rhs != lhs; }
+
+inline std::string operator+(const EntityID& lhs, const std::string& rhs) { return lhs.str() + rhs; }
+inline std::string operator+(const EntityID& lhs, const char* rhs) { return lhs.str() + rhs; }
+inline std::string operator+(const std::string& lhs, const EntityID& rhs) { return lhs + rhs.str(); }
+inline std::string operator+(const char* lhs, const EntityID& rhs) { return lhs + rhs.str(); }
+
+inline std::ostream& operator<<(std::ostream& stream, const EntityID& id) { return stream << id.str(); }
+
 struct Entity;
 
 struct ScriptEnv {
@@ -63,6 +132,42 @@ struct ScriptRef {
 	}
 };
 
+struct Entity;
+
+// A const field of an Entity that scripts can read, and how to read it. Each
+// Entity type has a static table of them; see Entity::fields().
+struct EntityField {
+	const char* name;
+	Variant (*get)(const Entity& e);
+};
+
+template<typename> struct MemberClass;
+template<typename T, typename V> struct MemberClass<V T::*> { using type = T; };
+
+// Reads a data member: { "name", FieldValue<&Item::name> }
+template<auto M>
+Variant FieldValue(const Entity& e) {
+	using T = typename MemberClass<decltype(M)>::type;
+	return Variant(static_cast<const T&>(e).*M);
+}
+
+// The fields of an Entity type, hashed by interned name.
+class FieldTable {
+public:
+	FieldTable() = default;
+	template<size_t N>
+	FieldTable(const EntityField(&fields)[N]) {
+		for (const EntityField& f : fields) add(f);
+	}
+
+	const EntityField* find(const EntityID& name) const;
+	static const FieldTable& empty();
+
+private:
+	void add(const EntityField& f);
+	std::unordered_map<uint32_t, const EntityField*> _fields;	// by EntityID::handle()
+};
+
 struct Entity {
 	Entity() = default;
 	Entity(const EntityID& id) : entityID(id) {}
@@ -71,8 +176,23 @@ struct Entity {
 	EntityID entityID;
 
 	virtual std::string description() const = 0;
-	virtual std::pair<bool, Variant> getVar(const std::string& k) const = 0;
 	virtual ScriptType getType() const = 0;
+	virtual const FieldTable& fields() const = 0;
+
+	// Reads a const field. Returns false if this type doesn't have it.
+	std::pair<bool, Variant> getVar(const EntityID& k) const;
 };
 
-} // namespace lurp
\ No newline at end of file
+} // namespace lurp
+
+template<>
+struct std::hash<lurp::EntityID> {
+	size_t operator()(const lurp::EntityID& id) const { return id.handle(); }
+};
+
+template<>
+struct fmt::formatter<lurp::EntityID> : fmt::formatter<std::string_view> {
+	auto format(const lurp::EntityID& id, fmt::format_context& ctx) const {
+		return fmt::formatter<std::string_view>::format(id.str(), ctx);
+	}
+};
\ No newline at end of file
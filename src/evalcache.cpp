@@ -0,0 +1,94 @@
+#include "evalcache.h"
+#include "iscript.h"
+
+#include <assert.h>
+
+namespace lurp {
+
+static uint64_t CoreVersion(const ICoreHandler* core)
+{
+	return core ? core->coreVersion() : 0;
+}
+
+static uint64_t InventoryVersion(const IMapHandler* map)
+{
+	return map ? map->inventoryVersion() : 0;
+}
+
+bool EvalCache::find(const Key& key, const ICoreHandler* core, const IMapHandler* map, bool& result)
+{
+	auto it = _cache.find(key);
+	if (it == _cache.end() || !valid(it->second, core, map)) {
+		_misses++;
+		return false;
+	}
+	_hits++;
+	result = it->second.result;
+	return true;
+}
+
+bool EvalCache::valid(Entry& e, const ICoreHandler* core, const IMapHandler* map) const
+{
+	uint64_t coreVersion = CoreVersion(core);
+	uint64_t inventoryVersion = InventoryVersion(map);
+	if (e.coreVersion == coreVersion && e.inventoryVersion == inventoryVersion)
+		return true;
+
+	// Something changed; check if it is something the eval() read.
+	if (e.coreVersion != coreVersion) {
+		for (const CoreRead& r : e.coreReads) {
+			std::pair<bool, Variant> v = core ? core->coreGet(r.entity, r.path) : std::pair<bool, Variant>();
+			if (v.first != r.found || (v.first && v.second != r.value))
+				return false;
+		}
+	}
+	if (e.inventoryVersion != inventoryVersion) {
+		for (const ItemRead& r : e.itemReads) {
+			int n = map ? map->numItems(r.entity, r.item) : 0;
+			if (n != r.n)
+				return false;
+		}
+	}
+	e.coreVersion = coreVersion;
+	e.inventoryVersion = inventoryVersion;
+	return true;
+}
+
+void EvalCache::begin()
+{
+	assert(!_recording);
+	_recording = true;
+	_cacheable = true;
+	_coreReads.clear();
+	_itemReads.clear();
+}
+
+void EvalCache::end(const Key& key, bool result, bool ok, const ICoreHandler* core, const IMapHandler* map)
+{
+	assert(_recording);
+	_recording = false;
+	if (!_cacheable || !ok) {
+		_cache.erase(key);
+		return;
+	}
+	Entry& e = _cache[key];
+	e.result = result;
+	e.coreVersion = CoreVersion(core);
+	e.inventoryVersion = InventoryVersion(map);
+	e.coreReads.swap(_coreReads);
+	e.itemReads.swap(_itemReads);
+}
+
+void EvalCache::readCore(const EntityID& entity, std::string_view path, bool found, const Variant& value)
+{
+	if (!_recording) return;
+	_coreReads.push_back({ entity, std::string(path), found, value });
+}
+
+void EvalCache::readItems(const EntityID& entity, const EntityID& item, int n)
+{
+	if (!_recording) return;
+	_itemReads.push_back({ entity, item, n });
+}
+
+} // namespace lurp
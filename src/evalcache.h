@@ -0,0 +1,98 @@
+#pragma once
+
+#include "defs.h"
+#include "lurpvariant.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace lurp {
+
+class ICoreHandler;
+class IMapHandler;
+
+// Memoizes the results of eval() functions.
+//
+// While an eval() runs, the script callbacks record what it reads: CoreData
+// values (core tables, CCoreGet) and item counts (CNumItems). Anything else that touches
+// the game state (CRandom, CCoreSet, CDeltaItem, etc.) makes the result
+// uncacheable. A cached result is valid as long as everything it read is
+// unchanged. The CoreData and inventory versions make the common case, where
+// nothing has changed at all, a simple compare.
+//
+// The result also depends on the script environment (npc, zone, room), which
+// is part of the key. Lua state the callbacks can't see is assumed to only
+// change in code() functions; see ScriptHelper.
+class EvalCache {
+public:
+	struct Key {
+		int func = -1;
+		ScriptEnv env;
+
+		bool operator==(const Key& rhs) const {
+			return func == rhs.func && env.script == rhs.env.script && env.npc == rhs.env.npc
+				&& env.zone == rhs.env.zone && env.room == rhs.env.room;
+		}
+	};
+
+	// Returns true and sets 'result' if there is a valid cached result.
+	bool find(const Key& key, const ICoreHandler* core, const IMapHandler* map, bool& result);
+
+	// Recording. begin() starts recording the reads of an eval(); end() stores the
+	// result (if it is cacheable.) Nested evals are not recorded.
+	bool recording() const { return _recording; }
+	void begin();
+	void end(const Key& key, bool result, bool ok, const ICoreHandler* core, const IMapHandler* map);
+
+	void readCore(const EntityID& entity, std::string_view path, bool found, const Variant& value);
+	void readItems(const EntityID& entity, const EntityID& item, int n);
+	void uncacheable() { _cacheable = false; }
+
+	void clear() { _cache.clear(); }
+
+	size_t size() const { return _cache.size(); }
+	int hits() const { return _hits; }
+	int misses() const { return _misses; }
+
+private:
+	struct KeyHash {
+		size_t operator()(const Key& k) const {
+			size_t h = std::hash<int>()(k.func);
+			for (const EntityID* id : { &k.env.script, &k.env.npc, &k.env.zone, &k.env.room })
+				h = h * 31 + id->handle();
+			return h;
+		}
+	};
+	struct CoreRead {
+		EntityID entity;
+		std::string path;
+		bool found = false;
+		Variant value;
+	};
+	struct ItemRead {
+		EntityID entity;
+		EntityID item;
+		int n = 0;
+	};
+	struct Entry {
+		bool result = false;
+		uint64_t coreVersion = 0;
+		uint64_t inventoryVersion = 0;
+		std::vector<CoreRead> coreReads;
+		std::vector<ItemRead> itemReads;
+	};
+
+	bool valid(Entry& e, const ICoreHandler* core, const IMapHandler* map) const;
+
+	std::unordered_map<Key, Entry, KeyHash> _cache;
+	bool _recording = false;
+	bool _cacheable = false;
+	std::vector<CoreRead> _coreReads;
+	std::vector<ItemRead> _itemReads;
+	int _hits = 0;
+	int _misses = 0;
+};
+
+} // namespace lurp
@@ -2,7 +2,13 @@
 
 #include <vector>
 #include <algorithm>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
 
+// Directed graph, stored as compressed rows: the segments are sorted by the
+// node they start at, and 'rows' maps each node to its run of segments, so
+// adjacent() is a hash lookup and then O(degree).
 template<typename NODE, typename EDGE>
 class Graph
 {
@@ -22,17 +28,38 @@ public:
 		if (biDir) {
 			segments.push_back({ b, a, e });
 		}
-    	std::sort(segments.begin(), segments.end());
+		if (!bulk)
+			sort();
+	}
+
+	// Bulk build: addEdge() between beginBuild() and endBuild() doesn't sort;
+	// endBuild() sorts once. Edges from the same node keep the order they were added.
+	void beginBuild(size_t nSegments = 0) {
+		bulk = true;
+		segments.reserve(segments.size() + nSegments);
+	}
+
+	void endBuild() {
+		bulk = false;
+		sort();
+	}
+
+	void clear() {
+		segments.clear();
+		rows.clear();
+		bulk = false;
 	}
 
 	bool hasNode(const NODE& a) const {
-		Segment s = { a, a, EDGE{} };
-		return std::binary_search(segments.begin(), segments.end(), s);
+		return rows.find(a) != rows.end();
 	}
-    
-	const auto adjacent(const NODE& a) const {
-		Segment s = { a, a, EDGE{} };
-		return std::equal_range(segments.begin(), segments.end(), s);
+
+	// Query functions are not valid during a bulk build.
+	using Range = std::pair<typename std::vector<Segment>::const_iterator, typename std::vector<Segment>::const_iterator>;
+	Range adjacent(const NODE& a) const {
+		auto it = rows.find(a);
+		if (it == rows.end()) return { segments.end(), segments.end() };
+		return { segments.begin() + it->second.first, segments.begin() + it->second.second };
 	}
 
 	std::vector<Segment> adjacentVec(const NODE& a) const {
@@ -46,5 +73,18 @@ public:
 	}
 
 private:
+	void sort() {
+		std::stable_sort(segments.begin(), segments.end());
+		rows.clear();
+		for (size_t i = 0; i < segments.size();) {
+			size_t end = i + 1;
+			while (end < segments.size() && segments[end].node0 == segments[i].node0) end++;
+			rows[segments[i].node0] = { i, end };
+			i = end;
+		}
+	}
+
 	std::vector<Segment> segments;
+	std::unordered_map<NODE, std::pair<size_t, size_t>> rows;	// node -> [begin, end) in segments
+	bool bulk = false;
 };
@@ -17,18 +17,23 @@ public:
 
 	virtual void movePlayer(const EntityID& dst, bool teleport) = 0;
 	virtual void endGame(const std::string& reason, int bias) = 0;
+
+	// Changes whenever an inventory may have changed.
+	virtual uint64_t inventoryVersion() const = 0;
 };
 
 class IAssetHandler {
 public:
 	// returns true an asset & path exists
-	virtual std::pair<bool, Variant> assetGet(const std::string& entity, const std::string& path) const = 0;
+	virtual std::pair<bool, Variant> assetGet(const EntityID& entity, std::string_view path) const = 0;
 };
 
 class ICoreHandler {
 public:
-	virtual void coreSet(const std::string& entity, const std::string& path, Variant val, bool initial) = 0;
-	virtual std::pair<bool, Variant> coreGet(const std::string& entity, const std::string& path) const = 0;
+	virtual void coreSet(const EntityID& entity, std::string_view path, Variant val, bool initial) = 0;
+	virtual std::pair<bool, Variant> coreGet(const EntityID& entity, std::string_view path) const = 0;
+	// Changes whenever a value changes.
+	virtual uint64_t coreVersion() const = 0;
 };
 
 // Provided by the ScriptDriver
@@ -113,7 +113,7 @@ void Inventory::convert(const ConstScriptAssets& assets)
 	_initItems.clear();
 }
 
-void Inventory::save(std::ostream& stream)
+void Inventory::save(std::ostream& stream) const
 {
 	fmt::print(stream, "items = {{ ");
 	for (const auto& item : this->items()) {
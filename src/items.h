@@ -35,14 +35,17 @@ struct Item : public Entity {
 	virtual std::string description() const override {
 		return fmt::format("Item entityID: {} '{}'", entityID, name);
 	}
-	virtual std::pair<bool, Variant> getVar(const std::string& k) const override {
-		if (k == "name") return { true, Variant(name) };
-		if (k == "desc") return { true, Variant(desc) };
-		if (k == "range") return { true, Variant(range) };
-		if (k == "armor") return { true, Variant(armor) };
-		if (k == "ap") return { true, Variant(ap) };
-		if (k == "damage") return { true, Variant(damage.toString()) };
-		return { false, Variant() };
+	virtual const FieldTable& fields() const override {
+		static constexpr EntityField kFields[] = {
+			{ "name", FieldValue<&Item::name> },
+			{ "desc", FieldValue<&Item::desc> },
+			{ "range", FieldValue<&Item::range> },
+			{ "armor", FieldValue<&Item::armor> },
+			{ "ap", FieldValue<&Item::ap> },
+			{ "damage", [](const Entity& e) { return Variant(static_cast<const Item&>(e).damage.toString()); } },
+		};
+		static const FieldTable table(kFields);
+		return table;
 	}
 	virtual ScriptType getType() const override {
 		return type; 
@@ -63,14 +66,17 @@ struct Power : Entity {
 	virtual std::string description() const override {
 		return fmt::format("Power entityID: {} '{}' {} cost={} range={} strength={}", entityID, name, effect, cost, range, strength);
 	}
-	virtual std::pair<bool, Variant> getVar(const std::string& k) const override {
-		if (k == "name") return { true, Variant(name) };
-		if (k == "effect") return { true, Variant(effect) };
-		if (k == "cost") return { true, Variant(cost) };
-		if (k == "range") return { true, Variant(range) };
-		if (k == "strength") return { true, Variant(strength) };
-		if (k == "region") return { true, Variant(region) };
-		return { false, Variant() };
+	virtual const FieldTable& fields() const override {
+		static constexpr EntityField kFields[] = {
+			{ "name", FieldValue<&Power::name> },
+			{ "effect", FieldValue<&Power::effect> },
+			{ "cost", FieldValue<&Power::cost> },
+			{ "range", FieldValue<&Power::range> },
+			{ "strength", FieldValue<&Power::strength> },
+			{ "region", FieldValue<&Power::region> },
+		};
+		static const FieldTable table(kFields);
+		return table;
 	}
 	virtual ScriptType getType() const override {
 		return type;
@@ -116,7 +122,7 @@ public:
 	const std::vector<ItemRef>& items() const { return _items; }
 
 	// items = { { "GOLD", 10 }, "SWORD" }
-	void save(std::ostream& stream);
+	void save(std::ostream& stream) const;
 
 	static constexpr ScriptType type{ ScriptType::kInventory };
 	std::string description() const {
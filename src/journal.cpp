@@ -0,0 +1,149 @@
+#include "journal.h"
+#include "savefile.h"
+#include "zonedriver.h"
+#include "SpookyV2.h"
+#include "../drivers/platform.h"
+
+#include <fmt/core.h>
+#include <plog/Log.h>
+
+#include <algorithm>
+
+namespace lurp {
+
+Journal::Journal(const std::filesystem::path& path) : _path(path)
+{
+}
+
+Journal::~Journal()
+{
+	closeLog();
+}
+
+/*static*/ std::filesystem::path Journal::logPath(const std::filesystem::path& path)
+{
+	std::filesystem::path p = path;
+	p += ".journal";
+	return p;
+}
+
+/*static*/ uint64_t Journal::hash(const uint8_t* data, size_t size)
+{
+	return SpookyHash::Hash64(data, size, kVersion);
+}
+
+/*static*/ uint32_t Journal::checksum(const uint8_t* data, size_t size)
+{
+	return SpookyHash::Hash32(data, size, kMagic);
+}
+
+void Journal::closeLog()
+{
+	if (_log) {
+		fclose(_log);
+		_log = nullptr;
+	}
+}
+
+bool Journal::compact(ZoneDriver& driver)
+{
+	closeLog();
+
+	// Snapshot and reset the change tracking together, so nothing is lost.
+	std::vector<uint8_t> base = SaveFile::write(driver);
+	driver.setJournaling(true);
+
+	// The base goes first. If we crash before the new log is written, the old
+	// log doesn't match the new base, and is ignored.
+	if (!SaveFile::writeFile(_path, base))
+		return false;
+
+	BinWriter header;
+	header.u32(kMagic);
+	header.u32(kVersion);
+	header.u64(hash(base.data(), base.size()));
+	if (!SaveFile::writeFile(logPath(_path), header.buffer()))
+		return false;
+
+	_log = SaveFile::openFile(logPath(_path), true);
+	if (!_log) {
+		PLOG(plog::error) << fmt::format("Could not open journal '{}'", logPath(_path).string());
+		return false;
+	}
+	_baseSize = base.size();
+	_logSize = header.size();
+	_nRecords = 0;
+	_nCompactions++;
+	return true;
+}
+
+bool Journal::checkpoint(ZoneDriver& driver)
+{
+	if (!_log)
+		return compact(driver);
+
+	BinWriter changes;
+	driver.saveChanges(changes);
+
+	BinWriter record;
+	record.u32(uint32_t(changes.size()));
+	record.u32(checksum(changes.buffer().data(), changes.size()));
+	record.write(changes.buffer().data(), changes.size());
+
+	bool ok = fwrite(record.buffer().data(), 1, record.size(), _log) == record.size();
+	ok = ok && fflush(_log) == 0;
+	ok = ok && (!sync || SaveFile::syncFile(_log));
+	if (!ok) {
+		// The log may now have a partial record; start over.
+		PLOG(plog::error) << fmt::format("Could not write journal '{}'", logPath(_path).string());
+		return compact(driver);
+	}
+	_logSize += record.size();
+	_nRecords++;
+
+	if (_logSize > std::max(kMinCompactSize, _baseSize))
+		return compact(driver);
+	return true;
+}
+
+/*static*/ bool Journal::replay(const std::filesystem::path& path, ZoneDriver& driver)
+{
+	MappedFile base(path);
+	if (!base.valid()) {
+		PLOG(plog::error) << fmt::format("Could not open save file '{}'", path.string());
+		return false;
+	}
+	if (!SaveFile::read(base.data(), base.size(), driver))
+		return false;
+
+	MappedFile log(logPath(path));
+	if (!log.valid())
+		return true;	// nothing since the base
+
+	BinReader r(log.data(), log.size());
+	uint32_t magic = r.u32();
+	uint32_t version = r.u32();
+	uint64_t baseHash = r.u64();
+	if (!r.ok() || magic != kMagic || version != kVersion || baseHash != hash(base.data(), base.size())) {
+		PLOG(plog::warning) << fmt::format("Journal '{}' doesn't match the save; ignored", logPath(path).string());
+		return true;
+	}
+
+	int n = 0;
+	while (!r.done()) {
+		uint32_t size = r.u32();
+		uint32_t sum = r.u32();
+		const uint8_t* data = r.bytes(size);
+		if (!data || checksum(data, size) != sum) {
+			PLOG(plog::warning) << fmt::format("Journal '{}' has a torn record after {} records", logPath(path).string(), n);
+			break;
+		}
+		BinReader changes(data, size);
+		if (!driver.loadChanges(changes))
+			return false;
+		n++;
+	}
+	return true;
+}
+
+} // namespace lurp
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "binio.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <filesystem>
+
+namespace lurp {
+
+class ZoneDriver;
+
+// Incremental saving. The save is a base snapshot (a SaveFile at 'path') and
+// an append-only log next to it ('path'.journal). A checkpoint appends only
+// what changed since the last one (see ZoneDriver::saveChanges), so it is
+// cheap enough to do after every player input. When the log grows past the
+// size of the base, it is folded into a new base (compaction).
+//
+// Log layout (little endian):
+//   header: magic, version, hash of the base file it applies to
+//   records: size, checksum, ZoneDriver change sections
+// A torn write at the end of the log fails the checksum and is ignored; a
+// log left over from an older base fails the hash and is ignored.
+class Journal {
+public:
+	static constexpr uint32_t kMagic = BinTag("LRPJ");
+	static constexpr uint32_t kVersion = 2;
+	// Don't compact until the log is at least this big.
+	static constexpr size_t kMinCompactSize = 64 * 1024;
+
+	Journal(const std::filesystem::path& path);
+	~Journal();
+
+	Journal(const Journal&) = delete;
+	Journal& operator=(const Journal&) = delete;
+
+	// Writes a new base snapshot, starts an empty log, and turns on
+	// journaling in the driver. Must be called before checkpoint().
+	bool compact(ZoneDriver& driver);
+	// Appends the changes since the last checkpoint, and compacts if needed.
+	bool checkpoint(ZoneDriver& driver);
+
+	// Loads the base and replays the log on top of it.
+	static bool replay(const std::filesystem::path& path, ZoneDriver& driver);
+
+	static std::filesystem::path logPath(const std::filesystem::path& path);
+
+	// If true (the default) every checkpoint is synced to disk.
+	bool sync = true;
+
+	size_t baseSize() const { return _baseSize; }
+	size_t logSize() const { return _logSize; }
+	int numRecords() const { return _nRecords; }
+	int numCompactions() const { return _nCompactions; }
+
+private:
+	static uint64_t hash(const uint8_t* data, size_t size);
+	static uint32_t checksum(const uint8_t* data, size_t size);
+	void closeLog();
+
+	std::filesystem::path _path;
+	FILE* _log = nullptr;
+	size_t _baseSize = 0;
+	size_t _logSize = 0;
+	int _nRecords = 0;
+	int _nCompactions = 0;
+};
+
+} // namespace lurp
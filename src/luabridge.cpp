@@ -1,4 +1,5 @@
 #include "luabridge.h"
+#include "chunkcache.h"
 
 #include "lua.hpp"
 #include "../drivers/platform.h"
@@ -7,6 +8,8 @@
 #include <plog/Log.h>
 #include <fmt/core.h>
 
+#include <algorithm>
+
 namespace lurp {
 
 template<typename T>
@@ -42,21 +45,6 @@ Variant TableIt::value() const {
 	return Variant::fromLua(_L, -1);
 }
 
-bool TableIt::isTableWithKV(const std::string& key, const std::string& value)
-{
-	bool result = false;
-	if (vType() == LUA_TTABLE) {		// -1 table
-		lua_pushstring(_L, key.c_str());	// -1 key, -2 table
-		int t = lua_gettable(_L, -2);		// -1 value, -2 table 
-		if (t == LUA_TSTRING) {
-			std::string s = lua_tostring(_L, -1);
-			result = s == value;
-		}
-		lua_pop(_L, 1); // -1 table
-	}
-	return result;
-}
-
 LuaBridge::LuaBridge()
 {
 	L = luaL_newstate();
@@ -66,9 +54,19 @@ LuaBridge::LuaBridge()
 	LuaStackCheck check(L);
 }
 
+LuaBridge::LuaBridge(LuaBridge& host) : _host(&host)
+{
+	assert(!host.isSession());
+	L = lua_newthread(host.L);
+	_threadRef = luaL_ref(host.L, LUA_REGISTRYINDEX);
+}
+
 LuaBridge::~LuaBridge()
 {
-	lua_close(L);
+	if (_host)
+		luaL_unref(L, LUA_REGISTRYINDEX, _threadRef);
+	else
+		lua_close(L);
 }
 
 void LuaBridge::registerGlobalFunc(void* handler, lua_CFunction func, const std::string& funcName)
@@ -103,13 +101,20 @@ void LuaBridge::appendLuaPath(const std::string& path)
 	//fmt::print("Lua path: {}\n", cur_path);
 }
 
+void LuaBridge::addSourceFile(const std::string& path)
+{
+	if (std::find(_sourceFiles.begin(), _sourceFiles.end(), path) == _sourceFiles.end())
+		_sourceFiles.push_back(path);
+}
+
 void LuaBridge::doFile(const std::string& filename)
 {
 	LuaStackCheck check(L);
 
 	std::string cwd;
 	CheckPath(filename, cwd);
-	int error = luaL_loadfile(L, filename.c_str());
+	addSourceFile(filename);
+	int error = ChunkCache::instance().load(L, filename);
 	if (error) {
 		PLOG(plog::error) << fmt::format("Occurs when calling luaL_loadfile() 0x{:x}", error);
 		PLOG(plog::error) << fmt::format("Msg: '{}'", lua_tostring(L, -1));
@@ -216,9 +221,9 @@ void LuaBridge::pop(int n)
 bool LuaBridge::getBoolField(const std::string& key, std::optional<bool> def) const
 {
 	Variant v = getField(L, key, 0);
-	if (v.type == LUA_TNIL && def) return def.value();
-	assert(v.type == LUA_TBOOLEAN);
-	return v.boolean;
+	if (v.type() == LUA_TNIL && def) return def.value();
+	assert(v.type() == LUA_TBOOLEAN);
+	return v.boolean();
 }
 
 void LuaBridge::setBoolField(const std::string& key, bool value)
@@ -238,13 +243,13 @@ bool LuaBridge::hasField(const std::string& key) const
 /* static */bool LuaBridge::hasField(lua_State* L, const std::string& key)
 {
 	Variant v = getField(L, key, 0);
-	return v.type != LUA_TNIL;
+	return v.type() != LUA_TNIL;
 }
 
 int LuaBridge::getFieldType(const std::string& key) const
 {
 	Variant v = getField(L, key.c_str(), 0);
-	return v.type;
+	return v.type();
 }
 
 std::vector<std::string> LuaBridge::getStrArray(const std::string& key) const
@@ -301,21 +306,28 @@ std::vector<int> LuaBridge::getIntArray(const std::string& key) const
 
 std::vector<LuaBridge::StringCount> LuaBridge::getStrCountArray(const std::string& key) const
 {
-	std::vector<StringCount> r;
 	LuaStackCheck check(L);
 
 	lua_pushstring(L, key.c_str());
 	lua_gettable(L, -2);
+	std::vector<StringCount> r = toStrCountArray(L);
+	lua_pop(L, 1);
+	return r;
+}
+
+/*static*/ std::vector<LuaBridge::StringCount> LuaBridge::toStrCountArray(lua_State* L)
+{
+	std::vector<StringCount> r;
 	for (TableIt it(L, -1); !it.done(); it.next()) {
 		if (it.kType() == LUA_TNUMBER) {
 			StringCount sc;
 			if (it.vType() == LUA_TTABLE) {
 				Variant str = getField(L, "", 1);
 				Variant num = getField(L, "", 2);
-				assert(str.type == LUA_TSTRING);
-				assert(num.type == LUA_TNUMBER);
-				sc.str = str.str;
-				sc.count = (int)num.num;
+				assert(str.type() == LUA_TSTRING);
+				assert(num.type() == LUA_TNUMBER);
+				sc.str = str.str();
+				sc.count = (int)num.num();
 				r.push_back(sc);
 			}
 			else {
@@ -325,7 +337,6 @@ std::vector<LuaBridge::StringCount> LuaBridge::getStrCountArray(const std::strin
 			}
 		}
 	}
-	lua_pop(L, 1);
 	return r;
 }
 
@@ -355,11 +366,11 @@ void LuaBridge::setStrCountArray(const std::string& key, const std::vector<Strin
 std::string LuaBridge::getStrField(const std::string& key, const std::optional<std::string>& def) const
 {
 	Variant v = getField(L, key, 0);
-	if (v.type == LUA_TNIL && def) return def.value();
-	if (v.type != LUA_TSTRING) {
+	if (v.type() == LUA_TNIL && def) return def.value();
+	if (v.type() != LUA_TSTRING) {
 		throw std::runtime_error(fmt::format("Expected string for key '{}'", key));
 	}
-	return v.str;
+	return v.str();
 }
 
 void LuaBridge::setStrField(const std::string& key, const std::string& value)
@@ -385,20 +396,15 @@ void LuaBridge::setStrField(const std::string& key, const std::string& value)
 	else
 		lua_pushnumber(L, index);		// -2 table -1 key/index
 
+	int type = LUA_TNIL;
 	if (raw)
-		v.type = lua_rawget(L, -2);		// -2 table -1 value
+		type = lua_rawget(L, -2);		// -2 table -1 value
 	else
-		v.type = lua_gettable(L, -2);		// -2 table -1 value
+		type = lua_gettable(L, -2);		// -2 table -1 value
 
-	if (v.type == LUA_TSTRING) {
-		v.str = lua_tostring(L, -1);
-	}
-	else if (v.type == LUA_TNUMBER) {
-		v.num = lua_tonumber(L, -1);
-	}
-	else if (v.type == LUA_TBOOLEAN) {
-		v.boolean = lua_toboolean(L, -1) ? true : false;
-	}
+	v = Variant::fromLua(L, -1);
+	if (v.type() != type)
+		v = Variant::fromType(type);	// table, function, etc.
 	lua_pop(L, 1);
 	return v;
 }
@@ -421,9 +427,9 @@ void LuaBridge::setStrField(const std::string& key, const std::string& value)
 int LuaBridge::getIntField(const std::string& key, const std::optional<int>& def) const
 {
 	Variant v = getField(L, key, 0);
-	if (v.type == LUA_TNIL && def) return def.value();
-	assert(v.type == LUA_TNUMBER);
-	return (int)v.num;
+	if (v.type() == LUA_TNIL && def) return def.value();
+	assert(v.type() == LUA_TNUMBER);
+	return (int)v.num();
 }
 
 void LuaBridge::setIntField(const std::string& key, int value)
@@ -17,8 +17,16 @@ class LuaBridge
 	friend struct TableIt;
 public:
 	LuaBridge();	
+	// A session: a thread on the host's lua_State. See ScriptBridge.
+	explicit LuaBridge(LuaBridge& host);
 	~LuaBridge();
 
+	LuaBridge(const LuaBridge&) = delete;
+	LuaBridge& operator=(const LuaBridge&) = delete;
+
+	bool isSession() const { return _host != nullptr; }
+	LuaBridge* host() const { return _host; }
+
 	void loadLUA(const std::string& path);
 
 	lua_State* getLuaState() const { return L; }
@@ -52,6 +60,8 @@ public:
 	std::vector<int> getIntArray(const std::string& key) const;
 
 	static Variant getField(lua_State* L, const std::string& key, int index, bool raw = false);
+	// The table at -1 as a StringCount array: { "a", { "b", 2 } }
+	static std::vector<StringCount> toStrCountArray(lua_State* L);
 
 	void setStrField(const std::string& key, const std::string& value);
 	void setIntField(const std::string& key, int value);
@@ -89,6 +99,11 @@ public:
 
 	void appendLuaPath(const std::string& path);
 
+	// The files read by doFile() and LoadMD(), in order, since the last clearSourceFiles().
+	const std::vector<std::string>& sourceFiles() const { return _sourceFiles; }
+	void addSourceFile(const std::string& path);
+	void clearSourceFiles() { _sourceFiles.clear(); }
+
 	// fixme: hack - the currentDir is set and cleared for file loading
 	std::filesystem::path currentDir() const {
 		return _currentDir;
@@ -96,8 +111,11 @@ public:
 
 private:
 	lua_State* L = 0;
+	LuaBridge* _host = nullptr;
+	int _threadRef = LUA_NOREF;		// keeps a session's thread alive
 	std::map<int, FuncInfo> _funcInfoMap;
 	std::filesystem::path _currentDir;
+	std::vector<std::string> _sourceFiles;
 
 	static int getFuncField(lua_State* L, const std::string& key);
 	static bool hasField(lua_State* L, const std::string& key);
@@ -124,7 +142,6 @@ struct TableIt
 	Variant key() const;
 	Variant value() const;
 
-	bool isTableWithKV(const std::string& key, const std::string& value);
 
 private:
 	lua_State* _L;
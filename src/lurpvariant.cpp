@@ -1,22 +1,102 @@
 #include "lurpvariant.h"
+#include "defs.h"
+#include "binio.h"
 
 #include <fmt/core.h>
 
+#include <assert.h>
+#include <atomic>
+#include <utility>
+
 namespace lurp
 {
 
+// Variants are copied between sessions and threads (snapshots, AutoSave), so the count is atomic.
+struct Variant::LongStr {
+	LongStr(std::string_view s) : str(s) {}
+
+	std::atomic<uint32_t> refs{ 1 };
+	const std::string str;
+};
+
+void Variant::setStr(std::string_view s)
+{
+	_type = LUA_TSTRING;
+	if (s.size() <= kSmallSize) {
+		memcpy(_data, s.data(), s.size());
+		_len = uint8_t(s.size());
+	}
+	else {
+		LongStr* p = new LongStr(s);
+		memcpy(_data, &p, sizeof(p));
+		_len = kLong;
+	}
+}
+
+Variant::LongStr* Variant::longStr() const
+{
+	assert(_len == kLong);
+	LongStr* p;
+	memcpy(&p, _data, sizeof(p));
+	return p;
+}
+
+void Variant::retain()
+{
+	longStr()->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Variant::release()
+{
+	LongStr* p = longStr();
+	if (p->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		delete p;
+}
+
+void Variant::swap(Variant& rhs) noexcept
+{
+	char data[kSmallSize];
+	memcpy(data, _data, kSmallSize);
+	memcpy(_data, rhs._data, kSmallSize);
+	memcpy(rhs._data, data, kSmallSize);
+	std::swap(_type, rhs._type);
+	std::swap(_len, rhs._len);
+}
+
+std::string_view Variant::strView() const
+{
+	if (_type != LUA_TSTRING) return {};
+	if (_len != kLong) return std::string_view(_data, _len);
+	return longStr()->str;
+}
+
+bool Variant::operator==(const Variant& rhs) const
+{
+	if (_type != rhs._type) return false;
+	switch (_type) {
+	case LUA_TBOOLEAN: return boolean() == rhs.boolean();
+	case LUA_TNUMBER: return num() == rhs.num();
+	case LUA_TSTRING:
+		if (_len != rhs._len) return false;
+		if (_len == kLong) return longStr() == rhs.longStr() || strView() == rhs.strView();
+		return memcmp(_data, rhs._data, _len) == 0;
+	default:
+		return true;
+	}
+}
+
 bool Variant::isTruthy() const
 {
-	switch (type) {
+	switch (_type) {
 	case LUA_TNIL:
 	case LUA_TNONE:
 		return false;
 	case LUA_TBOOLEAN:
-		return boolean;
+		return boolean();
 	case LUA_TNUMBER:
-		return num != 0;
+		return num() != 0;
 	case LUA_TSTRING:
-		return !str.empty();
+		return _len != 0;
 	default:
 		return true;
 	}
@@ -24,39 +104,35 @@ bool Variant::isTruthy() const
 
 /*static*/ Variant Variant::fromLua(lua_State* L, int index)
 {
-	Variant v;
 	switch (lua_type(L, index)) {
-	case LUA_TSTRING:
-		v.type = LUA_TSTRING;
-		v.str = lua_tostring(L, index);
-		break;
+	case LUA_TSTRING: {
+		size_t len = 0;
+		const char* s = lua_tolstring(L, index, &len);
+		return Variant(std::string_view(s, len));
+	}
 	case LUA_TNUMBER:
-		v.type = LUA_TNUMBER;
-		v.num = lua_tonumber(L, index);
-		break;
+		return Variant(double(lua_tonumber(L, index)));
 	case LUA_TBOOLEAN:
-		v.type = LUA_TBOOLEAN;
-		v.boolean = lua_toboolean(L, index);
-		break;
+		return Variant(lua_toboolean(L, index) != 0);
 	default:
-		v.type = LUA_TNIL;
-		break;
+		return Variant();
 	}
-	return v;
 }
 
 
 void Variant::pushLua(lua_State* L) const
 {
-	switch (type) {
-	case LUA_TSTRING:
-		lua_pushstring(L, str.c_str());
+	switch (_type) {
+	case LUA_TSTRING: {
+		std::string_view s = strView();
+		lua_pushlstring(L, s.data(), s.size());
 		break;
+	}
 	case LUA_TNUMBER:
-		lua_pushnumber(L, num);
+		lua_pushnumber(L, num());
 		break;
 	case LUA_TBOOLEAN:
-		lua_pushboolean(L, boolean);
+		lua_pushboolean(L, boolean());
 		break;
 	default:
 		lua_pushnil(L);
@@ -66,15 +142,15 @@ void Variant::pushLua(lua_State* L) const
 
 void Variant::dump() const
 {
-	switch (type) {
+	switch (_type) {
 	case LUA_TSTRING:
-		fmt::print("{}", str);
+		fmt::print("{}", strView());
 		break;
 	case LUA_TNUMBER:
-		fmt::print("{}", num);
+		fmt::print("{}", num());
 		break;
 	case LUA_TBOOLEAN:
-		fmt::print("{}", boolean ? "true" : "false");
+		fmt::print("{}", boolean() ? "true" : "false");
 		break;
 	default:
 		fmt::print("nil");
@@ -84,13 +160,34 @@ void Variant::dump() const
 
 std::string Variant::toLuaString() const
 {
-	switch (type) {
-	case LUA_TSTRING: return fmt::format("\"{}\"", str);
-	case LUA_TNUMBER: return fmt::format("{}", num);
-	case LUA_TBOOLEAN: return fmt::format("{}", boolean ? "true" : "false");
+	switch (_type) {
+	case LUA_TSTRING: return fmt::format("\"{}\"", strView());
+	case LUA_TNUMBER: return fmt::format("{}", num());
+	case LUA_TBOOLEAN: return fmt::format("{}", boolean() ? "true" : "false");
 	case LUA_TNIL: return "nil";
 	}
 	return "unknown";
 }
 
+void Variant::write(BinWriter& w) const
+{
+	w.u8(uint8_t(_type));
+	switch (_type) {
+	case LUA_TSTRING: w.str(strView()); break;
+	case LUA_TNUMBER: w.f64(num()); break;
+	case LUA_TBOOLEAN: w.boolean(boolean()); break;
+	default: break;
+	}
+}
+
+/*static*/ Variant Variant::read(BinReader& r)
+{
+	switch (r.u8()) {
+	case LUA_TSTRING: return Variant(r.str());
+	case LUA_TNUMBER: return Variant(r.f64());
+	case LUA_TBOOLEAN: return Variant(r.boolean());
+	default: return Variant();
+	}
+}
+
 } // namespace lurp
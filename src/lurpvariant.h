@@ -1,41 +1,110 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <string.h>
+#include <stdint.h>
 
 #include "lua.hpp"
 
 namespace lurp {
-    struct Variant {
+
+class BinWriter;
+class BinReader;
+
+// A Lua value: nil, boolean, number, or string. 16 bytes.
+//
+// Strings up to kSmallSize bytes are stored inline, so copying those is a
+// memcpy. Longer strings are in a reference counted block that copies share.
+struct Variant {
+	static constexpr size_t kSmallSize = 14;
+
 	Variant() = default;
-	Variant(const Variant&) = default;
-	Variant& operator=(const Variant&) = default;
 
-	Variant(const std::string& s) : type(LUA_TSTRING), str(s) {}
-	Variant(const char* s) : type(LUA_TSTRING), str(s) {}
-	Variant(double n) : type(LUA_TNUMBER), num(n) {}
-	Variant(int n) : type(LUA_TNUMBER), num(n) {}
-	Variant(bool b) : type(LUA_TBOOLEAN), boolean(b) {}
+	Variant(std::string_view s) { setStr(s); }
+	Variant(const std::string& s) { setStr(s); }
+	Variant(const char* s) { setStr(s); }
+	Variant(double n) : _type(LUA_TNUMBER) { memcpy(_data, &n, sizeof(n)); }
+	Variant(int n) : Variant(double(n)) {}
+	Variant(bool b) : _type(LUA_TBOOLEAN) { _data[0] = b ? 1 : 0; }
 
-	bool operator==(const Variant& rhs) const {
-		return type == rhs.type && str == rhs.str && num == rhs.num && boolean == rhs.boolean;
+	Variant(const Variant& rhs) : _type(rhs._type), _len(rhs._len) {
+		memcpy(_data, rhs._data, kSmallSize);
+		if (_len == kLong) retain();
+	}
+	Variant(Variant&& rhs) noexcept : _type(rhs._type), _len(rhs._len) {
+		memcpy(_data, rhs._data, kSmallSize);
+		rhs._type = LUA_TNIL;
+		rhs._len = 0;
 	}
+	Variant& operator=(const Variant& rhs) {
+		Variant v(rhs);
+		swap(v);
+		return *this;
+	}
+	Variant& operator=(Variant&& rhs) noexcept {
+		swap(rhs);
+		return *this;
+	}
+	~Variant() {
+		if (_len == kLong) release();
+	}
+
+	bool operator==(const Variant& rhs) const;
 	bool operator!=(const Variant& rhs) const {
 		return !(*this == rhs);
 	}
 
+	int type() const { return _type; }
+	bool isNil() const { return _type == LUA_TNIL; }
+
+	// The value, if the type matches. Otherwise "", 0, or false.
+	std::string str() const { return std::string(strView()); }
+	// Valid as long as this Variant is.
+	std::string_view strView() const;
+	double num() const {
+		if (_type != LUA_TNUMBER) return 0;
+		double n;
+		memcpy(&n, _data, sizeof(n));
+		return n;
+	}
+	bool boolean() const { return _type == LUA_TBOOLEAN && _data[0] != 0; }
+
 	bool isTruthy() const;
 	bool asBool() const { return isTruthy(); }
 
 	static Variant fromLua(lua_State* L, int index);
+	// A Variant that only records the type; used for tables, functions, etc.
+	static Variant fromType(int type) {
+		Variant v;
+		v._type = int8_t(type);
+		return v;
+	}
 	void pushLua(lua_State* L) const;
 
 	std::string toLuaString() const;
 	void dump() const;
 
-	int type = LUA_TNIL;
-	std::string str;
-	double num = 0;
-	bool boolean = false;
+	void write(BinWriter& w) const;
+	static Variant read(BinReader& r);
+
+private:
+	static constexpr uint8_t kLong = 0xff;
+	struct LongStr;
+
+	void setStr(std::string_view s);
+	LongStr* longStr() const;
+	void retain();
+	void release();
+	void swap(Variant& rhs) noexcept;
+
+	// number: double. boolean: _data[0]. Short string: the bytes (not null terminated).
+	// Long string: LongStr pointer.
+	alignas(8) char _data[kSmallSize] = {};
+	int8_t _type = LUA_TNIL;
+	uint8_t _len = 0;	// short string length, or kLong
 };
 
-}
\ No newline at end of file
+static_assert(sizeof(Variant) == 16, "Variant should be 16 bytes");
+
+} // namespace lurp
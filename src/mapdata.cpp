@@ -9,6 +9,37 @@ MapData::MapData(uint32_t seed)
 	random.setSeed(seed);
 }
 
+bool MapData::markLineRead(int id)
+{
+	assert(id >= 0);
+	if (isLineRead(id))
+		return false;
+	CowWrite(_textRead).setLineRead(id);
+	_textReadVersion++;
+	if (journaling)
+		newLinesRead.push_back(id);
+	return true;
+}
+
+bool MapData::markTextRead(uint64_t hash)
+{
+	if (isTextRead(hash))
+		return false;
+	CowWrite(_textRead).hashed.insert(hash);
+	if (journaling)
+		newTextRead.push_back(hash);
+	return true;
+}
+
+void MapData::restoreTextRead(const std::shared_ptr<const TextRead>& textRead)
+{
+	// Safe: a shared TextRead is never written (see CowWrite)
+	_textRead = std::const_pointer_cast<TextRead>(textRead);
+	_textReadVersion++;
+	newLinesRead.clear();
+	newTextRead.clear();
+}
+
 NewsItem NewsItem::itemDelta(const Item& item, int delta, int count) 
 {
 	NewsItem ni;
@@ -6,6 +6,8 @@
 #include <stdint.h>
 #include <unordered_set>
 #include <queue>
+#include <vector>
+#include <memory>
 
 namespace lurp {
 
@@ -44,11 +46,55 @@ struct MapData
 {
 	static constexpr uint32_t kSeed = 0x12345678;
 
+	// Which text has been read. Every line is a bit, by Text::Line::id. Lines
+	// with substitutions read differently each time, so each rendering is also
+	// hashed, Hash(speaker, text), for TextLine::alreadyRead.
+	struct TextRead {
+		std::vector<uint64_t> bits;
+		std::unordered_set<uint64_t> hashed;
+
+		bool isLineRead(int id) const {
+			size_t w = size_t(id) / 64;
+			return w < bits.size() && (bits[w] & (uint64_t(1) << (id % 64)));
+		}
+		void setLineRead(int id) {
+			size_t w = size_t(id) / 64;
+			if (w >= bits.size()) bits.resize(w + 1, 0);
+			bits[w] |= uint64_t(1) << (id % 64);
+		}
+		void clear() {
+			bits.clear();
+			hashed.clear();
+		}
+	};
+
 	MapData(uint32_t seed);
 	Random random;
-	std::unordered_set<uint64_t> textRead;
+	// Text read since the last journal checkpoint; only tracked while journaling.
+	std::vector<int> newLinesRead;
+	std::vector<uint64_t> newTextRead;
+	bool journaling = false;
 	CoreData coreData;
 	NewsQueue newsQueue;
+
+	const TextRead& textRead() const { return *_textRead; }
+	// Changes whenever a line id is marked read, or the TextRead is replaced.
+	uint64_t textReadVersion() const { return _textReadVersion; }
+	bool isLineRead(int id) const { return _textRead->isLineRead(id); }
+	bool isTextRead(uint64_t hash) const { return _textRead->hashed.count(hash) > 0; }
+	// Returns true if this is the first time the line / text has been read.
+	bool markLineRead(int id);
+	bool markTextRead(uint64_t hash);
+	// For loading; copies if it is shared with a snapshot.
+	TextRead& mutableTextRead() { _textReadVersion++; return CowWrite(_textRead); }
+
+	// Copy-on-write snapshot (see ZoneDriver::snapshot)
+	std::shared_ptr<const TextRead> snapshotTextRead() const { return _textRead; }
+	void restoreTextRead(const std::shared_ptr<const TextRead>& textRead);
+
+private:
+	std::shared_ptr<TextRead> _textRead = std::make_shared<TextRead>();
+	uint64_t _textReadVersion = 0;
 };
 
 } // namespace lurp
\ No newline at end of file
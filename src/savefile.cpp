@@ -0,0 +1,258 @@
+#include "savefile.h"
+#include "zonedriver.h"
+#include "../drivers/platform.h"
+
+#include <fmt/core.h>
+#include <plog/Log.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace lurp {
+
+/*static*/ std::vector<uint8_t> SaveFile::write(const ZoneDriver& driver, bool compress)
+{
+	BinWriter sections;
+	driver.save(sections);
+	return encode(sections.buffer().data(), sections.size(), compress);
+}
+
+/*static*/ std::vector<uint8_t> SaveFile::encode(const uint8_t* sections, size_t size, bool compress)
+{
+	BinWriter w;
+	w.u32(kMagic);
+	w.u32(kVersion);
+	w.u32(compress ? kCompressed : 0);
+	w.u32(uint32_t(size));
+	if (compress) {
+		std::vector<uint8_t> c = SaveFile::compress(sections, size);
+		w.write(c.data(), c.size());
+	}
+	else {
+		w.write(sections, size);
+	}
+	return w.buffer();
+}
+
+/*static*/ bool SaveFile::read(const uint8_t* data, size_t size, ZoneDriver& driver)
+{
+	BinReader r(data, size);
+	uint32_t magic = r.u32();
+	uint32_t version = r.u32();
+	uint32_t flags = r.u32();
+	uint32_t rawSize = r.u32();
+	if (!r.ok() || magic != kMagic || version != kVersion) {
+		PLOG(plog::error) << "Save file has the wrong magic or version";
+		return false;
+	}
+
+	const uint8_t* payload = data + r.pos();
+	size_t payloadSize = size - r.pos();
+
+	if (flags & kCompressed) {
+		std::vector<uint8_t> raw(rawSize);
+		if (!decompress(payload, payloadSize, raw.data(), raw.size())) {
+			PLOG(plog::error) << "Save file is corrupt (compression)";
+			return false;
+		}
+		BinReader sections(raw.data(), raw.size());
+		return driver.load(sections);
+	}
+	if (payloadSize != rawSize) {
+		PLOG(plog::error) << "Save file is truncated";
+		return false;
+	}
+	BinReader sections(payload, payloadSize);
+	return driver.load(sections);
+}
+
+/*static*/ bool SaveFile::save(const std::filesystem::path& path, const ZoneDriver& driver, bool compress)
+{
+	return writeFile(path, write(driver, compress));
+}
+
+/*static*/ FILE* SaveFile::openFile(const std::filesystem::path& path, bool append)
+{
+#ifdef _WIN32
+	FILE* fp = nullptr;
+	if (_wfopen_s(&fp, path.c_str(), append ? L"ab" : L"wb") != 0) return nullptr;
+	return fp;
+#else
+	return fopen(path.c_str(), append ? "ab" : "wb");
+#endif
+}
+
+/*static*/ bool SaveFile::syncFile(FILE* fp)
+{
+#ifdef _WIN32
+	return _commit(_fileno(fp)) == 0;
+#else
+	return fsync(fileno(fp)) == 0;
+#endif
+}
+
+/*static*/ bool SaveFile::writeFile(const std::filesystem::path& path, const std::vector<uint8_t>& data)
+{
+	std::filesystem::path tmp = path;
+	tmp += ".tmp";
+
+	FILE* fp = openFile(tmp, false);
+	if (!fp) {
+		PLOG(plog::error) << fmt::format("Could not open save file '{}' for writing", tmp.string());
+		return false;
+	}
+	bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+	ok = ok && fflush(fp) == 0;
+	ok = ok && syncFile(fp);
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok) {
+		PLOG(plog::error) << fmt::format("Could not write save file '{}'", tmp.string());
+		std::error_code ec;
+		std::filesystem::remove(tmp, ec);
+		return false;
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(tmp, path, ec);
+	if (ec) {
+		PLOG(plog::error) << fmt::format("Could not rename '{}' to '{}': {}", tmp.string(), path.string(), ec.message());
+		return false;
+	}
+#ifndef _WIN32
+	// Make the rename itself durable.
+	int dir = open(path.parent_path().empty() ? "." : path.parent_path().string().c_str(), O_RDONLY);
+	if (dir >= 0) {
+		fsync(dir);
+		close(dir);
+	}
+#endif
+	return true;
+}
+
+/*static*/ bool SaveFile::load(const std::filesystem::path& path, ZoneDriver& driver)
+{
+	MappedFile file(path);
+	if (!file.valid()) {
+		PLOG(plog::error) << fmt::format("Could not open save file '{}'", path.string());
+		return false;
+	}
+	return read(file.data(), file.size(), driver);
+}
+
+// Compressed stream is a series of sequences:
+//   token: high nibble is the literal length, low nibble is the match length - kMinMatch.
+//          15 means more length bytes follow (each added; 255 means keep going)
+//   literals
+//   offset: 2 bytes, back from the current position (not present in the last sequence)
+//   match length bytes
+static constexpr size_t kMinMatch = 4;
+static constexpr size_t kMaxOffset = 0xffff;
+static constexpr int kHashBits = 12;
+
+static uint32_t Read32(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static void WriteLength(std::vector<uint8_t>& out, size_t n)
+{
+	while (n >= 255) {
+		out.push_back(255);
+		n -= 255;
+	}
+	out.push_back(uint8_t(n));
+}
+
+static void EmitSequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t nLiterals, size_t offset, size_t matchLen)
+{
+	size_t m = matchLen ? matchLen - kMinMatch : 0;
+	uint8_t token = uint8_t((nLiterals < 15 ? nLiterals : 15) << 4) | uint8_t(m < 15 ? m : 15);
+	out.push_back(token);
+	if (nLiterals >= 15) WriteLength(out, nLiterals - 15);
+	out.insert(out.end(), literals, literals + nLiterals);
+	if (matchLen) {
+		out.push_back(uint8_t(offset));
+		out.push_back(uint8_t(offset >> 8));
+		if (m >= 15) WriteLength(out, m - 15);
+	}
+}
+
+/*static*/ std::vector<uint8_t> SaveFile::compress(const uint8_t* data, size_t size)
+{
+	std::vector<uint8_t> out;
+	out.reserve(size / 2 + 16);
+	std::vector<int64_t> table(size_t(1) << kHashBits, -1);
+
+	size_t anchor = 0;
+	size_t i = 0;
+	while (i + kMinMatch <= size) {
+		uint32_t seq = Read32(data + i);
+		uint32_t h = (seq * 2654435761u) >> (32 - kHashBits);
+		int64_t cand = table[h];
+		table[h] = int64_t(i);
+
+		if (cand >= 0 && i - size_t(cand) <= kMaxOffset && Read32(data + cand) == seq) {
+			size_t len = kMinMatch;
+			while (i + len < size && data[cand + len] == data[i + len]) len++;
+			EmitSequence(out, data + anchor, i - anchor, i - size_t(cand), len);
+			i += len;
+			anchor = i;
+		}
+		else {
+			i++;
+		}
+	}
+	EmitSequence(out, data + anchor, size - anchor, 0, 0);
+	return out;
+}
+
+/*static*/ bool SaveFile::decompress(const uint8_t* data, size_t size, uint8_t* out, size_t outSize)
+{
+	const uint8_t* ip = data;
+	const uint8_t* const iend = data + size;
+	size_t op = 0;
+
+	auto readLength = [&](size_t& n) {
+		while (true) {
+			if (ip >= iend) return false;
+			uint8_t b = *ip++;
+			n += b;
+			if (b != 255) return true;
+		}
+	};
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		size_t nLiterals = token >> 4;
+		if (nLiterals == 15 && !readLength(nLiterals)) return false;
+		if (nLiterals > size_t(iend - ip) || nLiterals > outSize - op) return false;
+		memcpy(out + op, ip, nLiterals);
+		ip += nLiterals;
+		op += nLiterals;
+
+		if (ip == iend) break;	// last sequence
+
+		if (iend - ip < 2) return false;
+		size_t offset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+		ip += 2;
+		size_t matchLen = token & 0x0f;
+		if (matchLen == 15 && !readLength(matchLen)) return false;
+		matchLen += kMinMatch;
+		if (offset == 0 || offset > op || matchLen > outSize - op) return false;
+
+		// May overlap, so byte by byte.
+		for (size_t k = 0; k < matchLen; k++, op++) out[op] = out[op - offset];
+	}
+	return op == outSize;
+}
+
+} // namespace lurp
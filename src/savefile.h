@@ -0,0 +1,52 @@
+#pragma once
+
+#include "binio.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <filesystem>
+
+namespace lurp {
+
+class ZoneDriver;
+
+// The binary save format. Reading it touches no Lua state.
+//
+// Layout (little endian):
+//   header: magic, version, flags, size of the (uncompressed) sections
+//   sections: see ZoneDriver::save(BinWriter&); optionally compressed
+//
+// The Lua text format (ZoneDriver::save(std::ostream&)) is still available
+// for debugging.
+struct SaveFile {
+	static constexpr uint32_t kMagic = BinTag("LRPS");
+	static constexpr uint32_t kVersion = 2;
+	static constexpr uint32_t kCompressed = 0x01;
+
+	static std::vector<uint8_t> write(const ZoneDriver& driver, bool compress = true);
+	// Adds the header to sections written by ZoneDriver::save(BinWriter&).
+	static std::vector<uint8_t> encode(const uint8_t* sections, size_t size, bool compress = true);
+	// Returns false if the data is corrupt or the wrong version. The driver
+	// is unchanged if the header or compression is bad, but may be partially
+	// loaded if a section is.
+	static bool read(const uint8_t* data, size_t size, ZoneDriver& driver);
+
+	static bool save(const std::filesystem::path& path, const ZoneDriver& driver, bool compress = true);
+	static bool load(const std::filesystem::path& path, ZoneDriver& driver);
+
+	// Writes to a temporary file, syncs it to disk, and renames it over 'path'.
+	// If anything fails (or the program crashes part way) the old file is intact.
+	static bool writeFile(const std::filesystem::path& path, const std::vector<uint8_t>& data);
+	// Opens a binary file for writing, or appending.
+	static FILE* openFile(const std::filesystem::path& path, bool append);
+	// Flushes the OS buffers to disk.
+	static bool syncFile(FILE* fp);
+
+	// A simple LZ77 byte compressor, in the style of LZ4. Fast, and saves are
+	// mostly repeated entity IDs, so it does well enough.
+	static std::vector<uint8_t> compress(const uint8_t* data, size_t size);
+	static bool decompress(const uint8_t* data, size_t size, uint8_t* out, size_t outSize);
+};
+
+} // namespace lurp
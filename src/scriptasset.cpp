@@ -1,5 +1,8 @@
 #include "scriptasset.h"
+#include "binio.h"
 #include "scriptbridge.h"
+#include "util.h"
+#include "SpookyV2.h"
 
 #include <fmt/core.h>
 #include <fmt/ostream.h>
@@ -8,10 +11,29 @@
 
 namespace lurp {
 
-ScriptAssets::ScriptAssets(const ConstScriptAssets& csa) :
-	_csa(csa)
+void ConstScriptAssets::index()
 {
-	scan();
+	_entityIDToIndex.clear();
+	scan(scripts);
+	scan(texts);
+	scan(choices);
+	scan(items);
+	scan(powers);
+	scan(interactions);
+	scan(rooms);
+	scan(zones);
+	scan(actors);
+	scan(combatants);
+	scan(battles);
+	scan(containers);
+	scan(edges);
+	scan(callScripts);
+
+	validateEdges();
+	buildRoomGraph();
+	buildOwners();
+	compileTemplates();
+	indexTextLines();
 
 	bool hasPlayer = isAsset("player");
 	if (!hasPlayer) {
@@ -19,12 +41,52 @@ ScriptAssets::ScriptAssets(const ConstScriptAssets& csa) :
 	}
 }
 
-std::pair<bool, Variant> ScriptAssets::assetGet(const std::string& entity, const std::string& path) const
+ScriptAssets::ScriptAssets(const ConstScriptAssets& csa) :
+	_csa(csa)
+{
+}
+
+bool ScriptAssets::hasInventory(const EntityID& entityID) const
+{
+	if (!isAsset(entityID)) return false;
+	ScriptRef ref = getScriptRef(entityID);
+	return ref.type == ScriptType::kActor || ref.type == ScriptType::kContainer;
+}
+
+const Inventory& ScriptAssets::baseInventory(const ScriptRef& ref) const
+{
+	if (ref.type == ScriptType::kActor) return _csa.actors[ref.index].inventory;
+	if (ref.type == ScriptType::kContainer) return _csa.containers[ref.index].inventory;
+	FatalError(fmt::format("entity '{}' does not have an inventory", ref.entity->entityID));
+	return _csa.actors[0].inventory;
+}
+
+Inventory& ScriptAssets::getInventory(const Entity& entity)
+{
+	_inventoryVersion++;
+	if (_journaling) _dirtyInventories.insert(entity.entityID);
+	InventoryMap& inventories = CowWrite(_inventories);
+	auto it = inventories.find(entity.entityID);
+	if (it != inventories.end()) return it->second;
+
+	const Inventory& base = baseInventory(getScriptRef(entity.entityID));
+	return inventories.emplace(entity.entityID, base).first->second;
+}
+
+const Inventory& ScriptAssets::getInventory(const Entity& entity) const
+{
+	auto it = _inventories->find(entity.entityID);
+	if (it != _inventories->end()) return it->second;
+	return baseInventory(getScriptRef(entity.entityID));
+}
+
+std::pair<bool, Variant> ScriptAssets::assetGet(const EntityID& entity, std::string_view path) const
 {
 	if (!isAsset(entity)) return { false, Variant() };
 	if (path == "entityID") return { true, Variant(entity) };
 	const Entity* e = get(entity);
-	return e->getVar(path);
+	// A name that was never interned can't be a field.
+	return e->getVar(EntityID::existing(path));
 }
 
 std::string ScriptAssets::desc(const EntityID& entityID) const
@@ -36,7 +98,7 @@ std::string ScriptAssets::desc(const EntityID& entityID) const
 void ScriptAssets::log() const
 {
 	PLOG(plog::debug) << "ScriptAssets:";
-	for (auto it = entityIDToIndex.begin(); it != entityIDToIndex.end(); it++) {
+	for (auto it = _csa.entityIndex().begin(); it != _csa.entityIndex().end(); it++) {
 		//const std::string& entityID = it->first;
 		ScriptRef ref = it->second;
 		PLOG(plog::debug) << fmt::format("  {}", ref.entity->description());
@@ -54,7 +116,7 @@ void ScriptAssets::save(std::ostream& stream)
 	*/
 	fmt::print(stream, "Inventories = {{\n");
 
-	for (auto& [entityID, inventory] : inventories) {
+	for (const auto& [entityID, inventory] : *_inventories) {
 		ScriptRef ref = getScriptRef(entityID);
 		if (ref.type == ScriptType::kContainer) {
 			const Container& container = _csa.containers[ref.index];
@@ -88,14 +150,15 @@ void ScriptAssets::load(ScriptBridge& loader)
 		EntityID id = loader.getStrField("entityID", {});
 		Inventory inv = loader.readInventory();
 		inv.convert(_csa);
-		inventories[id] = inv;
+		CowWrite(_inventories)[id] = inv;
 	}
 	lua_pop(L, 1);
+	_inventoryVersion++;
 }
 
-void ScriptAssets::validateEdges()
+void ConstScriptAssets::validateEdges() const
 {
-	for (const Edge& edge : _csa.edges) {
+	for (const Edge& edge : edges) {
 		if (!isAsset(edge.room1)) {
 			FatalError(fmt::format("Edge='{}' room1='{}' does not exist", edge.entityID, edge.room1));
 			ScriptRef ref = getScriptRef(edge.room1);
@@ -113,31 +176,197 @@ void ScriptAssets::validateEdges()
 	}
 }
 
-void ScriptAssets::scan()
+void ConstScriptAssets::buildRoomGraph()
+{
+	_roomGraph.clear();
+	_roomGraph.beginBuild(edges.size() * 2);
+	for (size_t i = 0; i < edges.size(); ++i) {
+		const Edge& edge = edges[i];
+		_roomGraph.addEdge(edge.room1, edge.room2, RoomEdge{ int(i), false });
+		if (edge.room2 != edge.room1)
+			_roomGraph.addEdge(edge.room2, edge.room1, RoomEdge{ int(i), true });
+	}
+	_roomGraph.endBuild();
+}
+
+const Tree& ConstScriptAssets::tree(const EntityID& entityID) const
 {
-	scan(_csa.scripts);
-	scan(_csa.texts);
-	scan(_csa.choices);
-	scan(_csa.items);
-	scan(_csa.powers);
-	scan(_csa.interactions);
-	scan(_csa.rooms);
-	scan(_csa.zones);
-	scan(_csa.actors);
-	scan(_csa.combatants);
-	scan(_csa.battles);
-	scan(_csa.containers);
-	scan(_csa.edges);
-	scan(_csa.callScripts);
+	std::lock_guard<std::mutex> lock(_treeCache->mutex);
+	auto it = _treeCache->trees.find(entityID);
+	if (it == _treeCache->trees.end())
+		it = _treeCache->trees.emplace(entityID, Tree(*this, entityID)).first;
+	return it->second;
+}
 
-	for (size_t i = 0; i < _csa.containers.size(); ++i) {
-		inventories[_csa.containers[i].entityID] = _csa.containers[i].inventory;
+void ConstScriptAssets::compileTemplates()
+{
+	for (Text& text : texts) {
+		text.compiledTest = TextTest::compile(text.test);
+		for (Text::Line& line : text.lines) {
+			line.speakerTemplate = TextTemplate::compile(line.speaker);
+			line.textTemplate = TextTemplate::compile(line.text);
+			line.compiledTest = TextTest::compile(line.test);
+		}
 	}
-	for (size_t i = 0; i < _csa.actors.size(); ++i) {
-		inventories[_csa.actors[i].entityID] = _csa.actors[i].inventory;
+	for (Choices& c : choices) {
+		for (Choices::Choice& choice : c.choices)
+			choice.textTemplate = TextTemplate::compile(choice.text);
 	}
+}
 
-	validateEdges();
+void ConstScriptAssets::indexTextLines()
+{
+	_textLines.clear();
+	SpookyHash spooky;
+	spooky.Init(0, 0);
+	for (size_t t = 0; t < texts.size(); t++) {
+		for (size_t i = 0; i < texts[t].lines.size(); i++) {
+			Text::Line& line = texts[t].lines[i];
+			line.substitution = line.speakerTemplate.hasVars() || line.textTemplate.hasVars();
+			line.id = int(_textLines.size());
+			_textLines.push_back({ int(t), int(i) });
+			uint64_t h = Hash(line.speaker, line.text);
+			spooky.Update(&h, sizeof(h));
+		}
+	}
+	uint64_t unused = 0;
+	spooky.Final(&_textHash, &unused);
+}
+
+void ConstScriptAssets::buildOwners()
+{
+	_owner.clear();
+	auto add = [&](const Entity& parent, const std::vector<EntityID>& objects) {
+		for (const EntityID& id : objects) {
+			auto [it, added] = _owner.emplace(id, parent.entityID);
+			if (!added && it->second != parent.entityID) {
+				PLOG(plog::warning) << fmt::format("Entity '{}' is in both '{}' and '{}'. Using '{}'.", id, it->second, parent.entityID, it->second);
+			}
+		}
+	};
+	for (const Zone& zone : zones) add(zone, zone.objects);
+	for (const Room& room : rooms) add(room, room.objects);
+}
+
+ConstScriptAssets::Location ConstScriptAssets::locate(const EntityID& entityID) const
+{
+	Location loc;
+	auto it = _entityIDToIndex.find(entityID);
+	if (it == _entityIDToIndex.end()) return loc;
+
+	EntityID id = entityID;
+	ScriptType type = it->second.type;
+	if (type != ScriptType::kRoom && type != ScriptType::kZone) {
+		id = owner(id);
+		if (id.empty()) return loc;
+		type = getScriptRef(id).type;
+	}
+	if (type == ScriptType::kRoom) {
+		loc.room = id;
+		loc.zone = owner(id);
+	}
+	else if (type == ScriptType::kZone) {
+		loc.zone = id;
+	}
+	return loc;
+}
+
+/*static*/ void ScriptAssets::writeInventory(BinWriter& w, const EntityID& entityID, const Inventory& inventory)
+{
+	w.str(entityID.str());
+	w.u32(uint32_t(inventory.items().size()));
+	for (const ItemRef& ref : inventory.items()) {
+		w.str(ref.pItem->entityID.str());
+		w.i32(ref.count);
+	}
+}
+
+bool ScriptAssets::readInventory(BinReader& r, EntityID& entityID, Inventory& inv) const
+{
+	entityID = EntityID(r.str());
+	uint32_t nItems = r.count(8);
+	for (uint32_t j = 0; j < nItems && r.ok(); j++) {
+		EntityID itemID(r.str());
+		int count = r.i32();
+		if (!isAsset(itemID) || getScriptRef(itemID).type != ScriptType::kItem || count <= 0) {
+			PLOG(plog::warning) << fmt::format("Save file has unknown item '{}'", itemID);
+			continue;
+		}
+		inv.addItem(getItem(itemID), count);
+	}
+	if (!hasInventory(entityID)) {
+		PLOG(plog::warning) << fmt::format("Save file has unknown inventory '{}'", entityID);
+		return false;
+	}
+	return true;
+}
+
+void ScriptAssets::save(BinWriter& w) const
+{
+	std::vector<std::pair<const EntityID*, const Inventory*>> changed;
+	for (const auto& [entityID, inventory] : *_inventories) {
+		if (inventory != baseInventory(getScriptRef(entityID)))
+			changed.push_back({ &entityID, &inventory });
+	}
+	w.u32(uint32_t(changed.size()));
+	for (const auto& [entityID, inventory] : changed) {
+		writeInventory(w, *entityID, *inventory);
+	}
+}
+
+bool ScriptAssets::load(BinReader& r)
+{
+	_inventories = std::make_shared<InventoryMap>();
+	_dirtyInventories.clear();
+	_inventoryVersion++;
+
+	uint32_t n = r.count(8);
+	for (uint32_t i = 0; i < n && r.ok(); i++) {
+		EntityID entityID;
+		Inventory inv;
+		if (readInventory(r, entityID, inv))
+			(*_inventories)[entityID] = inv;
+	}
+	return r.ok();
+}
+
+void ScriptAssets::setJournaling(bool on)
+{
+	_journaling = on;
+	_dirtyInventories.clear();
+}
+
+void ScriptAssets::saveChanges(BinWriter& w)
+{
+	// Write the whole inventory; they are small, and it keeps the records idempotent.
+	w.u32(uint32_t(_dirtyInventories.size()));
+	for (const EntityID& entityID : _dirtyInventories) {
+		auto it = _inventories->find(entityID);
+		writeInventory(w, entityID, it != _inventories->end() ? it->second : baseInventory(getScriptRef(entityID)));
+	}
+	_dirtyInventories.clear();
+}
+
+bool ScriptAssets::loadChanges(BinReader& r)
+{
+	_inventoryVersion++;
+
+	uint32_t n = r.count(8);
+	for (uint32_t i = 0; i < n && r.ok(); i++) {
+		EntityID entityID;
+		Inventory inv;
+		if (readInventory(r, entityID, inv))
+			CowWrite(_inventories)[entityID] = inv;
+	}
+	return r.ok();
+}
+
+void ScriptAssets::restore(const std::shared_ptr<const InventoryMap>& inventories)
+{
+	// Safe: a shared map is never written (see CowWrite)
+	_inventories = std::const_pointer_cast<InventoryMap>(inventories);
+	_inventoryVersion++;
+	_dirtyInventories.clear();
 }
 
 #define TYPE_BODY(vecName, itemEnum) \
@@ -1,18 +1,56 @@
 #pragma once
 
 #include <map>
+#include <set>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
 #include <fmt/format.h>
 
 #include "zone.h"
 #include "scripttypes.h"
 #include "iscript.h"
+#include "graph.h"
+#include "tree.h"
 
 namespace lurp {
 
 class ScriptBridge;
+class BinWriter;
+class BinReader;
 
+// Location of a Lua function: Global[entityID][index][key], where index==0
+// refers to the entity table itself. Used to find the function in any
+// Lua state that has run the game file.
+struct FuncPath {
+	std::string table;
+	EntityID entityID;
+	int index = 0;
+	std::string key;
+};
+
+// An entry in the room adjacency graph: the edge, and whether the
+// room is room2 (so the direction is reversed.)
+struct RoomEdge {
+	int edge = -1;		// index into ConstScriptAssets::edges
+	bool flip = false;
+};
+using RoomGraph = Graph<EntityID, RoomEdge>;
+
+// The immutable assets of a game. Read once, and then shared (read-only) by
+// any number of game sessions.
+//
+// The eval() and code() fields of the entities are indices into 'funcs', not
+// Lua references. Each ScriptBridge maps them to functions in its own Lua state.
 struct ConstScriptAssets
 {
+	ConstScriptAssets() = default;
+	// Entities are referenced by pointer (the index, inventories) so copying is an error.
+	ConstScriptAssets(const ConstScriptAssets&) = delete;
+	ConstScriptAssets& operator=(const ConstScriptAssets&) = delete;
+	ConstScriptAssets(ConstScriptAssets&&) = default;
+	ConstScriptAssets& operator=(ConstScriptAssets&&) = default;
+
 	std::vector<Script> scripts;
 	std::vector<Text> texts;
 	std::vector<Choices> choices;
@@ -27,29 +65,134 @@ struct ConstScriptAssets
 	std::vector<Container> containers;
 	std::vector<Edge> edges;
 	std::vector<CallScript> callScripts;
-};
 
-struct ScriptAssets : public IAssetHandler
-{
-	ScriptAssets(const ConstScriptAssets& csa);
+	std::vector<FuncPath> funcs;
 
-	std::map<EntityID, Inventory> inventories;
+	// Build the entity index and validate the assets. Called once after
+	// the assets are read; the vectors must not change after.
+	void index();
 
 	ScriptRef getScriptRef(const EntityID& entityID) const {
-		auto it = entityIDToIndex.find(entityID);
-		if (it == entityIDToIndex.end()) {
+		auto it = _entityIDToIndex.find(entityID);
+		if (it == _entityIDToIndex.end()) {
 			FatalError(fmt::format("entity '{}' does not exist.\n", entityID));
 		}
 		return it->second;
 	}
 
+	bool isAsset(const EntityID& entityID) const {
+		return _entityIDToIndex.find(entityID) != _entityIDToIndex.end();
+	}
+
+	const std::unordered_map<EntityID, ScriptRef>& entityIndex() const { return _entityIDToIndex; }
+
+	// The Room or Zone that lists 'entityID' as an object. Empty if it isn't placed.
+	const EntityID& owner(const EntityID& entityID) const {
+		static const EntityID none;
+		auto it = _owner.find(entityID);
+		return it == _owner.end() ? none : it->second;
+	}
+
+	// Where an entity is. 'room' is empty for a Zone, or for an entity that is
+	// directly in a Zone. Both are empty if the entity isn't placed.
+	struct Location {
+		EntityID zone;
+		EntityID room;
+	};
+	Location locate(const EntityID& entityID) const;
+
+	// Every Text::Line has a dense id, so read state can be a bitset.
+	// textHash() changes if any line changes.
+	int numTextLines() const { return int(_textLines.size()); }
+	const Text::Line& textLine(int id) const {
+		const TextLineRef& ref = _textLines[id];
+		return texts[ref.text].lines[ref.line];
+	}
+	uint64_t textHash() const { return _textHash; }
+
+	// Room -> (adjacent room, edge). Built by index().
+	const RoomGraph& roomGraph() const { return _roomGraph; }
+
+	// The Tree of a script. Built the first time it is asked for, and then
+	// shared by every driver and session. Thread safe.
+	const Tree& tree(const EntityID& entityID) const;
+
+	// Calls f(table, entityID, func) for every function field, where 'table' is the
+	// global Lua table that holds the entity.
+	template<typename F>
+	void forEachFunc(F&& f) {
+		for (Script& s : scripts) f("Scripts", s.entityID, s.code);
+		for (Text& t : texts) {
+			f("Texts", t.entityID, t.eval);
+			f("Texts", t.entityID, t.code);
+			for (Text::Line& line : t.lines) {
+				f("Texts", t.entityID, line.eval);
+				f("Texts", t.entityID, line.code);
+			}
+		}
+		for (Choices& c : choices) {
+			for (Choices::Choice& choice : c.choices) {
+				f("AllChoices", c.entityID, choice.eval);
+				f("AllChoices", c.entityID, choice.code);
+			}
+		}
+		for (Interaction& i : interactions) {
+			f("Interactions", i.entityID, i.eval);
+			f("Interactions", i.entityID, i.code);
+		}
+		for (Container& c : containers) f("Containers", c.entityID, c.eval);
+		for (CallScript& cs : callScripts) {
+			f("CallScripts", cs.entityID, cs.code);
+			f("CallScripts", cs.entityID, cs.eval);
+		}
+	}
+
+private:
+	std::unordered_map<EntityID, ScriptRef> _entityIDToIndex;
+	std::unordered_map<EntityID, EntityID> _owner;
+	RoomGraph _roomGraph;
+	struct TextLineRef {
+		int text;
+		int line;
+	};
+	std::vector<TextLineRef> _textLines;
+	uint64_t _textHash = 0;
+
+	struct TreeCache {
+		std::mutex mutex;
+		std::unordered_map<EntityID, Tree> trees;	// node based, so references are stable
+	};
+	std::unique_ptr<TreeCache> _treeCache = std::make_unique<TreeCache>();
+
+	void validateEdges() const;
+	void buildRoomGraph();
+	void buildOwners();
+	void compileTemplates();
+	void indexTextLines();
+
+	template <typename T>
+	void scan(const std::vector<T>& vec) {
+		for (size_t i = 0; i < vec.size(); ++i) _entityIDToIndex[vec[i].entityID] = { &vec[i], T::type, int(i) };
+	}
+};
+
+// The per-session view of the assets: the shared ConstScriptAssets plus
+// the inventories this session has changed. Cheap to construct.
+struct ScriptAssets : public IAssetHandler
+{
+	ScriptAssets(const ConstScriptAssets& csa);
+
+	ScriptRef getScriptRef(const EntityID& entityID) const {
+		return _csa.getScriptRef(entityID);
+	}
+
 	const Entity* get(const EntityID& entityID) const {
 		ScriptRef sr = getScriptRef(entityID);
 		return sr.entity;
 	}
 
 	bool isAsset(const EntityID& entityID) const {
-		return entityIDToIndex.find(entityID) != entityIDToIndex.end();
+		return _csa.isAsset(entityID);
 	}
 
 	const Script& getScript(const EntityID& entityID) const;
@@ -67,21 +210,43 @@ struct ScriptAssets : public IAssetHandler
 	const Edge& getEdge(const EntityID& entityID) const;
 	const Power& getPower(const EntityID& entityID) const;
 
-	Inventory& getInventory(const Entity& entity) {
-		return inventories.at(entity.entityID);
-	}
+	// Actors and Containers have inventories.
+	bool hasInventory(const EntityID& entityID) const;
 
-	const Inventory& getInventory(const Entity& entity) const{
-		return inventories.at(entity.entityID);
-	}
+	// Copy-on-write: the first mutable access copies the inventory from
+	// the ConstScriptAssets into this session.
+	Inventory& getInventory(const Entity& entity);
+	const Inventory& getInventory(const Entity& entity) const;
+
+	using InventoryMap = std::map<EntityID, Inventory>;
+
+	// The inventories that have been accessed for change.
+	const InventoryMap& changedInventories() const { return *_inventories; }
+	// Incremented by every mutable access to an inventory.
+	uint64_t inventoryVersion() const { return _inventoryVersion; }
 
 	const ConstScriptAssets& getConst() const { return _csa; }
 
+	// Lua text; a debug format.
 	void save(std::ostream& stream);
 	void load(ScriptBridge& loader);
 
+	// Binary (see SaveFile). Loading replaces the current inventories.
+	void save(BinWriter& w) const;
+	bool load(BinReader& r);
+
+	// Journaling (see Journal). While on, inventories accessed for change are
+	// tracked, and saveChanges() writes (and forgets) them.
+	void setJournaling(bool on);
+	void saveChanges(BinWriter& w);
+	bool loadChanges(BinReader& r);
+
+	// Copy-on-write snapshot of the inventories (see ZoneDriver::snapshot).
+	std::shared_ptr<const InventoryMap> snapshot() const { return _inventories; }
+	void restore(const std::shared_ptr<const InventoryMap>& inventories);
+
 	// IAssetHandler
-	virtual std::pair<bool, Variant> assetGet(const std::string& entity, const std::string& path) const;
+	virtual std::pair<bool, Variant> assetGet(const EntityID& entity, std::string_view path) const;
 
 	// Debugging: return the description of the entity
 	std::string desc(const EntityID& entityID) const;
@@ -90,15 +255,15 @@ struct ScriptAssets : public IAssetHandler
 	const ConstScriptAssets& _csa;
 
 private:
-	std::map<EntityID, ScriptRef> entityIDToIndex;
-	void validateEdges();
-
-	void scan();
+	const Inventory& baseInventory(const ScriptRef& ref) const;
+	static void writeInventory(BinWriter& w, const EntityID& entityID, const Inventory& inventory);
+	// Returns false if the inventory should be skipped.
+	bool readInventory(BinReader& r, EntityID& entityID, Inventory& inventory) const;
 
-	template <typename T>
-	void scan(const std::vector<T>& vec) {
-		for (size_t i = 0; i < vec.size(); ++i) entityIDToIndex[vec[i].entityID] = { &vec[i], T::type, int(i) };
-	}
+	std::shared_ptr<InventoryMap> _inventories = std::make_shared<InventoryMap>();
+	uint64_t _inventoryVersion = 0;
+	bool _journaling = false;
+	std::set<EntityID> _dirtyInventories;
 };
 
 } // namespace lurp
@@ -5,6 +5,8 @@
 #include "util.h"
 #include "../drivers/platform.h"
 #include "markdown.h"
+#include "bundle.h"
+#include "assetschema.h"
 
 #include <plog/Log.h>
 
@@ -13,6 +15,8 @@
 #include <assert.h>
 #include <filesystem>
 #include <array>
+#include <map>
+#include <algorithm>
 
 namespace lurp {
 
@@ -58,6 +62,7 @@ static void DumpStack(lua_State* L, int n) {
 
 ScriptBridge::ScriptBridge()
 {
+	*(ScriptBridge**)lua_getextraspace(getLuaState()) = this;
 	//lua_pushstring(L, "script/");
 	//lua_setglobal(L, "DIR");
 	setGlobal("DIR", "script/");
@@ -107,8 +112,91 @@ ScriptBridge::ScriptBridge()
 	//fmt::print("Script engine init.\n");
 }
 
+ScriptBridge::ScriptBridge(ScriptBridge& host) : LuaBridge(host)
+{
+	lua_State* L = getLuaState();
+	*(ScriptBridge**)lua_getextraspace(L) = this;
+
+	host.enableSessions();
+	host._sessions.push_back(this);
+	lua_newtable(L);
+	_envRef = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	_funcRefs = host._funcRefs;
+	_basicTestPassed = host._basicTestPassed;
+}
+
 ScriptBridge::~ScriptBridge()
 {
+	assert(_sessions.empty());
+	if (_envRef != LUA_NOREF)
+		luaL_unref(getLuaState(), LUA_REGISTRYINDEX, _envRef);
+	if (isSession()) {
+		std::vector<ScriptBridge*>& sessions = static_cast<ScriptBridge*>(host())->_sessions;
+		sessions.erase(std::find(sessions.begin(), sessions.end(), this));
+	}
+}
+
+void ScriptBridge::clearSharedCaches()
+{
+	ScriptBridge* h = isSession() ? static_cast<ScriptBridge*>(host()) : this;
+	h->clearCaches();
+	for (ScriptBridge* s : h->_sessions)
+		s->clearCaches();
+}
+
+// Set by SetupScriptEnv() and Entity(), so they are per session.
+static const char* const kSessionGlobals[] = { "script", "player", "npc", "zone", "room", "CoreCache" };
+
+void ScriptBridge::enableSessions()
+{
+	if (_envRef != LUA_NOREF) return;
+
+	// The game's Lua functions all use the one global table (their _ENV is
+	// fixed when the chunk is loaded), so the per session globals are taken out
+	// of it, and its metatable finds them in the running session.
+	lua_State* L = getLuaState();
+	LuaStackCheck check(L);
+
+	lua_pushglobaltable(L);					// -1 globals
+	assert(!lua_getmetatable(L, -1));
+	lua_newtable(L);						// -1 env, -2 globals
+	for (const char* name : kSessionGlobals) {
+		lua_getfield(L, -2, name);
+		lua_setfield(L, -2, name);
+		lua_pushnil(L);
+		lua_setfield(L, -3, name);
+	}
+	_envRef = luaL_ref(L, LUA_REGISTRYINDEX);	// -1 globals
+
+	lua_createtable(L, 0, 2);				// -1 metatable, -2 globals
+	lua_pushcfunction(L, l_SessionIndex);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, l_SessionNewIndex);
+	lua_setfield(L, -2, "__newindex");
+	lua_setmetatable(L, -2);
+	lua_pop(L, 1);
+}
+
+/*static*/ int ScriptBridge::l_SessionIndex(lua_State* L)
+{
+	// 1 globals, 2 key
+	ScriptBridge* bridge = Bridge(L);
+	lua_rawgeti(L, LUA_REGISTRYINDEX, bridge->_envRef);
+	lua_pushvalue(L, 2);
+	lua_rawget(L, -2);
+	return 1;
+}
+
+/*static*/ int ScriptBridge::l_SessionNewIndex(lua_State* L)
+{
+	// 1 globals, 2 key, 3 value
+	ScriptBridge* bridge = Bridge(L);
+	lua_rawgeti(L, LUA_REGISTRYINDEX, bridge->_envRef);
+	lua_pushvalue(L, 2);
+	lua_pushvalue(L, 3);
+	lua_rawset(L, -3);
+	return 0;
 }
 
 void ScriptBridge::registerCallbacks()
@@ -119,13 +207,14 @@ void ScriptBridge::registerCallbacks()
 	};
 
 	// Register c callback funcs
-	static const int NUM_FUNCS = 9;
+	static const int NUM_FUNCS = 10;
 	static const Func funcs[NUM_FUNCS] = {
 		{ "CRandom", &l_CRandom },
 		{ "CDeltaItem", &l_CDeltaItem},
 		{ "CNumItems", &l_CNumItems},
 		{ "CCoreGet", &l_CCoreGet},
 		{ "CCoreSet", &l_CCoreSet},
+		{ "CCoreTable", &l_CCoreTable},
 		{ "CAllTextRead", &l_CAllTextRead},
 		{ "CMove", &l_CMove},
 		{ "CEndGame", &l_CEndGame},
@@ -185,72 +274,6 @@ Color ScriptBridge::GetColorField(const std::string& key, const std::optional<Co
 	return c;
 }
 
-std::vector<EntityID> ScriptBridge::readObjects() const
-{
-	std::vector<EntityID> obj;
-
-	lua_State* state = getLuaState();
-
-	for (TableIt it(state, -1); !it.done(); it.next()) {
-		if (lua_istable(state, -1)) {
-			Variant v = getField(state, "entityID", 0);
-			assert(v.type == LUA_TSTRING);
-			obj.push_back(v.str);
-		}
-	}
-	return obj;
-}
-
-Edge ScriptBridge::readEdge() const
-{
-	Edge re;
-
-	try {
-		re.entityID = readEntityID("entityID", {});
-		std::string dir = toLower(getStrField("dir", { "" }));
-
-		if (!dir.empty()) {
-			if (dir == "north" || dir == "n") re.dir = Edge::Dir::kNorth;
-			else if (dir == "northeast" || dir == "ne") re.dir = Edge::Dir::kNortheast;
-			else if (dir == "east" || dir == "e") re.dir = Edge::Dir::kEast;
-			else if (dir == "southeast" || dir == "se") re.dir = Edge::Dir::kSoutheast;
-			else if (dir == "south" || dir == "s") re.dir = Edge::Dir::kSouth;
-			else if (dir == "southwest" || dir == "sw") re.dir = Edge::Dir::kSouthwest;
-			else if (dir == "west" || dir == "w") re.dir = Edge::Dir::kWest;
-			else if (dir == "northwest" || dir == "nw") re.dir = Edge::Dir::kNorthwest;
-			else assert(false);
-		}
-
-		re.name = getStrField("name", { "" });
-		re.room1 = getStrField("room1", {});
-		re.room2 = getStrField("room2", {});
-		re.locked = getBoolField("locked", { false });
-		re.key = getStrField("key", { "" });
-	}
-	catch(std::exception& e) {
-		FatalReadError(e.what(), re);
-	}
-	return re;
-}
-
-Container ScriptBridge::readContainer() const
-{
-	Container c;
-
-	try {
-		c.entityID = readEntityID("entityID", {});
-		c.name = getStrField("name", {});
-		c.locked = getBoolField("locked", { false });
-		c.key = getStrField("key", { "" });
-		c.eval = getFuncField("eval");
-		c.inventory = readInventory();
-	}
-	catch (std::exception& e) {
-		FatalReadError(e.what(), c);
-	}
-	return c;
-}
-
 Inventory ScriptBridge::readInventory() const
 {
 	Inventory inv;
@@ -268,447 +291,602 @@ Inventory ScriptBridge::readInventory() const
 	return inv;
 }
 
-Room ScriptBridge::readRoom() const
+static ScriptType ToScriptType(const std::string& type)
 {
-	Room r;
+	if (type == "Script") return ScriptType::kScript;
+	if (type == "Text") return ScriptType::kText;
+	if (type == "Choices") return ScriptType::kChoices;
+	if (type == "Battle") return ScriptType::kBattle;
+	if (type == "CallScript") return ScriptType::kCallScript;
+	assert(false);
+	return ScriptType::kScript;
+}
 
-	try {
-		r.entityID = readEntityID("entityID", {});
-		r.name = getStrField("name", {});
-		r.desc = getStrField("desc", { "" });
-		r.objects = readObjects();
-	}
-	catch (std::exception& e) {
-		FatalReadError(e.what(), r);
-	}
-	return r;
+static bool ReadDir(lua_State* L, Edge& e)
+{
+	std::string dir;
+	if (!SchemaRead(L, dir)) return false;
+	dir = toLower(dir);
+
+	if (dir.empty()) return true;
+	if (dir == "north" || dir == "n") e.dir = Edge::Dir::kNorth;
+	else if (dir == "northeast" || dir == "ne") e.dir = Edge::Dir::kNortheast;
+	else if (dir == "east" || dir == "e") e.dir = Edge::Dir::kEast;
+	else if (dir == "southeast" || dir == "se") e.dir = Edge::Dir::kSoutheast;
+	else if (dir == "south" || dir == "s") e.dir = Edge::Dir::kSouth;
+	else if (dir == "southwest" || dir == "sw") e.dir = Edge::Dir::kSouthwest;
+	else if (dir == "west" || dir == "w") e.dir = Edge::Dir::kWest;
+	else if (dir == "northwest" || dir == "nw") e.dir = Edge::Dir::kNorthwest;
+	else assert(false);
+	return true;
 }
 
-Zone ScriptBridge::readZone() const
+static bool ReadItems(lua_State* L, Inventory& inv)
 {
-	Zone z;
-	try {
-		z.entityID = readEntityID("entityID", {});
-		z.objects = readObjects();
-		z.name = getStrField("name", { "" });
-	}
-	catch (std::exception& e) {
-		FatalReadError(e.what(), z);
+	if (lua_type(L, -1) != LUA_TTABLE) return false;
+	for (const auto& p : LuaBridge::toStrCountArray(L)) {
+		inv.addInitItem(p.str, p.count);
 	}
-	return z;
+	return true;
 }
 
-Item ScriptBridge::readItem() const
+static bool ReadPowers(lua_State* L, std::vector<EntityID>& powers)
 {
-	Item item;
-	try {
-		item.entityID = readEntityID("entityID", {});
-		item.name = getStrField("name", {});
-		item.desc = getStrField("desc", { "" });
-		item.range = getIntField("range", { 0 });
-		item.armor = getIntField("armor", { 0 });
-		item.damage = Die::parse(getStrField("damage", { "" }));
-		item.ap = getIntField("ap", { 0 });
+	if (lua_type(L, -1) != LUA_TTABLE) return false;
+	for (TableIt it(L, -1); !it.done(); it.next()) {
+		EntityID id;
+		if (!SchemaRead(L, id)) return false;
+		powers.push_back(id);
 	}
-	catch (std::exception& e) {
-		FatalReadError(e.what(), item);
-	}
-	return item;
+	return true;
 }
 
-Power ScriptBridge::readPower() const
+// Any entity table in a Room or Zone is an object in it.
+static bool ReadObject(lua_State* L, std::vector<EntityID>& objects)
 {
-	Power power;
-	try {
-		power.entityID = readEntityID("entityID", {});
-		power.name = getStrField("name", {});
-		power.effect = getStrField("effect", {});
-		power.cost = getIntField("cost", { 1 });
-		power.range = getIntField("range", { 1 });
-		power.strength = getIntField("strength", { 1 });
-		power.region = getBoolField("region", { false });
-	}
-	catch (std::exception& e) {
-		FatalReadError(e.what(), power);
-	}
-	return power;
+	if (lua_type(L, -1) != LUA_TTABLE) return true;
+	EntityID id;
+	if (!SchemaRead(L, id)) return false;
+	objects.push_back(id);
+	return true;
 }
 
-Text ScriptBridge::readText() const
+static bool ReadRegions(lua_State* L, Battle& b)
 {
-	Text text;
-	try {
-		/*
-			Text {
-				entityID = "T1",
-				eval = function() return true end,
-				test = "{player.alive}",
-				code = function() player:set("sun", true) end,
-				s = "narrator",
-
-				{ eval = function() return true end, s = "narrator", "It is a beautiful day", "The birds are singing" },
-				{ test = "{player.energetic}",	s = "player", "I should go outside" },
-				{ code = function() zone:set("outside", true) end, s = "narrator", "You go outside" }
-
-				"This is also text",
-				"That the narrator says.",
-			}
-		*/
+	if (lua_type(L, -1) != LUA_TTABLE) return false;
+	for (TableIt it(L, -1); !it.done(); it.next()) {
+		if (it.kType() == LUA_TNUMBER) {
+			lurp::swbattle::Region r;
+			r.name = LuaBridge::getField(L, "", 1).str();
+			r.yards = (int)LuaBridge::getField(L, "", 2).num();
+			std::string c = LuaBridge::getField(L, "", 3).str();
+			if (c == "light") r.cover = lurp::swbattle::Cover::kLightCover;
+			else if (c == "medium") r.cover = lurp::swbattle::Cover::kMediumCover;
+			else if (c == "heavy") r.cover = lurp::swbattle::Cover::kHeavyCover;
+
+			b.regions.push_back(r);
+		}
+	}
+	return true;
+}
 
-		text.entityID = readEntityID("entityID", {});
-		text.eval = getFuncField("eval");
-		text.test = getStrField("test", { "" });
-		text.code = getFuncField("code");
-		std::string speaker = getStrField("s", { "" });
+/*
+	Text {
+		entityID = "T1",
+		eval = function() return true end,
+		test = "{player.alive}",
+		code = function() player:set("sun", true) end,
+		s = "narrator",
 
-		if (hasField("md")) {
-			std::string md = getStrField("md", {});
-			std::vector<Text::Line> lines = Text::parseMarkdown(md);
+		{ eval = function() return true end, s = "narrator", "It is a beautiful day", "The birds are singing" },
+		{ test = "{player.energetic}",	s = "player", "I should go outside" },
+		{ code = function() zone:set("outside", true) end, s = "narrator", "You go outside" }
 
-			for (const Text::Line& line : lines) {
-				text.lines.push_back(line);
+		"This is also text",
+		"That the narrator says.",
+	}
+*/
+// A Text while it is being read. The keys come in any order, so the speaker
+// and md lines are applied once the whole table has been read.
+struct TextReader : Text {
+	std::string speaker;
+	std::string md;
+	std::vector<size_t> plainLines;	// lines from plain strings, which use 'speaker'
+
+	Text finish() {
+		for (size_t i : plainLines) {
+			lines[i].speaker = speaker;
+		}
+		if (!md.empty()) {
+			std::vector<Text::Line> mdLines = Text::parseMarkdown(md);
+			lines.insert(lines.begin(), mdLines.begin(), mdLines.end());
+		}
+		return static_cast<Text&>(*this);
+	}
+};
+
+// A table of lines in a Text, which share the same speaker, eval(), and code().
+struct LineReader : Text::Line {
+	std::vector<std::string> texts;
+};
+
+// The schema for every asset type, bound to one Lua state.
+struct AssetSchemas {
+	AssetSchemas(lua_State* L);
+
+	using LineSchema = AssetSchema<LineReader>;
+	using ChoiceSchema = AssetSchema<Choices::Choice>;
+	using EventSchema = AssetSchema<Script::Event>;
+	using ScriptSchema = AssetSchema<Script>;
+	using TextSchema = AssetSchema<TextReader>;
+	using ChoicesSchema = AssetSchema<Choices>;
+	using ItemSchema = AssetSchema<Item>;
+	using PowerSchema = AssetSchema<Power>;
+	using InteractionSchema = AssetSchema<Interaction>;
+	using ContainerSchema = AssetSchema<Container>;
+	using EdgeSchema = AssetSchema<Edge>;
+	using RoomSchema = AssetSchema<Room>;
+	using ZoneSchema = AssetSchema<Zone>;
+	using ActorSchema = AssetSchema<Actor>;
+	using CombatantSchema = AssetSchema<Combatant>;
+	using BattleSchema = AssetSchema<Battle>;
+	using CallScriptSchema = AssetSchema<CallScript>;
+
+	// nested tables
+	LineSchema line;
+	ChoiceSchema choice;
+	EventSchema event;
+
+	ScriptSchema script;
+	TextSchema text;
+	ChoicesSchema choices;
+	ItemSchema item;
+	PowerSchema power;
+	InteractionSchema interaction;
+	ContainerSchema container;
+	EdgeSchema edge;
+	RoomSchema room;
+	ZoneSchema zone;
+	ActorSchema actor;
+	CombatantSchema combatant;
+	BattleSchema battle;
+	CallScriptSchema callScript;
+};
+
+AssetSchemas::AssetSchemas(lua_State* L) :
+	line(L, nullptr, {
+		{ "s", LineSchema::Value<&LineReader::speaker> },
+		{ "test", LineSchema::Value<&LineReader::test> },
+		{ "eval", LineSchema::Func<&LineReader::eval> },
+		{ "code", LineSchema::Func<&LineReader::code> },
+	}, [](lua_State* L, LineReader& r) {
+		// The strings are the actual text lines.
+		if (lua_type(L, -2) == LUA_TNUMBER && lua_type(L, -1) == LUA_TSTRING)
+			r.texts.push_back(lua_tostring(L, -1));
+		return true;
+	}),
+	choice(L, nullptr, {
+		{ "text", ChoiceSchema::Value<&Choices::Choice::text>, true },
+		{ "next", ChoiceSchema::Value<&Choices::Choice::next> },
+		{ "eval", ChoiceSchema::Func<&Choices::Choice::eval> },
+		{ "code", ChoiceSchema::Func<&Choices::Choice::code> },
+	}),
+	event(L, nullptr, {
+		{ "entityID", EventSchema::Value<&Script::Event::entityID>, true },
+		{ "type", [](lua_State* L, Script::Event& e) {
+			std::string type;
+			if (!SchemaRead(L, type)) return false;
+			e.type = ToScriptType(type);
+			return true;
+		}, true },
+	}),
+	script(L, "Script", {
+		{ "entityID", ScriptSchema::Value<&Script::entityID>, true },
+		{ "code", ScriptSchema::Func<&Script::code> },
+		{ "npc", ScriptSchema::Value<&Script::npc> },
+	}, [this](lua_State* L, Script& s) {
+		if (lua_type(L, -2) != LUA_TNUMBER) return true;
+		if (lua_type(L, -1) != LUA_TTABLE) return false;
+		Script::Event e;
+		event.read(e);
+		s.events.push_back(e);
+		return true;
+	}),
+	text(L, "Text", {
+		{ "entityID", TextSchema::Value<&TextReader::entityID>, true },
+		{ "eval", TextSchema::Func<&TextReader::eval> },
+		{ "test", TextSchema::Value<&TextReader::test> },
+		{ "code", TextSchema::Func<&TextReader::code> },
+		{ "s", TextSchema::Value<&TextReader::speaker> },
+		{ "md", TextSchema::Value<&TextReader::md> },
+	}, [this](lua_State* L, TextReader& t) {
+		if (lua_type(L, -2) != LUA_TNUMBER) return true;
+		if (lua_type(L, -1) == LUA_TTABLE) {
+			LineReader r;
+			line.read(r);
+			for (const std::string& s : r.texts) {
+				Text::Line l = r;
+				l.text = s;
+				t.lines.push_back(l);
 			}
 		}
-
-		for (TableIt it(getLuaState(), -1); !it.done(); it.next()) {
-			if (it.kType() != LUA_TNUMBER)
-				continue;
-			if (it.vType() == LUA_TTABLE) {
-				Text::Line line;
-				if (hasField("s")) {
-					line.speaker = getStrField("s", {});
-				}
-				if (hasField("test")) {
-					line.test = getStrField("test", {});
-				}
-				if (hasField("eval")) {
-					line.eval = getFuncField("eval");
-				}
-				if (hasField("code")) {
-					line.code = getFuncField("code");
-				}
-
-				// This inner loop goes through each of the strings,
-				// which are the actual text lines, assigned to the same
-				// speaker with the same eval() and code().
-				for (TableIt inner(getLuaState(), -1); !inner.done(); inner.next()) {
-					if (inner.kType() != LUA_TNUMBER) continue;
-					Variant v = inner.value();
-					if (v.type != LUA_TSTRING) continue;
-					line.text = v.str;
-					text.lines.push_back(line);
+		else if (lua_type(L, -1) == LUA_TSTRING) {
+			Text::Line l;
+			l.text = lua_tostring(L, -1);
+			t.plainLines.push_back(t.lines.size());
+			t.lines.push_back(l);
+		}
+		return true;
+	}),
+	choices(L, "Choices", {
+		{ "entityID", ChoicesSchema::Value<&Choices::entityID>, true },
+		{ "action", [](lua_State* L, Choices& c) {
+			std::string a;
+			if (!SchemaRead(L, a)) return false;
+			if (a == "done") c.action = Choices::Action::kDone;
+			else if (a == "rewind") c.action = Choices::Action::kRewind;
+			else if (a == "repeat") c.action = Choices::Action::kRepeat;
+			else if (a == "pop") c.action = Choices::Action::kPop;
+			return true;
+		} },
+	}, [this](lua_State* L, Choices& c) {
+		if (lua_type(L, -2) != LUA_TNUMBER) return true;
+		if (lua_type(L, -1) != LUA_TTABLE) return false;
+		Choices::Choice ch;
+		ch.next = EntityID("done");
+		choice.read(ch);
+		c.choices.push_back(ch);
+		return true;
+	}),
+	item(L, "Item", {
+		{ "entityID", ItemSchema::Value<&Item::entityID>, true },
+		{ "name", ItemSchema::Value<&Item::name>, true },
+		{ "desc", ItemSchema::Value<&Item::desc> },
+		{ "range", ItemSchema::Value<&Item::range> },
+		{ "armor", ItemSchema::Value<&Item::armor> },
+		{ "damage", [](lua_State* L, Item& i) {
+			std::string d;
+			if (!SchemaRead(L, d)) return false;
+			i.damage = Die::parse(d);
+			return true;
+		} },
+		{ "ap", ItemSchema::Value<&Item::ap> },
+	}),
+	power(L, "Power", {
+		{ "entityID", PowerSchema::Value<&Power::entityID>, true },
+		{ "name", PowerSchema::Value<&Power::name>, true },
+		{ "effect", PowerSchema::Value<&Power::effect>, true },
+		{ "cost", PowerSchema::Value<&Power::cost> },
+		{ "range", PowerSchema::Value<&Power::range> },
+		{ "strength", PowerSchema::Value<&Power::strength> },
+		{ "region", PowerSchema::Value<&Power::region> },
+	}),
+	interaction(L, "Interaction", {
+		{ "entityID", InteractionSchema::Value<&Interaction::entityID>, true },
+		{ "name", InteractionSchema::Value<&Interaction::name> },
+		{ "next", InteractionSchema::Value<&Interaction::next>, true },
+		{ "npc", InteractionSchema::Value<&Interaction::npc> },
+		{ "required", InteractionSchema::Value<&Interaction::required> },
+		{ "eval", InteractionSchema::Func<&Interaction::eval> },
+		{ "code", InteractionSchema::Func<&Interaction::code> },
+	}),
+	container(L, "Container", {
+		{ "entityID", ContainerSchema::Value<&Container::entityID>, true },
+		{ "name", ContainerSchema::Value<&Container::name>, true },
+		{ "locked", ContainerSchema::Value<&Container::locked> },
+		{ "key", ContainerSchema::Value<&Container::key> },
+		{ "eval", ContainerSchema::Func<&Container::eval> },
+		{ "items", [](lua_State* L, Container& c) { return ReadItems(L, c.inventory); } },
+	}),
+	edge(L, "Edge", {
+		{ "entityID", EdgeSchema::Value<&Edge::entityID>, true },
+		{ "dir", ReadDir },
+		{ "name", EdgeSchema::Value<&Edge::name> },
+		{ "room1", EdgeSchema::Value<&Edge::room1>, true },
+		{ "room2", EdgeSchema::Value<&Edge::room2>, true },
+		{ "locked", EdgeSchema::Value<&Edge::locked> },
+		{ "key", EdgeSchema::Value<&Edge::key> },
+	}),
+	room(L, "Room", {
+		{ "entityID", RoomSchema::Value<&Room::entityID>, true },
+		{ "name", RoomSchema::Value<&Room::name>, true },
+		{ "desc", RoomSchema::Value<&Room::desc> },
+	}, [](lua_State* L, Room& r) { return ReadObject(L, r.objects); }),
+	zone(L, "Zone", {
+		{ "entityID", ZoneSchema::Value<&Zone::entityID>, true },
+		{ "name", ZoneSchema::Value<&Zone::name> },
+	}, [](lua_State* L, Zone& z) { return ReadObject(L, z.objects); }),
+	actor(L, "Actor", {
+		{ "entityID", ActorSchema::Value<&Actor::entityID>, true },
+		{ "name", ActorSchema::Value<&Actor::name>, true },
+		{ "wild", ActorSchema::Value<&Actor::wild> },
+		{ "fighting", ActorSchema::Value<&Actor::fighting> },
+		{ "shooting", ActorSchema::Value<&Actor::shooting> },
+		{ "arcane", ActorSchema::Value<&Actor::arcane> },
+		{ "items", [](lua_State* L, Actor& a) { return ReadItems(L, a.inventory); } },
+		{ "powers", [](lua_State* L, Actor& a) { return ReadPowers(L, a.powers); } },
+	}),
+	combatant(L, "Combatant", {
+		{ "entityID", CombatantSchema::Value<&Combatant::entityID>, true },
+		{ "name", CombatantSchema::Value<&Combatant::name>, true },
+		{ "count", CombatantSchema::Value<&Combatant::count> },
+		{ "wild", CombatantSchema::Value<&Combatant::wild> },
+		{ "fighting", CombatantSchema::Value<&Combatant::fighting> },
+		{ "shooting", CombatantSchema::Value<&Combatant::shooting> },
+		{ "arcane", CombatantSchema::Value<&Combatant::arcane> },
+		{ "bias", CombatantSchema::Value<&Combatant::bias> },
+		{ "items", [](lua_State* L, Combatant& c) { return ReadItems(L, c.inventory); } },
+		{ "powers", [](lua_State* L, Combatant& c) { return ReadPowers(L, c.powers); } },
+	}),
+	battle(L, "Battle", {
+		{ "entityID", BattleSchema::Value<&Battle::entityID>, true },
+		{ "name", BattleSchema::Value<&Battle::name> },
+		{ "regions", ReadRegions },
+		{ "combatants", [](lua_State* L, Battle& b) {
+			if (lua_type(L, -1) != LUA_TTABLE) return false;
+			// The listed combatants go before the numbered ones, whichever is read first.
+			std::vector<EntityID> listed;
+			for (const auto& s : LuaBridge::toStrCountArray(L)) {
+				for (int i = 0; i < s.count; ++i) {
+					listed.push_back(s.str);
 				}
 			}
-			else if (it.vType() == LUA_TSTRING) {
-
-				Variant v = it.value();
-				Text::Line line;
-				line.speaker = speaker;
-				line.text = v.str;
-				text.lines.push_back(line);
-			}
-		}
-	}
-	catch (std::exception& e) {
-		FatalReadError(e.what(), text);
-	}
-	return text;
-}
-
-ScriptType ScriptBridge::toScriptType(const std::string& type) const
+			b.combatants.insert(b.combatants.begin(), listed.begin(), listed.end());
+			return true;
+		} },
+	}, [](lua_State* L, Battle& b) {
+		if (lua_type(L, -2) != LUA_TNUMBER) return true;
+		if (lua_type(L, -1) != LUA_TTABLE) return false;
+		EntityID id;
+		if (!SchemaRead(L, id)) return false;
+		b.combatants.push_back(id);
+		return true;
+	}),
+	callScript(L, "CallScript", {
+		{ "entityID", CallScriptSchema::Value<&CallScript::entityID>, true },
+		{ "scriptID", CallScriptSchema::Value<&CallScript::scriptID>, true },
+		{ "npc", CallScriptSchema::Value<&CallScript::npc> },
+		{ "code", CallScriptSchema::Func<&CallScript::code> },
+		{ "eval", CallScriptSchema::Func<&CallScript::eval> },
+	})
 {
-	if (type == "Script") return ScriptType::kScript;
-	if (type == "Text") return ScriptType::kText;
-	if (type == "Choices") return ScriptType::kChoices;
-	if (type == "Battle") return ScriptType::kBattle;
-	if (type == "CallScript") return ScriptType::kCallScript;
-	assert(false);
-	return ScriptType::kScript;
 }
 
-Script ScriptBridge::readScript() const
+// Reads every table in the global 'glob' with the schema's type, and passes it to 'add'.
+template<typename T, typename F>
+static void ReadAssets(lua_State* L, const char* glob, const AssetSchema<T>& schema, T init, F add)
 {
-	Script s;
-	try {
-		s.entityID = readEntityID("entityID", {});
-		s.code = getFuncField("code");
-		s.npc = getStrField("npc", {""});
-
-		for (TableIt it(getLuaState(), -1); !it.done(); it.next()) {
-			if (it.kType() == LUA_TNUMBER) {
-				EntityID id = readEntityID("entityID", {});
-				ScriptType type = toScriptType(getStrField("type", {}));
-				s.events.push_back({ id, type });
-			}
+	LuaBridge::LuaStackCheck check(L);
+	lua_getglobal(L, glob);
+	for (TableIt it(L, -1); !it.done(); it.next()) {
+		if (!schema.isType()) continue;
+		T t = init;
+		int top = lua_gettop(L);
+		try {
+			schema.read(t);
 		}
+		catch (std::exception& e) {
+			lua_settop(L, top);
+			FatalReadError(e.what(), t);
+		}
+		add(t);
 	}
-	catch (std::exception& e) {
-		FatalReadError(e.what(), s);
-	}
-	return s;
+	lua_pop(L, 1);
 }
 
-EntityID ScriptBridge::readEntityID(const std::string& key, const std::optional<EntityID>& def) const
+template<typename T>
+static void ReadAssets(lua_State* L, const char* glob, const AssetSchema<T>& schema, std::vector<T>& out, T init = T())
 {
-	std::string id;
-	int tMinusOne = lua_type(getLuaState(), -1);
-	if (tMinusOne != LUA_TTABLE) {
-		assert(tMinusOne == LUA_TTABLE); // -1 table
-		throw std::runtime_error("Error parsing entity");
-	}
-	
-	Variant v = getField(getLuaState(), key, 0);
-	if (v.type == LUA_TSTRING) {
-		id = v.str;
-	}
-	else if (v.type == LUA_TTABLE) {
-		lua_pushstring(getLuaState(), key.c_str());
-		int t = lua_gettable(getLuaState(), -2);
-		CHECK(t == LUA_TTABLE);
-		id = getStrField("entityID", {});
-		lua_pop(getLuaState(), 1);
-	}
-	else {
-		if (def) 
-			id = def.value();
-		else
-			throw std::runtime_error(fmt::format("No entity found while reading EntityID for key '{}'", key));
-	}
-	return id;
+	ReadAssets(L, glob, schema, init, [&out](T& t) { out.push_back(std::move(t)); });
 }
 
-Choices ScriptBridge::readChoices() const
+void ScriptBridge::runGameFile(const std::string& inputFilePath, ConstScriptAssets* csa)
 {
-	Choices c;
-	try {
-		c.entityID = getStrField("entityID", {});
-
-		std::string a = getStrField("action", { "done" });
-		if (a == "done") c.action = Choices::Action::kDone;
-		else if (a == "rewind") c.action = Choices::Action::kRewind;
-		else if (a == "repeat") c.action = Choices::Action::kRepeat;
-		else if (a == "pop") c.action = Choices::Action::kPop;
-
-		for (TableIt it(getLuaState(), -1); !it.done(); it.next()) {
-			if (it.kType() == LUA_TNUMBER) {
-				Choices::Choice choice;
-				choice.text = getStrField("text", {});
-				choice.next = readEntityID("next", { "done" });
-				choice.eval = getFuncField("eval");
-				choice.code = getFuncField("code");
-				c.choices.push_back(choice);
-			}
-		}
-	}
-	catch (std::exception& e) {
-		FatalReadError(e.what(), c);
-	}
-	return c;
-}
+	// The game is loaded by the host, and shared with its sessions.
+	assert(!isSession());
+	clearSourceFiles();
+	// required
+	doFile("script/_map.lua");
 
-Interaction ScriptBridge::readInteraction() const
-{
-	Interaction i;
-	try {
-		i.entityID = getStrField("entityID", {});
-		i.name = getStrField("name", { "" });
-		i.next = readEntityID("next", {});
-		i.npc = readEntityID("npc", { "" });
-		i.required = getBoolField("required", { false });
-		i.eval = getFuncField("eval");
-		i.code = getFuncField("code");
-	}
-	catch(std::exception& e) {
-		FatalReadError(e.what(), i);
-	}
-	return i;
+	std::filesystem::path path = inputFilePath;
+
+	// game/start.lua
+	// parent_path:    `./game`
+	// need to append: 'game'
+	appendLuaPath(path.parent_path().string());
+	_currentCSA = csa;
+	doFile(inputFilePath);
+	_currentCSA = nullptr;
 }
 
-Actor ScriptBridge::readActor() const
+void ScriptBridge::readAssets(ConstScriptAssets& csa)
 {
-	Actor actor;
-	try {
-		actor.entityID = getStrField("entityID", {});
-		actor.name = getStrField("name", {});
-		actor.wild = getBoolField("wild", { false });
-		actor.fighting = getIntField("fighting", { 0 });
-		actor.shooting = getIntField("shooting", { 0 });
-		actor.arcane = getIntField("arcane", { 0 });
+	lua_State* L = getLuaState();
+	AssetSchemas schemas(L);
+
+	ReadAssets(L, "Scripts", schemas.script, csa.scripts);
+	ReadAssets(L, "Texts", schemas.text, TextReader(), [&csa](TextReader& t) { csa.texts.push_back(t.finish()); });
+	ReadAssets(L, "AllChoices", schemas.choices, csa.choices);
+	ReadAssets(L, "Items", schemas.item, csa.items);
+	ReadAssets(L, "Powers", schemas.power, csa.powers);
+	ReadAssets(L, "Interactions", schemas.interaction, csa.interactions);
+
+	ReadAssets(L, "Containers", schemas.container, csa.containers);
+	ReadAssets(L, "Edges", schemas.edge, csa.edges);
+	ReadAssets(L, "Rooms", schemas.room, csa.rooms);
+	ReadAssets(L, "Zones", schemas.zone, csa.zones);
+
+	Battle battle;
+	battle.name = "battle";
+	ReadAssets(L, "Actors", schemas.actor, csa.actors);
+	ReadAssets(L, "Combatants", schemas.combatant, csa.combatants);
+	ReadAssets(L, "Battles", schemas.battle, csa.battles, battle);
+	ReadAssets(L, "CallScripts", schemas.callScript, csa.callScripts);
 
-		if (hasField("items")) {
-			actor.inventory = readInventory();
-		}
-		if (hasField("powers")) {
-			lua_pushstring(getLuaState(), "powers");
-			lua_gettable(getLuaState(), -2);
+	// Now all the inventories need to be converted.
+	for (auto& i : csa.actors) i.inventory.convert(csa);
+	for (auto& i : csa.combatants) i.inventory.convert(csa);
+	for (auto& i : csa.containers) i.inventory.convert(csa);
 
-			for (TableIt it(getLuaState(), -1); !it.done(); it.next()) {
-				EntityID id = it.value().str;
-				actor.powers.push_back(id);
-			}
-			lua_pop(getLuaState(), 1);
-		}
-	}
-	catch (std::exception& e) {
-		FatalReadError(e.what(), actor);
-	}
-	return actor;
+	indexFuncs(csa);
 }
 
-Combatant ScriptBridge::readCombatant() const
+bool ScriptBridge::findFuncPath(int ref, const char* table, const EntityID& entityID, FuncPath& fp) const
 {
-	Combatant c;
-	try {
-		c.entityID = getStrField("entityID", {});
-		c.name = getStrField("name", {});
-		c.count = getIntField("count", { 1 });
-		c.wild = getBoolField("wild", { false });
-		c.fighting = getIntField("fighting", { 0 });
-		c.shooting = getIntField("shooting", { 0 });
-		c.arcane = getIntField("arcane", { 0 });
-		c.bias = getIntField("bias", { 0 });
-
-		c.inventory = readInventory();
-
-		if (hasField("powers")) {
-			lua_pushstring(getLuaState(), "powers");
-			lua_gettable(getLuaState(), -2);
-
-			for (TableIt it(getLuaState(), -1); !it.done(); it.next()) {
-				EntityID id = it.value().str;
-				c.powers.push_back(id);
+	static const char* const kKeys[] = { "eval", "code" };
+	lua_State* L = getLuaState();
+	LuaStackCheck check(L);
+
+	int top = lua_gettop(L);
+	lua_rawgeti(L, LUA_REGISTRYINDEX, ref);		// -1 func
+	int funcIndex = lua_gettop(L);
+
+	bool found = false;
+	if (lua_getglobal(L, table) == LUA_TTABLE && lua_getfield(L, -1, entityID.c_str()) == LUA_TTABLE) {
+		// The function is either on the entity itself, or on one of its
+		// numbered children (a Text line, a Choice).
+		for (int index = 0; !found; index++) {
+			if (index > 0) {
+				int t = lua_geti(L, -1, index);	// -1 child
+				if (t == LUA_TNIL) {
+					lua_pop(L, 1);
+					break;
+				}
+				if (t != LUA_TTABLE) {
+					lua_pop(L, 1);
+					continue;
+				}
+			}
+			for (const char* key : kKeys) {
+				lua_getfield(L, -1, key);
+				if (lua_rawequal(L, -1, funcIndex)) {
+					fp.table = table;
+					fp.entityID = entityID;
+					fp.index = index;
+					fp.key = key;
+					found = true;
+				}
+				lua_pop(L, 1);
+				if (found) break;
 			}
-			lua_pop(getLuaState(), 1);
+			if (index > 0) lua_pop(L, 1);
 		}
 	}
-	catch (std::exception& e) {
-		FatalReadError(e.what(), c);
-	}
-	return c;
+	lua_settop(L, top);
+	return found;
 }
 
-Battle ScriptBridge::readBattle() const
+void ScriptBridge::indexFuncs(ConstScriptAssets& csa)
 {
-	Battle b;
-
-	try {
-		b.entityID = readEntityID("entityID", {});
-		b.name = getStrField("name", {"battle"});
-
-		if (hasField("regions")) {
-			lua_pushstring(getLuaState(), "regions");
-			lua_gettable(getLuaState(), -2);
-
-			for (TableIt it(getLuaState(), -1); !it.done(); it.next()) {
-				if (it.kType() == LUA_TNUMBER) {
-					lurp::swbattle::Region r;
-					r.name = getField(getLuaState(), "", 1).str;
-					r.yards = (int)getField(getLuaState(), "", 2).num;
-					std::string c = getField(getLuaState(), "", 3).str;
-					if (c == "light") r.cover = lurp::swbattle::Cover::kLightCover;
-					else if (c == "medium") r.cover = lurp::swbattle::Cover::kMediumCover;
-					else if (c == "heavy") r.cover = lurp::swbattle::Cover::kHeavyCover;
-
-					b.regions.push_back(r);
-				}
-			}
-			lua_pop(getLuaState(), 1);
+	// The readers store Lua registry refs, which are only meaningful to this
+	// Lua state. Convert them to indices into csa.funcs.
+	std::map<std::string, int> pathToIndex;
+	csa.funcs.clear();
+	_funcRefs.clear();
+
+	csa.forEachFunc([&](const char* table, const EntityID& entityID, int& func) {
+		if (func < 0) return;
+
+		FuncPath fp;
+		if (!findFuncPath(func, table, entityID, fp)) {
+			FatalError(fmt::format("Could not locate function for '{}' in table '{}'", entityID, table));
 		}
-
-		if (hasField("combatants")) {
-			std::vector<StringCount> sc = getStrCountArray("combatants");
-			for (const auto& s : sc) {
-				for (int i = 0; i < s.count; ++i) {
-					b.combatants.push_back(s.str);
-				}
-			}
+		std::string key = fmt::format("{}/{}/{}/{}", fp.table, fp.entityID, fp.index, fp.key);
+		auto it = pathToIndex.find(key);
+		if (it == pathToIndex.end()) {
+			int index = (int)csa.funcs.size();
+			csa.funcs.push_back(fp);
+			_funcRefs.push_back(func);
+			pathToIndex[key] = index;
+			func = index;
 		}
-
-		for (TableIt it(getLuaState(), -1); !it.done(); it.next()) {
-			if (it.kType() == LUA_TNUMBER) {
-				EntityID id = readEntityID("entityID", {});
-				b.combatants.push_back(id);
-			}
+		else {
+			// Lines in a Text share a function.
+			luaL_unref(getLuaState(), LUA_REGISTRYINDEX, func);
+			func = it->second;
 		}
-	}
-	catch (std::exception& e) {
-		FatalReadError(e.what(), b);
-	}
-	return b;
+	});
 }
 
-CallScript ScriptBridge::readCallScript() const
+void ScriptBridge::bindFuncs(const ConstScriptAssets& csa)
 {
-	CallScript cs;
-	try {
-		cs.entityID = readEntityID("entityID", {});
-		cs.scriptID = readEntityID("scriptID", {});
-		cs.npc = readEntityID("npc", { "" });
-		cs.code = getFuncField("code");
-		cs.eval = getFuncField("eval");
-	}
-	catch (std::exception& e) {
-		FatalReadError(e.what(), cs);
-	}
-	return cs;
-}
+	lua_State* L = getLuaState();
+	LuaStackCheck check(L);
+
+	_funcRefs.clear();
+	_funcRefs.resize(csa.funcs.size(), -1);
+
+	for (size_t i = 0; i < csa.funcs.size(); i++) {
+		const FuncPath& fp = csa.funcs[i];
+		int top = lua_gettop(L);
+		if (lua_getglobal(L, fp.table.c_str()) == LUA_TTABLE
+			&& lua_getfield(L, -1, fp.entityID.c_str()) == LUA_TTABLE
+			&& (fp.index == 0 || lua_geti(L, -1, fp.index) == LUA_TTABLE)
+			&& lua_getfield(L, -1, fp.key.c_str()) == LUA_TFUNCTION)
+		{
+			_funcRefs[i] = luaL_ref(L, LUA_REGISTRYINDEX);
+		}
+		lua_settop(L, top);
 
-// READ_ASSET(AllChoices, Choices, choices, readChoices);
-#define READ_ASSET(glob, type, member, func) \
-{  \
-    lua_State* state = getLuaState(); \
-	lua_getglobal(state, glob); \
-	for (TableIt it(state, -1); !it.done(); it.next()) { \
-		if (it.isTableWithKV("type", type)) { \
-			csa.member.push_back(func()); \
-		} \
-	} \
-	lua_pop(state, 1); \
+		if (_funcRefs[i] < 0) {
+			FatalError(fmt::format("Function '{}[{}][{}].{}' not found. The assets do not match the game file.",
+				fp.table, fp.entityID, fp.index, fp.key));
+		}
+	}
 }
 
-ConstScriptAssets ScriptBridge::readCSA(const std::string& inputFilePath)
+ConstScriptAssets ScriptBridge::readCSA(const std::string& inputFilePath, std::filesystem::path bundlePath)
 {
 	assert(!inputFilePath.empty());
-	ConstScriptAssets csa;
-	// required
-	doFile("script/_map.lua");
+	if (bundlePath.empty())
+		bundlePath = Bundle::path(inputFilePath);
 
-	std::filesystem::path path = inputFilePath;
+	ConstScriptAssets csa;
+	bool useBundle = false;
+	{
+		MappedFile file(bundlePath);
+		if (file.valid()) {
+			useBundle = Bundle::read(file.data(), file.size(), csa);
+		}
+	}
 
-	// game/start.lua
-	// parent_path:    `./game`
-	// need to append: 'game'
-	appendLuaPath(path.parent_path().string());
-	_currentCSA = &csa;
-	doFile(inputFilePath);
-	_currentCSA = nullptr;
+	if (useBundle) {
+		// The game file still needs to run to create the functions; but the markdown
+		// files and the asset tables don't need to be read.
+		runGameFile(inputFilePath, nullptr);
+		bindFuncs(csa);
+		PLOG(plog::info) << fmt::format("Assets loaded from bundle '{}'", bundlePath.string());
+	}
+	else {
+		runGameFile(inputFilePath, &csa);
+		readAssets(csa);
+	}
+	csa.index();
 
-	READ_ASSET("Scripts", "Script", scripts, readScript);
-	READ_ASSET("Texts", "Text", texts, readText);
-	READ_ASSET("AllChoices", "Choices", choices, readChoices);
-	READ_ASSET("Items", "Item", items, readItem);
-	READ_ASSET("Powers", "Power", powers, readPower);
-	READ_ASSET("Interactions", "Interaction", interactions, readInteraction);
+	int kbytes = lua_gc(getLuaState(), LUA_GCCOUNT);
+	PLOG(plog::info) << fmt::format("LUA memory usage: {} KB", kbytes);
 
-	READ_ASSET("Containers", "Container", containers, readContainer);
-	READ_ASSET("Edges", "Edge", edges, readEdge);
-	READ_ASSET("Rooms", "Room", rooms, readRoom);
-	READ_ASSET("Zones", "Zone", zones, readZone);
+	return csa;
+}
 
-	READ_ASSET("Actors", "Actor", actors, readActor);
-	READ_ASSET("Combatants", "Combatant", combatants, readCombatant);
-	READ_ASSET("Battles", "Battle", battles, readBattle);
-	READ_ASSET("CallScripts", "CallScript", callScripts, readCallScript);
+void ScriptBridge::bindCSA(const std::string& inputFilePath, const ConstScriptAssets& csa)
+{
+	assert(!inputFilePath.empty());
+	runGameFile(inputFilePath, nullptr);
+	bindFuncs(csa);
+}
 
-	// Now all the inventories need to be converted.
-	for (auto& i : csa.actors) i.inventory.convert(csa);
-	for (auto& i : csa.combatants) i.inventory.convert(csa);
-	for (auto& i : csa.containers) i.inventory.convert(csa);
+bool ScriptBridge::compileCSA(const std::string& inputFilePath, std::filesystem::path bundlePath)
+{
+	assert(!inputFilePath.empty());
+	if (bundlePath.empty())
+		bundlePath = Bundle::path(inputFilePath);
 
-	int kbytes = lua_gc(getLuaState(), LUA_GCCOUNT);
-	PLOG(plog::info) << fmt::format("LUA memory usage: {} KB", kbytes);
+	ConstScriptAssets csa;
+	runGameFile(inputFilePath, &csa);
+	readAssets(csa);
 
-	return csa;
+	return Bundle::write(bundlePath, csa, sourceFiles());
 }
 
 std::vector<Text> ScriptBridge::LoadMD(const std::string& filename)
@@ -734,19 +912,20 @@ std::vector<Text> ScriptBridge::LoadMD(const std::string& filename)
 
 /*static*/ int ScriptBridge::l_CRandom(lua_State* L)
 {
-	ScriptBridge* bridge = (ScriptBridge*)lua_touserdata(L, lua_upvalueindex(1));
+	ScriptBridge* bridge = Bridge(L);
 	uint32_t r = 0;
 	assert(bridge->_iMapHandler);
 	if (bridge->_iMapHandler) {
 		r = bridge->_iMapHandler->getRandom();
 	}
+	bridge->_evalCache.uncacheable();
 	lua_pushinteger(L, r);
 	return 1;
 }
 
 /*static*/ int ScriptBridge::l_CDeltaItem(lua_State* L)
 {
-	ScriptBridge* bridge = (ScriptBridge*)lua_touserdata(L, lua_upvalueindex(1));
+	ScriptBridge* bridge = Bridge(L);
 	assert(bridge->_iMapHandler);
 
 	std::string containerID = lua_tostring(L, 1);
@@ -756,43 +935,61 @@ std::vector<Text> ScriptBridge::LoadMD(const std::string& filename)
 	if (bridge->_iMapHandler) {
 		bridge->_iMapHandler->deltaItem(containerID, itemID, n);
 	}
+	bridge->_evalCache.uncacheable();
 	return 0;
 }
 
 /*static*/ int ScriptBridge::l_CNumItems(lua_State* L)
 {
-	ScriptBridge* bridge = (ScriptBridge*)lua_touserdata(L, lua_upvalueindex(1));
+	ScriptBridge* bridge = Bridge(L);
 	assert(bridge->_iMapHandler);
-	std::string containerID = lua_tostring(L, 1);
-	std::string itemID = lua_tostring(L, 2);
+	EntityID containerID = lua_tostring(L, 1);
+	EntityID itemID = lua_tostring(L, 2);
 	int n = 0;
 	if (bridge->_iMapHandler) {
 		n = bridge->_iMapHandler->numItems(containerID, itemID);
 	}
+	bridge->_evalCache.readItems(containerID, itemID, n);
 	lua_pushinteger(L, n);
 	return 1;
 }
 
-/*static*/ int ScriptBridge::l_CCoreGet(lua_State* L)
+bool ScriptBridge::coreGet(const EntityID& entity, std::string_view path, Variant& v)
 {
-	ScriptBridge* bridge = (ScriptBridge*)lua_touserdata(L, lua_upvalueindex(1));
-	assert(bridge->_iCoreHandler);
-	std::string entityID = lua_tostring(L, 1);
-	std::string scope = lua_tostring(L, 2);
-
+	assert(_iCoreHandler);
 	bool handled = false;
-	Variant v;
 
-	if (!handled && bridge->_iCoreHandler) {
-		std::pair<bool, Variant> p = bridge->_iCoreHandler->coreGet(entityID, scope);
+	if (!handled && _iCoreHandler) {
+		std::pair<bool, Variant> p = _iCoreHandler->coreGet(entity, path);
 		handled = p.first;
 		v = p.second;
+		// Assets don't change, so only the CoreData is a dependency.
+		_evalCache.readCore(entity, path, p.first, p.second);
 	}
-	if (!handled && bridge->_iAssetHandler) {
-		std::pair<bool, Variant> p = bridge->_iAssetHandler->assetGet(entityID, scope);
+	if (!handled && _iAssetHandler) {
+		std::pair<bool, Variant> p = _iAssetHandler->assetGet(entity, path);
 		handled = p.first;
 		v = p.second;
 	}
+	return handled;
+}
+
+void ScriptBridge::coreSet(const EntityID& entity, std::string_view path, const Variant& v, bool mutableUser)
+{
+	assert(_iCoreHandler);
+	if (_iCoreHandler) {
+		_iCoreHandler->coreSet(entity, path, v, mutableUser);
+	}
+	_evalCache.uncacheable();
+}
+
+/*static*/ int ScriptBridge::l_CCoreGet(lua_State* L)
+{
+	EntityID entityID = lua_tostring(L, 1);
+	std::string_view scope = lua_tostring(L, 2);
+
+	Variant v;
+	bool handled = Bridge(L)->coreGet(entityID, scope, v);
 
 	lua_pushboolean(L, handled);
 	v.pushLua(L);
@@ -801,64 +998,123 @@ std::vector<Text> ScriptBridge::LoadMD(const std::string& filename)
 
 /*static*/ int ScriptBridge::l_CCoreSet(lua_State* L)
 {
-	ScriptBridge* bridge = (ScriptBridge*)lua_touserdata(L, lua_upvalueindex(1));
-	assert(bridge->_iCoreHandler);
-	std::string entityID = lua_tostring(L, 1);
-	std::string scope = lua_tostring(L, 2);
+	EntityID entityID = lua_tostring(L, 1);
+	std::string_view scope = lua_tostring(L, 2);
 	Variant v = Variant::fromLua(L, 3);
 	bool mutableUser = lua_toboolean(L, 4);
 
-	bool handled = false;
+	Bridge(L)->coreSet(entityID, scope, v, mutableUser);
+	return 0;
+}
+
+/*static*/ int ScriptBridge::l_CCoreTable(lua_State* L)
+{
+	// 1 core table, 2 source table. Sets the metatable of the core table,
+	// whose __index and __newindex go straight to coreGet() and coreSet()
+	// with the entity and source table as upvalues, and returns it.
+	luaL_checktype(L, 1, LUA_TTABLE);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	lua_getfield(L, 1, "entityID");
+	EntityID entityID = luaL_checkstring(L, -1);
+	lua_pop(L, 1);
+
+	lua_createtable(L, 0, 2);							// -1 metatable
+	lua_pushinteger(L, entityID.handle());
+	lua_pushvalue(L, 2);
+	lua_pushcclosure(L, l_CoreIndex, 2);
+	lua_setfield(L, -2, "__index");
+	lua_pushinteger(L, entityID.handle());
+	lua_pushcclosure(L, l_CoreNewIndex, 1);
+	lua_setfield(L, -2, "__newindex");
+	lua_setmetatable(L, 1);
+
+	lua_settop(L, 1);
+	return 1;
+}
 
-	if (!handled && bridge->_iCoreHandler) {
-		bridge->_iCoreHandler->coreSet(entityID, scope, v, mutableUser);
+/*static*/ int ScriptBridge::l_CoreIndex(lua_State* L)
+{
+	// 1 core table, 2 key
+	// The core can have a value set to nil, which overrides the source, so
+	// coreGet() returns whether it has the value separately from the value.
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		EntityID entityID = EntityID::fromHandle((uint32_t)lua_tointeger(L, lua_upvalueindex(1)));
+		size_t len = 0;
+		const char* key = lua_tolstring(L, 2, &len);
+
+		Variant v;
+		if (Bridge(L)->coreGet(entityID, std::string_view(key, len), v)) {
+			v.pushLua(L);
+			return 1;
+		}
 	}
+	// Not in the core: the immutable source value.
+	lua_pushvalue(L, 2);
+	lua_gettable(L, lua_upvalueindex(2));
+	return 1;
+}
+
+/*static*/ int ScriptBridge::l_CoreNewIndex(lua_State* L)
+{
+	// 1 core table, 2 key, 3 value
+	EntityID entityID = EntityID::fromHandle((uint32_t)lua_tointeger(L, lua_upvalueindex(1)));
+	size_t len = 0;
+	const char* key = luaL_checklstring(L, 2, &len);
+
+	Bridge(L)->coreSet(entityID, std::string_view(key, len), Variant::fromLua(L, 3), false);
 	return 0;
 }
 
 /*static*/ int ScriptBridge::l_CAllTextRead(lua_State* L)
 {
-	ScriptBridge* bridge = (ScriptBridge*)lua_touserdata(L, lua_upvalueindex(1));
+	ScriptBridge* bridge = Bridge(L);
 	bool result = true;
 	std::string entityID = lua_tostring(L, 1);
 
 	if (bridge->_iTextHandler) {
 		result = bridge->_iTextHandler->allTextRead(entityID);
 	}
+	bridge->_evalCache.uncacheable();
 	lua_pushboolean(L, result);
 	return 1;
 }
 
 /*static*/ int ScriptBridge::l_CMove(lua_State* L)
 {
-	ScriptBridge* bridge = (ScriptBridge*)lua_touserdata(L, lua_upvalueindex(1));
+	ScriptBridge* bridge = Bridge(L);
 
 	std::string dstID = lua_tostring(L, 1);
 	bool tele = lua_toboolean(L, 2);
 	if (bridge->_iMapHandler)
 		bridge->_iMapHandler->movePlayer(dstID, tele);
+	bridge->_evalCache.uncacheable();
 	return 0;
 }
 
 /*static*/ int ScriptBridge::l_CEndGame(lua_State* L)
 {
-	ScriptBridge* bridge = (ScriptBridge*)lua_touserdata(L, lua_upvalueindex(1));
+	ScriptBridge* bridge = Bridge(L);
 
 	std::string reason = lua_tostring(L, 1);
 	int bias = (int) lua_tointeger(L, 2);
 	if (bridge->_iMapHandler)
 		bridge->_iMapHandler->endGame(reason, bias);
+	bridge->_evalCache.uncacheable();
 	return 0;
 }
 
 /*static*/ int ScriptBridge::l_CLoadMD(lua_State* L)
 {
-	ScriptBridge* bridge = (ScriptBridge*)lua_touserdata(L, lua_upvalueindex(1));
+	ScriptBridge* bridge = Bridge(L);
 
 	std::string fname = lua_tostring(L, 1);
 
+	// When loading from a bundle, the texts are already read.
+	if (!bridge->_currentCSA)
+		return 0;
+
+	bridge->addSourceFile((bridge->currentDir() / fname).generic_string());
 	std::vector<Text> tVec = bridge->LoadMD(fname);
-	assert(bridge->_currentCSA);
 	bridge->_currentCSA->texts.insert(bridge->_currentCSA->texts.end(), tVec.begin(), tVec.end());
 	return 0;
 }
@@ -7,10 +7,12 @@
 #include "scripttypes.h"
 #include "util.h"
 #include "geom.h"
+#include "evalcache.h"
 
 #include <vector>
 #include <string>
 #include <optional>
+#include <unordered_map>
 #include <filesystem>
 
 extern "C" struct lua_State;
@@ -19,18 +21,35 @@ namespace lurp {
 
 struct ScriptAssets;
 struct ConstScriptAssets;
+struct FuncPath;
 struct Battler;
 class Random;
 
+// A session (see the second constructor) shares the host's lua_State, and so
+// the game's functions and asset tables, which are read-only once the game is
+// loaded. It runs on its own Lua thread, and has its own script, player, npc,
+// zone, and room globals, core tables, caches, and handlers.
 class ScriptBridge : public LuaBridge
 {
 public:
 	ScriptBridge();
+	// A session on 'host'. The host must already have read or been bound to the
+	// game, and must outlive the session. A lua_State isn't thread safe, so the
+	// host and its sessions must only be used from one thread at a time.
+	//
+	// Only the per session globals, and globals a session adds, are its own.
+	// Writing a global the game already has, or into the game's tables
+	// (rather than the entities' core tables), changes it for the host and
+	// every session. Keep per player state in the core tables. Since code()
+	// can write shared state, running it clears the caches of the host and all
+	// its sessions (see clearSharedCaches()).
+	explicit ScriptBridge(ScriptBridge& host);
 	~ScriptBridge();
 
 	void setIMap(IMapHandler* handler) {
 		assert((handler && !_iMapHandler) || (!handler && _iMapHandler));
 		_iMapHandler = handler;
+		clearCaches();
 	}
 
 	void setICore(ICoreHandler* handler) {
@@ -38,6 +57,7 @@ public:
 			if (_iCoreCount == 0) {
 				assert(!_iCoreHandler);
 				_iCoreHandler = handler;
+				clearCaches();
 			}
 			else {
 				assert(handler == _iCoreHandler);
@@ -48,6 +68,7 @@ public:
 			_iCoreCount--;
 			if (_iCoreCount == 0) {
 				_iCoreHandler = nullptr;
+				clearCaches();
 			}
 		}
 	}
@@ -60,9 +81,38 @@ public:
 	void setIAsset(IAssetHandler* handler) {
 		assert((handler && !_iAssetHandler) || (!handler && _iAssetHandler));
 		_iAssetHandler = handler;
+		clearCaches();
 	}
 
-	ConstScriptAssets readCSA(const std::string& path);
+	// The caches are cleared whenever the handlers change.
+	EvalCache& evalCache() { return _evalCache; }
+	// VarBinder's Lua lookups, by (entity, var) handles. Like the EvalCache, assumes
+	// Lua state only changes in code() functions.
+	using VarCache = std::unordered_map<uint64_t, Variant>;
+	VarCache& varCache() { return _varCache; }
+	void clearCaches() {
+		_evalCache.clear();
+		_varCache.clear();
+	}
+	// Clears the caches of the host and all its sessions, which share the Lua state.
+	void clearSharedCaches();
+	const ICoreHandler* iCore() const { return _iCoreHandler; }
+	const IMapHandler* iMap() const { return _iMapHandler; }
+
+	// Reads the assets for the game at 'path'. If a bundle (see Bundle) exists at 'bundlePath',
+	// and is up to date, it is used. An empty bundlePath uses the default location.
+	ConstScriptAssets readCSA(const std::string& path, std::filesystem::path bundlePath = {});
+	// Reads the assets from Lua and writes them to a bundle. Returns true on success.
+	bool compileCSA(const std::string& path, std::filesystem::path bundlePath = {});
+	// Sets up this bridge to run a game with assets that were read by a different
+	// bridge. The ConstScriptAssets can then be shared between the two.
+	void bindCSA(const std::string& path, const ConstScriptAssets& csa);
+
+	// Converts a function index (Text::eval, Choice::code, etc.) to a Lua registry ref.
+	int funcRef(int func) const {
+		assert(func >= 0 && func < (int)_funcRefs.size());
+		return _funcRefs[func];
+	}
 	std::vector<Text> LoadMD(const std::string& filename);
 
 
@@ -80,41 +130,45 @@ private:
 	ITextHandler* _iTextHandler = nullptr;
 	IAssetHandler* _iAssetHandler = nullptr;
 	int _iCoreCount = 0;
+	EvalCache _evalCache;
+	VarCache _varCache;
 
 	ConstScriptAssets* _currentCSA = nullptr;	// for md callback. hacky.
+	std::vector<int> _funcRefs;	// function index -> registry ref
+	int _envRef = LUA_NOREF;	// per session globals, once sessions are enabled
+	std::vector<ScriptBridge*> _sessions;	// on the host
+
+	// The bridge that is running on 'L': the host, or one of its sessions. (A
+	// coroutine created from Lua starts with the host's.)
+	static ScriptBridge* Bridge(lua_State* L) {
+		return *(ScriptBridge**)lua_getextraspace(L);
+	}
+	void enableSessions();
 
 	void registerCallbacks();
-
-	Zone readZone() const;
-	Room readRoom() const;
-	Edge readEdge() const;
-	Container readContainer() const;
-
-	Item readItem() const;
-	Power readPower() const;
-	Text readText() const;
-	Choices readChoices() const;
-	Script readScript() const;
-	Interaction readInteraction() const;
-	Actor readActor() const;
-	Combatant readCombatant() const;
-	Battle readBattle() const;
-	CallScript readCallScript() const;
-
-	EntityID readEntityID(const std::string& key, const std::optional<EntityID>& def) const;
-	ScriptType toScriptType(const std::string& type) const;
-
-	std::vector<EntityID> readObjects() const;
+	void runGameFile(const std::string& path, ConstScriptAssets* csa);
+	void readAssets(ConstScriptAssets& csa);
+	bool findFuncPath(int ref, const char* table, const EntityID& entityID, FuncPath& fp) const;
+	void indexFuncs(ConstScriptAssets& csa);
+	void bindFuncs(const ConstScriptAssets& csa);
+	// The value of entity.path in the CoreData, and failing that, the assets.
+	bool coreGet(const EntityID& entity, std::string_view path, Variant& v);
+	void coreSet(const EntityID& entity, std::string_view path, const Variant& v, bool mutableUser);
 
 	static int l_CRandom(lua_State* L);
 	static int l_CDeltaItem(lua_State* L);
 	static int l_CNumItems(lua_State* L);
 	static int l_CCoreGet(lua_State* L);
 	static int l_CCoreSet(lua_State* L);
+	static int l_CCoreTable(lua_State* L);
+	static int l_CoreIndex(lua_State* L);
+	static int l_CoreNewIndex(lua_State* L);
 	static int l_CAllTextRead(lua_State* L);
 	static int l_CMove(lua_State* L);
 	static int l_CEndGame(lua_State* L);
 	static int l_CLoadMD(lua_State* L);
+	static int l_SessionIndex(lua_State* L);
+	static int l_SessionNewIndex(lua_State* L);
 };
 
 
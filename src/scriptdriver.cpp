@@ -1,4 +1,5 @@
 #include "scriptdriver.h"
+#include "binio.h"
 #include "debug.h"
 #include "util.h"
 #include "scriptasset.h"
@@ -12,6 +13,12 @@
 
 namespace lurp {
 
+static const Tree& EmptyTree()
+{
+	static const Tree empty;
+	return empty;
+}
+
 bool ScriptDriver::parseAction(const std::string& s, Choices::Action& action) const
 {
 	action = Choices::Action::kDone;
@@ -29,8 +36,8 @@ ScriptDriver::ScriptDriver(const ScriptAssets& assets, MapData& mapData, ScriptB
 	: _assets(assets),
 	_bridge(bridge),
 	_mapData(mapData),
-	_tree(assets, env.script),
-	_treeIt(_tree)
+	_tree(&assets._csa.tree(env.script)),
+	_treeIt(*_tree)
 {
 	_scriptEnv = env;
 	_bridge.setICore(&mapData.coreData);
@@ -39,7 +46,7 @@ ScriptDriver::ScriptDriver(const ScriptAssets& assets, MapData& mapData, ScriptB
 	_helper = std::make_unique<ScriptHelper>(bridge, _mapData.coreData, _scriptEnv);
 	_helper->call(func, 0);
 
-	_tree.log();
+	_tree->log();
 	processTree(false);
 }
 
@@ -51,14 +58,16 @@ ScriptDriver::~ScriptDriver()
 
 void ScriptDriver::abort()
 {
-	_treeIt.setIndex(_tree.size());
+	_treeIt.setIndex(_tree->size());
 	_choicesStack.clear();
 }
 
 void ScriptDriver::clear()
 {
 	_scriptEnv = ScriptEnv();
-	_tree.clear();
+	_tree = &EmptyTree();
+	_treeIt = TreeIt(*_tree);
+	_unread = UnreadLines();
 	_treeIt.setIndex(0);
 	_textSubIndex = 0;
 	_choicesStack.clear();
@@ -78,7 +87,7 @@ Text ScriptDriver::filterText(const Text& text) const
 
 	bool outerEval = true;
 	outerEval = _helper->call(text.eval, 1);
-	outerEval = outerEval && textTest(text.test);
+	outerEval = outerEval && textTest(text.compiledTest);
 	if (!outerEval) {
 		return result;
 	}
@@ -87,14 +96,16 @@ Text ScriptDriver::filterText(const Text& text) const
 	for (const Text::Line& line : text.lines) {
 		bool eval = true;
 		eval = _helper->call(line.eval, 1);
-		eval = eval && textTest(line.test);
+		eval = eval && textTest(line.compiledTest);
 
 		if (!eval) continue;
 
 		Text::Line tl;
-		tl.speaker = substitute(line.speaker);
-		tl.text = substitute(line.text);
+		tl.speaker = substitute(line.speakerTemplate, line.speaker);
+		tl.text = substitute(line.textTemplate, line.text);
 		tl.code = line.code;
+		tl.id = line.id;
+		tl.substitution = line.substitution;
 		result.lines.push_back(tl);
 	}
 	return result;
@@ -113,7 +124,7 @@ Choices ScriptDriver::filterChoices(const Choices& choices) const
 		}
 		if (pass) {
 			result.choices.push_back(c);
-			result.choices.back().text = substitute(c.text);
+			result.choices.back().text = substitute(c.textTemplate, c.text);
 			result.choices.back().unmapped = (int)i;
 		}
 	}
@@ -126,59 +137,37 @@ ScriptType ScriptDriver::type() const
 	return _treeIt.get().type;
 }
 
-std::string ScriptDriver::substitute(const std::string& in) const
+std::string ScriptDriver::substitute(const TextTemplate& t, const std::string& in) const
 {
-	if (!_helper) return in;
-	std::vector<size_t> open;
-	std::vector<size_t> close;
+	if (!_helper || !t.hasVars()) return in;
 
-	for (size_t i = 0; i < in.size(); ++i) {
-		if (in[i] == '{') 
-			open.push_back(i);
-		else if (in[i] == '}') 
-			close.push_back(i);
-	}
-	assert(open.size() == close.size());
-	if (open.empty())
-		return in;
+	// Subtle. This doesn't work:
+	//		VarBinder binder = _helper->varBinder();
+	// because this ScriptDriver might have modified the npc.
+	VarBinder binder(_assets, _bridge, _mapData.coreData, _scriptEnv);
 
 	std::string out;
-	size_t prev = 0;
-	for (size_t i = 0; i < open.size(); i++) {
-		out += in.substr(prev, open[i] - prev);
-		prev = close[i] + 1;
-
-		// Subtle. This doesn't work:
-		//		VarBinder binder = _helper->varBinder();
-		// because this ScriptDriver might have modified the npc.
-		VarBinder binder(_assets, _bridge, _mapData.coreData, _scriptEnv);
-
-		Variant v = binder.get(in.substr(open[i] + 1, close[i] - open[i] - 1));
-		if (v.type == LUA_TSTRING)
-			out += v.str;
-		else if (v.type == LUA_TNUMBER)
-			out += std::to_string(int(v.num));
+	out.reserve(in.size() + 32);
+	t.render(out, [&](const VarPath& path, std::string& o) {
+		Variant v = binder.get(path);
+		if (v.type() == LUA_TSTRING)
+			o += v.str();
+		else if (v.type() == LUA_TNUMBER)
+			o += std::to_string(int(v.num()));
 		else
 			assert(false);
-	}
-	out += in.substr(prev);
+	});
 	return out;
 }
 
-bool ScriptDriver::textTest(const std::string& test) const
+bool ScriptDriver::textTest(const TextTest& test) const
 {
 	if (!_helper) return true;
-	if (test.size() < 2) return true;
-	std::string t = test.substr(1, test.size() - 2);	// remove the brackets
-	bool invert = false;
-	if (t[0] == '~') {
-		invert = true;
-		t = t.substr(1);
-	}
+	if (test.empty()) return true;
 	VarBinder binder(_assets, _bridge, _mapData.coreData, _scriptEnv);
-	Variant v = binder.get(t);
+	Variant v = binder.get(test.var);
 	bool truthy = v.isTruthy();
-	return invert ? !truthy : truthy;
+	return test.invert ? !truthy : truthy;
 }
 
 
@@ -193,16 +182,11 @@ TextLine ScriptDriver::line()
 	textLine.speaker = line.speaker;
 	textLine.text = line.text;
 
-	// FIXME: refactor into MapData
-	uint64_t hash = Hash(line.speaker, line.text);
-
-	if (_mapData.textRead.find(hash) == _mapData.textRead.end()) {
-		_mapData.textRead.insert(hash);
-		textLine.alreadyRead = false;
-	}
-	else {
-		textLine.alreadyRead = true;
-	}
+	bool firstRead = markLineRead(line.id);
+	if (line.substitution)
+		textLine.alreadyRead = !_mapData.markTextRead(Hash(line.speaker, line.text));
+	else
+		textLine.alreadyRead = !firstRead;
 
 	_helper.get()->call(line.code, 0);
 	return textLine;
@@ -375,32 +359,69 @@ void ScriptDriver::choose(int i)
 
 bool ScriptDriver::allTextRead(const EntityID& id) const
 {
-	ScriptRef ref = _assets.getScriptRef(id);
-	int index = -1;
+	if (_unread.version != _mapData.textReadVersion())
+		countUnreadLines();
 
-	const TreeVec& tree = _tree.tree();
-	for (size_t i = 0; i < tree.size(); ++i) {
-		if (tree[i].ref == ref) {
-			index = (int)i;
-			break;
+	int index = _tree->find(id);
+	if (index < 0) return true;
+	return _unread.count[index] == 0;
+}
+
+bool ScriptDriver::markLineRead(int id)
+{
+	uint64_t version = _mapData.textReadVersion();
+	if (!_mapData.markLineRead(id))
+		return false;
+
+	// Keep the counts current, unless they are already stale.
+	if (_unread.version == version) {
+		auto it = _unread.nodes.find(id);
+		if (it != _unread.nodes.end()) {
+			for (int node : it->second)
+				_unread.count[node]--;
 		}
+		_unread.version = _mapData.textReadVersion();
 	}
-	if (index < 0) return true;
+	return true;
+}
 
-	int end = _tree.getNodeTE(index) + 1;
-	for (int i = index; i < end; ++i) {
-		if (tree[i].leading && tree[i].ref.type == ScriptType::kText) {
-			const Text& text = _assets._csa.texts[tree[i].ref.index];
-			Text filtered = filterText(text);
-			for (const Text::Line& line : filtered.lines) {
-				uint64_t hash = Hash(line.speaker, line.text);
-				if (_mapData.textRead.find(hash) == _mapData.textRead.end()) {
-					return false;
-				}
+void ScriptDriver::countUnreadLines() const
+{
+	const TreeVec& tree = _tree->tree();
+
+	if (!_unread.built) {
+		// Which nodes each line is under. Conditional text may never be shown,
+		// so it doesn't have to be read; that also means the eval() and test
+		// don't need to be run to answer allTextRead().
+		std::vector<int> open;	// leading edges of the nodes we are in
+		for (int i = 0; i < (int)tree.size(); i++) {
+			const NodeRef& node = tree[i];
+			if (!node.leading) {
+				open.pop_back();
+				continue;
+			}
+			open.push_back(i);
+
+			if (node.ref.type != ScriptType::kText) continue;
+			const Text& text = _assets._csa.texts[node.ref.index];
+			if (text.eval >= 0 || !text.test.empty()) continue;
+
+			for (const Text::Line& line : text.lines) {
+				if (line.id < 0 || line.eval >= 0 || !line.test.empty()) continue;
+				std::vector<int>& nodes = _unread.nodes[line.id];
+				nodes.insert(nodes.end(), open.begin(), open.end());
 			}
 		}
+		_unread.built = true;
 	}
-	return true;
+
+	_unread.count.assign(tree.size(), 0);
+	for (const auto& [id, nodes] : _unread.nodes) {
+		if (_mapData.isLineRead(id)) continue;
+		for (int node : nodes)
+			_unread.count[node]++;
+	}
+	_unread.version = _mapData.textReadVersion();
 }
 
 /*static*/ void ScriptDriver::saveScriptEnv(std::ostream& stream, const ScriptEnv& env)
@@ -434,7 +455,7 @@ void ScriptDriver::save(std::ostream& stream) const
 	saveScriptEnv(stream, _scriptEnv);
 
 	fmt::print(stream, "--[[\n");
-	_tree.write(stream);
+	_tree->write(stream);
 	fmt::print(stream, "--]]\n");
 
 	// Always true? But needs to be a leading edge
@@ -443,7 +464,7 @@ void ScriptDriver::save(std::ostream& stream) const
 	assert(_treeIt.getNode().leading == true);	
 
 	fmt::print(stream, "ScriptDriver = {{\n");
-	fmt::print(stream, "  treeItIndex = {}, textSubIndex = {}, treeSize = {},\n", _treeIt.index(), _textSubIndex, _tree.size());
+	fmt::print(stream, "  treeItIndex = {}, textSubIndex = {}, treeSize = {},\n", _treeIt.index(), _textSubIndex, _tree->size());
 	fmt::print(stream, "  entityID = '{}',\n", _treeIt.getNode().entityID);
 	fmt::print(stream, "  choicesStack = {{\n");
 	for(auto& c : _choicesStack) {
@@ -473,13 +494,7 @@ bool ScriptDriver::load(ScriptBridge& loader)
 	int treeItIndex = loader.getIntField("treeItIndex", { 0 });
 	int textSubIndex = loader.getIntField("textSubIndex", { 0 });
 
-	_tree = Tree(_assets, _scriptEnv.script);
-	if (_tree.size() == 0) {
-		// deleted script??
-		assert(false);
-		return false;
-	}
-
+	_choicesStack.clear();
 	loader.pushTable("choicesStack");
 	for (TableIt it(L, -1); !it.done(); it.next()) {
 		if (it.kType() == LUA_TNUMBER) {
@@ -490,20 +505,126 @@ bool ScriptDriver::load(ScriptBridge& loader)
 	lua_pop(L, 1);
 	lua_pop(L, 1);
 
+	return restore(entityID, treeItIndex, textSubIndex);
+}
+
+void ScriptDriver::save(BinWriter& w) const
+{
+	ScriptPosition pos = position();
+
+	w.str(pos.env.script.str());
+	w.str(pos.env.zone.str());
+	w.str(pos.env.room.str());
+	w.str(pos.env.npc.str());
+
+	w.i32(pos.treeIndex);
+	w.i32(pos.textSubIndex);
+	w.str(pos.node.str());
+	w.u32(uint32_t(pos.choicesStack.size()));
+	for (Choices::Action a : pos.choicesStack) {
+		w.i32((int)a);
+	}
+}
+
+bool ScriptDriver::load(BinReader& r)
+{
+	ScriptPosition pos;
+	pos.env.script = EntityID(r.str());
+	pos.env.zone = EntityID(r.str());
+	pos.env.room = EntityID(r.str());
+	pos.env.npc = EntityID(r.str());
+
+	pos.treeIndex = r.i32();
+	pos.textSubIndex = r.i32();
+	pos.node = EntityID(r.str());
+
+	uint32_t n = r.count(4);
+	for (uint32_t i = 0; i < n; i++) {
+		pos.choicesStack.push_back((Choices::Action)r.i32());
+	}
+	if (!r.ok()) return false;
+	return setPosition(pos);
+}
+
+ScriptPosition ScriptDriver::position() const
+{
+	assert(_treeIt.getNode().leading == true);
+
+	ScriptPosition pos;
+	pos.env = _scriptEnv;
+	pos.treeIndex = _treeIt.index();
+	pos.textSubIndex = _textSubIndex;
+	pos.node = _treeIt.getNode().entityID;
+	pos.choicesStack = _choicesStack;
+	if (type() == ScriptType::kText) {
+		pos.mapped = true;
+		pos.mappedText = _mappedText;
+	}
+	else if (type() == ScriptType::kChoices) {
+		pos.mapped = true;
+		pos.mappedChoices = _mappedChoices;
+	}
+	return pos;
+}
+
+bool ScriptDriver::setPosition(const ScriptPosition& pos)
+{
+	// Check if this entire asset got moved / deleted.
+	if (!_assets.isAsset(pos.env.script)) {
+		return false;
+	}
+	_scriptEnv = pos.env;
+	_choicesStack = pos.choicesStack;
+
+	_helper.reset(nullptr);
+	_helper.reset(new ScriptHelper(_bridge, _mapData.coreData, _scriptEnv));
+
+	// Already filtered: pick up at the node without running its evals and code again.
+	if (pos.mapped) {
+		_tree = &_assets._csa.tree(_scriptEnv.script);
+		if (pos.treeIndex >= 0 && pos.treeIndex < _tree->size() && _tree->getNode(pos.treeIndex).entityID == pos.node) {
+			_treeIt = TreeIt(*_tree);
+			_treeIt.setIndex(pos.treeIndex);
+			_unread = UnreadLines();
+			_mappedText = pos.mappedText;
+			_mappedChoices = pos.mappedChoices;
+			_textSubIndex = pos.textSubIndex;
+			return true;
+		}
+	}
+	return restore(pos.node, pos.treeIndex, pos.textSubIndex);
+}
+
+bool ScriptDriver::restore(const EntityID& entityID, int treeItIndex, int textSubIndex)
+{
+	_tree = &_assets._csa.tree(_scriptEnv.script);
+	_treeIt = TreeIt(*_tree);
+	_unread = UnreadLines();
+	if (_tree->size() == 0) {
+		// deleted script??
+		assert(false);
+		return false;
+	}
+
 	// Loading a mutated script is fraught with peril.
 	// There's probably more that can be done to track if the Script has changed (hash?)
 	// and make sure the _choicesStack is valid.
 	// Weak spot.
 
-	const NodeRef& nodeRef = _tree.getNode(treeItIndex);
-	if (nodeRef.entityID == entityID) {
-		// Assume everything is okay.
-		_treeIt.setIndex(treeItIndex);
-		processTree(false);
-		if (textSubIndex < int(_mappedText.lines.size())) {
-			_textSubIndex = textSubIndex;
+	if (treeItIndex >= 0 && treeItIndex < _tree->size()) {
+		const NodeRef& nodeRef = _tree->getNode(treeItIndex);
+		if (nodeRef.entityID == entityID) {
+			// Assume everything is okay. Processing a Choices node pushes its
+			// action again, so take off the one that was saved.
+			_treeIt.setIndex(treeItIndex);
+			if (nodeRef.ref.type == ScriptType::kChoices && !_choicesStack.empty())
+				_choicesStack.pop_back();
+			processTree(false);
+			if (textSubIndex < int(_mappedText.lines.size())) {
+				_textSubIndex = textSubIndex;
+			}
+			return true;
 		}
-		return true;
 	}
 
 	// It has been mutated. What we don't know is if the choicesStack is valid,
@@ -518,8 +639,8 @@ bool ScriptDriver::load(ScriptBridge& loader)
 	}
 
 	// If we have a reliable entityID, use that
-	if (entityID.substr(0, 5) != "_GEN_") {
-		int index = _tree.find(entityID);
+	if (entityID.str().substr(0, 5) != "_GEN_") {
+		int index = _tree->find(entityID);
 		if (index >= 0) {
 			_treeIt.setIndex(index);
 			processTree(false);
@@ -10,12 +10,15 @@
 #include <string>
 #include <vector>
 #include <unordered_set>
+#include <unordered_map>
 
 namespace lurp {
 
 struct ScriptAssets;
 class ScriptHelper;
 class CoreData;
+class BinWriter;
+class BinReader;
 
 class ScriptDriver : public ITextHandler
 {
@@ -26,7 +29,7 @@ public:
 	bool done() const;
 	void abort();
 	void clear();
-	bool valid() const { return _tree.size() > 0; }
+	bool valid() const { return _tree->size() > 0; }
 	const ScriptEnv& env() const { return _scriptEnv; }
 
 	// kText
@@ -41,18 +44,31 @@ public:
 	void advance();
 	void choose(int i);					// kChoices
 
-	const Tree* getTree() const { return &_tree;}
+	const Tree* getTree() const { return _tree; }
 	virtual bool allTextRead(const EntityID& id) const;
 
 	const ScriptHelper* helper() const { return _helper.get(); }
 	VarBinder varBinder() const;
 
+	// Lua text; a debug format.
 	void save(std::ostream& stream) const;
 	bool load(ScriptBridge& loader);
 	static void saveScriptEnv(std::ostream& stream, const ScriptEnv& env);
 	static ScriptEnv loadScriptEnv(ScriptBridge& loader);
 
+	// Binary (see SaveFile).
+	void save(BinWriter& w) const;
+	bool load(BinReader& r);
+
+	// The position can be set on a new ScriptDriver to pick up where this one
+	// is (see ZoneDriver::snapshot). Returns false if the Script is gone.
+	ScriptPosition position() const;
+	bool setPosition(const ScriptPosition& pos);
+
 private:
+	// Restores the position in the (possibly changed) Script after a load.
+	bool restore(const EntityID& entityID, int treeItIndex, int textSubIndex);
+
 	bool parseAction(const std::string& str, Choices::Action& action) const;
 
 	// eval() the active choices and do text substitution
@@ -60,8 +76,13 @@ private:
 	Choices filterChoices(const Choices& choices) const;
 
 	void processTree(bool step);
-	std::string substitute(const std::string& in) const;
-	bool textTest(const std::string& test) const;
+	std::string substitute(const TextTemplate& t, const std::string& in) const;
+	bool textTest(const TextTest& test) const;
+
+	// Marks the line read and updates the unread counts. Returns true if it is
+	// the first time the line is read.
+	bool markLineRead(int id);
+	void countUnreadLines() const;
 
 	const ScriptAssets& _assets;
 	ScriptBridge& _bridge;
@@ -69,7 +90,7 @@ private:
 	MapData& _mapData;
 	
 	std::unique_ptr<ScriptHelper> _helper;
-	Tree _tree;
+	const Tree* _tree;		// shared; see ConstScriptAssets::tree()
 	TreeIt _treeIt;
 
 	int _textSubIndex = 0;
@@ -77,6 +98,18 @@ private:
 
 	Choices _mappedChoices;		// Choices: filter down to what passed 'eval'
 	Text _mappedText;			// Text: filter down to what passed 'eval' and 'test'
+
+	// The number of unread lines under each node of the tree, so allTextRead()
+	// is O(1) and never runs script code. Built when first needed, and kept
+	// current as this driver reads lines; rebuilt if the MapData changes
+	// behind its back (a load, or another driver).
+	struct UnreadLines {
+		bool built = false;
+		uint64_t version = UINT64_MAX;						// MapData::textReadVersion() of 'count'
+		std::vector<int> count;								// by tree index (leading edge)
+		std::unordered_map<int, std::vector<int>> nodes;	// line id -> nodes it is under
+	};
+	mutable UnreadLines _unread;
 };
 
 } // namespace lurp
\ No newline at end of file
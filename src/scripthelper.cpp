@@ -75,12 +75,27 @@ void ScriptHelper::tearDownScriptEnv()
 	_coreData.clearScriptEnv();
 }
 
-bool ScriptHelper::call(int ref, int nResult) const
+bool ScriptHelper::call(int func, int nResult) const
 {
-	if (ref < 0) {
+	if (func < 0) {
 		return true;
 	}
 
+	EvalCache& cache = _bridge.evalCache();
+	EvalCache::Key key{ func, _scriptEnv };
+	bool record = false;
+	if (nResult == 1) {
+		bool result = false;
+		if (_cacheEnabled && !cache.recording() && cache.find(key, _bridge.iCore(), _bridge.iMap(), result))
+			return result;
+		record = _cacheEnabled && !cache.recording();
+	}
+	else {
+		_bridge.clearSharedCaches();
+		cache.uncacheable();	// in case this is called from an eval()
+	}
+
+	int ref = _bridge.funcRef(func);
 	lua_State* L = _bridge.getLuaState();
 	ScriptBridge::LuaStackCheck check(L);
 	ScriptBridge::FuncInfo fi = _bridge.getFuncInfo(ref);
@@ -89,11 +104,19 @@ bool ScriptHelper::call(int ref, int nResult) const
 	lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
 	assert(lua_type(L, -1) == LUA_TFUNCTION);
 
-	return pcall(ref, fi.nParams, nResult);
+	if (record) cache.begin();
+	bool ok = true;
+	bool result = pcall(ref, fi.nParams, nResult, &ok);
+	if (record) cache.end(key, result, ok, _bridge.iCore(), _bridge.iMap());
+	return result;
 }
 
 bool ScriptHelper::callGlobal(const std::string& funcName, const std::vector<std::string>& args, int nResult) const
 {
+	_bridge.clearSharedCaches();
+	_bridge.evalCache().uncacheable();
+	_cacheEnabled = false;
+
 	lua_State* L = _bridge.getLuaState();
 	ScriptBridge::LuaStackCheck check(L);
 
@@ -109,7 +132,7 @@ bool ScriptHelper::callGlobal(const std::string& funcName, const std::vector<std
 	return pcall(-1, (int)args.size(), nResult);
 }
 
-bool ScriptHelper::pcall(int funcRef, int nArgs, int nResult) const
+bool ScriptHelper::pcall(int funcRef, int nArgs, int nResult, bool* ok) const
 {
 	ScriptBridge::FuncInfo fi;
 	if (funcRef >= 0) {
@@ -128,6 +151,7 @@ bool ScriptHelper::pcall(int funcRef, int nArgs, int nResult) const
 		std::string e = lua_tostring(L, -1);
 		PLOG(plog::warning) << fmt::format("Msg: {}", e);
 		assert(false);
+		if (ok) *ok = false;
 	}
 	bool r = false;
 	Variant vr = Variant::fromLua(L, -1);
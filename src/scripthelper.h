@@ -21,20 +21,26 @@ public:
 
 	// eval(script, player, npc) -> bool
 	// code(script, player, npc) -> nil
-	bool call(int funcRef, int nResult) const;
+	// 'func' is a function index from the assets; see ScriptBridge::funcRef()
+	// eval() results are memoized (see EvalCache). Calling a code() function, or
+	// callGlobal(), clears the cache, since it may change Lua state the cache can't track.
+	// That state is shared by a host and its sessions, so it clears all their caches.
+	bool call(int func, int nResult) const;
 
 	bool callGlobal(const std::string& funcName, const std::vector<std::string>& args, int nResult) const;
 
 	const ScriptEnv& env() const { return _scriptEnv; }
 
 private:
-	bool pcall(int funcRef, int nArgs, int nResult) const;
+	bool pcall(int funcRef, int nArgs, int nResult, bool* ok = nullptr) const;
 	void setupScriptEnv();
 	void tearDownScriptEnv();
 
 	ScriptBridge& _bridge;
 	CoreData& _coreData;
 	const ScriptEnv& _scriptEnv;
+	// callGlobal() can change the environment (SetupNPCEnv), so it no longer matches the key.
+	mutable bool _cacheEnabled = true;
 };
 
 } // namespace lurp
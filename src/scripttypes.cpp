@@ -5,6 +5,38 @@
 
 namespace lurp {
 
+/*static*/ TextTemplate TextTemplate::compile(const std::string& in)
+{
+	TextTemplate t;
+	size_t prev = 0;
+	while (true) {
+		size_t open = in.find('{', prev);
+		if (open == std::string::npos) break;
+		size_t close = in.find('}', open);
+		assert(close != std::string::npos);
+		if (close == std::string::npos) break;
+
+		t.segments.push_back({ in.substr(prev, open - prev), VarPath(in.substr(open + 1, close - open - 1)) });
+		prev = close + 1;
+	}
+	if (!t.segments.empty())
+		t.segments.push_back({ in.substr(prev), VarPath() });
+	return t;
+}
+
+/*static*/ TextTest TextTest::compile(const std::string& test)
+{
+	TextTest t;
+	if (test.size() < 2) return t;
+	std::string path = test.substr(1, test.size() - 2);	// remove the brackets
+	if (!path.empty() && path[0] == '~') {
+		t.invert = true;
+		path = path.substr(1);
+	}
+	t.var = VarPath(path);
+	return t;
+}
+
 /*static*/ void Text::paragraphHandler(const MarkDown& md, const std::vector<MarkDown::Span>& spans, int)
 {
 	std::string text;
@@ -10,6 +10,7 @@
 #include "items.h"
 #include "battle.h"
 #include "markdown.h"
+#include "varpath.h"
 
 namespace lurp {
 
@@ -33,9 +34,12 @@ struct Script : Entity
 		return fmt::format("Script entityID: {} nEvents={}", entityID, events.size());
 	}
 
-	virtual std::pair<bool, Variant> getVar(const std::string& k) const override {
-		if (k == "npc") return { true, Variant(npc) };
-		return { false, Variant() };
+	virtual const FieldTable& fields() const override {
+		static constexpr EntityField kFields[] = {
+			{ "npc", FieldValue<&Script::npc> },
+		};
+		static const FieldTable table(kFields);
+		return table;
 	}
 
 	virtual ScriptType getType() const override {
@@ -43,6 +47,38 @@ struct Script : Entity
 	}
 };
 
+// A string with {path} substitutions, split once (by ConstScriptAssets::index)
+// into literal runs and variable paths, so rendering is a single pass.
+struct TextTemplate {
+	struct Segment {
+		std::string literal;	// text before the variable
+		VarPath var;			// path inside the braces; empty for the trailing literal
+	};
+	std::vector<Segment> segments;	// empty if there is nothing to substitute
+
+	static TextTemplate compile(const std::string& in);
+	bool hasVars() const { return !segments.empty(); }
+
+	// Appends the text to 'out'. value(varPath, out) appends the value of a variable.
+	template<typename F>
+	void render(std::string& out, F&& value) const {
+		for (const Segment& s : segments) {
+			out += s.literal;
+			if (!s.var.empty()) value(s.var, out);
+		}
+	}
+};
+
+// A Text 'test', "{path}" or "{~path}": true if the variable is truthy (or
+// falsy, with the ~). Compiled by ConstScriptAssets::index().
+struct TextTest {
+	VarPath var;
+	bool invert = false;
+
+	static TextTest compile(const std::string& test);
+	bool empty() const { return var.empty(); }
+};
+
 struct TextLine {
 	std::string speaker;
 	std::string text;
@@ -56,13 +92,19 @@ struct Text : Entity {
 
 		int eval = -1;
 		std::string test;
+		TextTest compiledTest;
 		int code = -1;		// called when this line is read
+		int id = -1;		// dense index of every line; see ConstScriptAssets::textLine()
+		bool substitution = false;	// speaker or text has a {substitution}
+		TextTemplate speakerTemplate;
+		TextTemplate textTemplate;
 	};
 
 	std::vector<Line> lines;
 
 	int eval = -1;		// return true if this option should be presented
 	std::string test;
+	TextTest compiledTest;
 	int code = -1;		// called when this object is read
 
 	Text copyWithoutLines() const {
@@ -70,6 +112,7 @@ struct Text : Entity {
 		t.entityID = entityID;
 		t.eval = eval;
 		t.test = test;
+		t.compiledTest = compiledTest;
 		t.code = code;
 		return t;
 	}
@@ -80,9 +123,7 @@ struct Text : Entity {
 		return fmt::format("Text entityID: {} nLines={}", entityID, lines.size());
 	}
 
-	virtual std::pair<bool, Variant> getVar(const std::string&) const override {
-		return { false, Variant() };
-	}
+	virtual const FieldTable& fields() const override { return FieldTable::empty(); }
 
 	virtual ScriptType getType() const override {
 		return type;
@@ -125,6 +166,7 @@ struct Choices : Entity {
 		int eval = -1;	// called to view choice
 		int code = -1;	// called if choice is selected
 		int unmapped = 0;	// original un-mapped index. not serialized.
+		TextTemplate textTemplate;	// not serialized; built by ConstScriptAssets::index()
 	};
 
 	std::vector<Choice> choices;
@@ -143,15 +185,29 @@ struct Choices : Entity {
 		return fmt::format("Choice entityID: {}", entityID);
 	}
 
-	virtual std::pair<bool, Variant> getVar(const std::string&) const override {
-		return { false, Variant() };
-	}
+	virtual const FieldTable& fields() const override { return FieldTable::empty(); }
 
 	virtual ScriptType getType() const override {
 		return type;
 	}
 };
 
+// Where a ScriptDriver is in its Script; see ScriptDriver::position()
+struct ScriptPosition {
+	ScriptEnv env;
+	int treeIndex = 0;
+	int textSubIndex = 0;
+	EntityID node;	// the node at treeIndex, to detect a changed Script
+	std::vector<Choices::Action> choicesStack;
+
+	// The Text or Choices at the node as already filtered by 'eval' and 'code'.
+	// A snapshot keeps them so a restore doesn't run the script again; a save
+	// doesn't, and the node is re-run on load.
+	bool mapped = false;
+	Text mappedText;
+	Choices mappedChoices;
+};
+
 struct Actor : Entity {
 	std::string name;
 	bool wild = false;
@@ -171,14 +227,17 @@ struct Actor : Entity {
 		return fmt::format("Actor entityID: {}", entityID);
 	}
 
-	virtual std::pair<bool, Variant> getVar(const std::string& k) const override {
-		if (k == "name") return { true, Variant(name) };
-		if (k == "wild") return { true, Variant(wild) };
-		// These can be changed.
-		//if (k == "fighting") return { true, Variant(fighting) };
-		//if (k == "shooting") return { true, Variant(shooting) };
-		//if (k == "arcane") return { true, Variant(arcane) };
-		return { false, Variant() };
+	virtual const FieldTable& fields() const override {
+		static constexpr EntityField kFields[] = {
+			{ "name", FieldValue<&Actor::name> },
+			{ "wild", FieldValue<&Actor::wild> },
+			// These can be changed.
+			//{ "fighting", FieldValue<&Actor::fighting> },
+			//{ "shooting", FieldValue<&Actor::shooting> },
+			//{ "arcane", FieldValue<&Actor::arcane> },
+		};
+		static const FieldTable table(kFields);
+		return table;
 	}
 
 	virtual ScriptType getType() const override {
@@ -204,15 +263,18 @@ struct Combatant : Entity {
 		return fmt::format("Combatant entityID: {}", entityID);
 	}
 
-	virtual std::pair<bool, Variant> getVar(const std::string& k) const override {
-		if (k == "name") return { true, Variant(name) };
-		if (k == "wild") return { true, Variant(wild) };
-		if (k == "count") return { true, Variant(count) };
-		if (k == "fighting") return { true, Variant(fighting) };
-		if (k == "shooting") return { true, Variant(shooting) };
-		if (k == "arcane") return { true, Variant(arcane) };
-		if (k == "bias") return { true, Variant(bias) };
-		return { false, Variant() };
+	virtual const FieldTable& fields() const override {
+		static constexpr EntityField kFields[] = {
+			{ "name", FieldValue<&Combatant::name> },
+			{ "wild", FieldValue<&Combatant::wild> },
+			{ "count", FieldValue<&Combatant::count> },
+			{ "fighting", FieldValue<&Combatant::fighting> },
+			{ "shooting", FieldValue<&Combatant::shooting> },
+			{ "arcane", FieldValue<&Combatant::arcane> },
+			{ "bias", FieldValue<&Combatant::bias> },
+		};
+		static const FieldTable table(kFields);
+		return table;
 	}
 
 	virtual ScriptType getType() const override {
@@ -231,9 +293,12 @@ struct Battle : Entity {
 		return fmt::format("Battle entityID: {}", entityID);
 	}
 
-	virtual std::pair<bool, Variant> getVar(const std::string& k) const override {
-		if (k == "name") return { true, Variant(name) };
-		return { false, Variant() };
+	virtual const FieldTable& fields() const override {
+		static constexpr EntityField kFields[] = {
+			{ "name", FieldValue<&Battle::name> },
+		};
+		static const FieldTable table(kFields);
+		return table;
 	}
 
 	virtual ScriptType getType() const override {
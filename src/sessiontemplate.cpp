@@ -0,0 +1,27 @@
+#include "sessiontemplate.h"
+
+namespace lurp {
+
+SessionTemplate::Session::Session(SessionTemplate& t) :
+	bridge(t._host),
+	assets(t._csa),
+	driver(assets, bridge, t._baseline)
+{
+}
+
+SessionTemplate::SessionTemplate(const std::string& gameFile, const EntityID& zone, std::filesystem::path bundlePath) :
+	_csa(_host.readCSA(gameFile, bundlePath))
+{
+	// The baseline is whatever starting the game does: the first room, and
+	// a required interaction if it has one.
+	ScriptAssets assets(_csa);
+	ZoneDriver driver(assets, _host, zone);
+	_baseline = driver.snapshot();
+}
+
+std::unique_ptr<SessionTemplate::Session> SessionTemplate::spawn()
+{
+	return std::make_unique<Session>(*this);
+}
+
+} // namespace lurp
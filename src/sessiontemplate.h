@@ -0,0 +1,53 @@
+#pragma once
+
+#include "scriptbridge.h"
+#include "scriptasset.h"
+#include "zonedriver.h"
+
+#include <filesystem>
+#include <memory>
+#include <string>
+
+namespace lurp {
+
+// A game loaded once, that new sessions (players) are stamped from.
+//
+// The template reads the game into a host ScriptBridge, and keeps the
+// ConstScriptAssets and a baseline: the snapshot of a ZoneDriver just started
+// in 'zone'. spawn() makes a session on the host (see ScriptBridge), with
+// ScriptAssets over the shared assets, and a ZoneDriver restored to the
+// baseline. No game file is read, and the game's code and evals aren't run
+// again (if the baseline is in a script, the session only sets up the script
+// environment; see ScriptPosition). The session state is copy-on-write, so
+// spawning doesn't get slower as the game gets bigger.
+//
+// The template must outlive its sessions, and, like the host, is used from
+// one thread at a time.
+class SessionTemplate {
+public:
+	struct Session {
+		explicit Session(SessionTemplate& t);
+
+		ScriptBridge bridge;
+		ScriptAssets assets;
+		ZoneDriver driver;
+	};
+
+	SessionTemplate(const std::string& gameFile, const EntityID& zone = EntityID(), std::filesystem::path bundlePath = {});
+
+	SessionTemplate(const SessionTemplate&) = delete;
+	SessionTemplate& operator=(const SessionTemplate&) = delete;
+
+	std::unique_ptr<Session> spawn();
+
+	const ConstScriptAssets& csa() const { return _csa; }
+	const ZoneDriver::Snapshot& baseline() const { return _baseline; }
+	ScriptBridge& host() { return _host; }
+
+private:
+	ScriptBridge _host;
+	ConstScriptAssets _csa;
+	ZoneDriver::Snapshot _baseline;
+};
+
+} // namespace lurp
@@ -8,6 +8,13 @@
 #include "tree.h"
 #include "markdown.h"
 #include "config.h"
+#include "bundle.h"
+#include "savefile.h"
+#include "autosave.h"
+#include "journal.h"
+#include "assetschema.h"
+#include "chunkcache.h"
+#include "sessiontemplate.h"
 #include "../drivers/platform.h"
 
 #include <fmt/core.h>
@@ -92,7 +99,7 @@ static void BasicTest()
 	ContainerVec containerVec = map.getContainers();
 	TEST(containerVec.size() == 1);
 	const Container& chest = *containerVec[0];
-	Inventory& chestInv = assets.inventories.at(chest.entityID);
+	Inventory& chestInv = assets.getInventory(chest);
 
 	const Item& key01 = assets.getItem("KEY_01");
 	TEST(chestInv.hasItem(key01) == true);
@@ -147,10 +154,10 @@ static void DialogTest_Bookcase(const EntityID& dialog)
 	dd.advance();
 	TEST(dd.type() == ScriptType::kChoices);
 	TEST(dd.choices().choices[1].text == "Read the arcane book");
-	TEST(binder.get("player.arcaneGlow").type == LUA_TNIL);
+	TEST(binder.get("player.arcaneGlow").type() == LUA_TNIL);
 	dd.choose(1);
-	TEST(binder.get("player.arcaneGlow").type == LUA_TBOOLEAN);
-	TEST(binder.get("player.arcaneGlow").boolean == true);
+	TEST(binder.get("player.arcaneGlow").type() == LUA_TBOOLEAN);
+	TEST(binder.get("player.arcaneGlow").boolean() == true);
 	TEST(dd.type() == ScriptType::kText);
 	TEST(dd.line().text == "You have an arcane glow.");
 	dd.advance();
@@ -217,11 +224,30 @@ static void TestScriptAccess()
 	const Actor& player = assets._csa.actors[ref.index];
 	TEST(player.name == "Test Player");
 
-	TEST(binder.get("player.fighting").num == 4.0);
+	TEST(binder.get("player.fighting").num() == 4.0);
 	binder.set("player.fighting", 5.0);
-	TEST(binder.get("player.fighting").num == 5.0);
+	TEST(binder.get("player.fighting").num() == 5.0);
 	binder.set("player.fighting", 4.0);
-	TEST(binder.get("player.fighting").num == 4.0);
+	TEST(binder.get("player.fighting").num() == 4.0);
+
+	VarPath path("npc.subDesc.accessory");
+	TEST(path.slot == VarPath::Slot::kNpc);
+	TEST(path.var == "subDesc.accessory");
+	TEST(path.keys.size() == 3 && path.keys[2] == "accessory");
+	TEST(VarPath("player.fighting").entity == EntityID("player"));
+
+	const Entity* sword = assets.get("SWORD_01");
+	TEST(sword->getVar("name").second == Variant("Sword"));
+	TEST(!sword->getVar("notAField").first);
+	TEST(!sword->getVar(EntityID()).first);
+
+	// Misses in Lua are cached, so the next one doesn't go to Lua.
+	VarPath missing("player.notAVariable");
+	TEST(binder.get(missing).type() == LUA_TNIL);
+	size_t nCached = bridge.varCache().size();
+	TEST(nCached > 0);
+	TEST(binder.get(missing).type() == LUA_TNIL);
+	TEST(bridge.varCache().size() == nCached);
 }
 
 static void TestScriptSave()
@@ -445,6 +471,240 @@ static void TestZoneSave()
 	}
 }
 
+static void TestBinarySave()
+{
+	{
+		std::string text;
+		for (int i = 0; i < 100; i++) text += fmt::format("ENTITY_{} player.gold ", i % 7);
+		std::vector<uint8_t> c = SaveFile::compress((const uint8_t*)text.data(), text.size());
+		TEST(c.size() < text.size() / 2);
+		std::string out(text.size(), 0);
+		TEST(SaveFile::decompress(c.data(), c.size(), (uint8_t*)out.data(), out.size()));
+		TEST(out == text);
+		// Truncated data is detected.
+		TEST(!SaveFile::decompress(c.data(), c.size() / 2, (uint8_t*)out.data(), out.size()));
+
+		std::vector<uint8_t> empty = SaveFile::compress(nullptr, 0);
+		TEST(SaveFile::decompress(empty.data(), empty.size(), nullptr, 0));
+	}
+
+	for (int compress = 0; compress < 2; compress++) {
+		for (int story = 0; story < 3; story++) {
+			std::vector<uint8_t> data;
+			EntityID containerID;
+			{
+				ScriptBridge bridge;
+				ConstScriptAssets csa = bridge.readCSA("game/example-zone/example-zone.lua");
+				ScriptAssets assets(csa);
+				ZoneDriver zd(assets, bridge, "ZONE");
+
+				containerID = zd.getContainers()[0]->entityID;
+				zd.transferAll(containerID, zd.getPlayer().entityID);
+				if (story >= 1) {
+					TEST(zd.move("MAIN_HALL") == ZoneDriver::MoveResult::kSuccess);
+					zd.startInteraction(zd.getInteractions()[0]);
+					TEST(zd.text().text == "Hello there!");
+				}
+				if (story >= 2) {
+					zd.advance();
+				}
+				data = SaveFile::write(zd, compress != 0);
+			}
+			{
+				ScriptBridge bridge;
+				ConstScriptAssets csa = bridge.readCSA("game/example-zone/example-zone.lua");
+				ScriptAssets assets(csa);
+				ZoneDriver zd(assets, bridge, "ZONE");
+
+				// A corrupt file is rejected.
+				TEST(!SaveFile::read(data.data(), data.size() - 1, zd));
+				TEST(!SaveFile::read(data.data(), 8, zd));
+
+				TEST(SaveFile::read(data.data(), data.size(), zd));
+				TEST(assets.getInventory(assets.getContainer(containerID)).emtpy());
+				if (story == 0) {
+					TEST(zd.currentRoom().entityID == "FOYER");
+					TEST(zd.mode() == ZoneDriver::Mode::kNavigation);
+				}
+				else if (story == 1) {
+					TEST(zd.currentRoom().entityID == "MAIN_HALL");
+					TEST(zd.mode() == ZoneDriver::Mode::kText);
+					TEST(zd.text().text == "Hello there!");
+				}
+				else {
+					TEST(zd.currentRoom().entityID == "MAIN_HALL");
+					TEST(zd.mode() == ZoneDriver::Mode::kNavigation);
+				}
+			}
+		}
+	}
+}
+
+static void TestAutoSave()
+{
+	std::filesystem::path path = SavePath("test", "autosave", true, ".lurps");
+	std::filesystem::remove(path);
+
+	ScriptBridge bridge;
+	ConstScriptAssets csa = bridge.readCSA("game/example-battle/example-battle.lua");
+	{
+		ScriptAssets assets(csa);
+		AutoSave autoSave(path);
+		ZoneDriver driver(assets, bridge, "BATTLE_ZONE");
+		driver.setAutoSave(&autoSave);
+
+		driver.advance();
+		driver.choose(0);	// knight
+		driver.advance();
+		TEST(autoSave.numWritten() == 0);
+		driver.choose(0);
+		TEST(driver.mode() == ZoneDriver::Mode::kBattle);
+
+		// Snapshot was taken on entering the battle; changes after that aren't in the save.
+		driver.battleDone();
+		autoSave.flush();
+		TEST(autoSave.numWritten() == 1);
+		TEST(autoSave.numFailed() == 0);
+	}
+	TEST(std::filesystem::exists(path));
+	std::filesystem::path tmp = path;
+	tmp += ".tmp";
+	TEST(!std::filesystem::exists(tmp));
+	{
+		ScriptAssets assets(csa);
+		ZoneDriver driver(assets, bridge, "BATTLE_ZONE");
+		TEST(SaveFile::load(path, driver));
+		TEST(driver.mode() == ZoneDriver::Mode::kBattle);
+		TEST(driver.getInventory(driver.getPlayer()).hasItem(assets.getItem("LONGSWORD")));
+	}
+}
+
+static void TestJournal()
+{
+	std::filesystem::path path = SavePath("test", "journal", true, ".lurps");
+	EntityID containerID;
+	{
+		ScriptBridge bridge;
+		ConstScriptAssets csa = bridge.readCSA("game/example-zone/example-zone.lua");
+		ScriptAssets assets(csa);
+		ZoneDriver zd(assets, bridge, "ZONE");
+
+		Journal journal(path);
+		journal.sync = false;
+		TEST(journal.compact(zd));
+
+		containerID = zd.getContainers()[0]->entityID;
+		zd.transferAll(containerID, zd.getPlayer().entityID);
+		TEST(journal.checkpoint(zd));
+
+		TEST(zd.move("MAIN_HALL") == ZoneDriver::MoveResult::kSuccess);
+		zd.startInteraction(zd.getInteractions()[0]);
+		TEST(zd.text().text == "Hello there!");
+		TEST(journal.checkpoint(zd));
+		TEST(journal.numRecords() == 2);
+	}
+	// A torn write at the end of the log is ignored.
+	{
+		FILE* fp = SaveFile::openFile(Journal::logPath(path), true);
+		TEST(fp);
+		const uint8_t junk[] = { 100, 0, 0, 0, 1, 2, 3 };
+		fwrite(junk, 1, sizeof(junk), fp);
+		fclose(fp);
+	}
+	{
+		ScriptBridge bridge;
+		ConstScriptAssets csa = bridge.readCSA("game/example-zone/example-zone.lua");
+		ScriptAssets assets(csa);
+		ZoneDriver zd(assets, bridge, "ZONE");
+
+		TEST(Journal::replay(path, zd));
+		TEST(assets.getInventory(assets.getContainer(containerID)).emtpy());
+		TEST(zd.currentRoom().entityID == "MAIN_HALL");
+		TEST(zd.mode() == ZoneDriver::Mode::kText);
+		TEST(zd.text().text == "Hello there!");
+	}
+}
+
+static void TestSnapshot()
+{
+	ScriptBridge bridge;
+	ConstScriptAssets csa = bridge.readCSA("game/example-zone/example-zone.lua");
+	ScriptAssets assets(csa);
+	ZoneDriver zd(assets, bridge, "ZONE");
+
+	EntityID containerID = zd.getContainers()[0]->entityID;
+	const Container& container = assets.getContainer(containerID);
+	TEST(!assets.getInventory(container).emtpy());
+
+	ZoneDriver::Snapshot start = zd.snapshot();
+	zd.mapData.coreData.coreSet("player", "mood", Variant("happy"), false);
+	zd.transferAll(containerID, zd.getPlayer().entityID);
+	ZoneDriver::Snapshot looted = zd.snapshot();
+
+	TEST(zd.move("MAIN_HALL") == ZoneDriver::MoveResult::kSuccess);
+	zd.startInteraction(zd.getInteractions()[0]);
+	TEST(zd.text().text == "Hello there!");
+	ZoneDriver::Snapshot talking = zd.snapshot();
+	zd.advance();
+	TEST(zd.mode() == ZoneDriver::Mode::kNavigation);
+
+	zd.restore(start);
+	TEST(zd.currentRoom().entityID == "FOYER");
+	TEST(zd.mode() == ZoneDriver::Mode::kNavigation);
+	TEST(!assets.getInventory(container).emtpy());
+	TEST(!zd.mapData.coreData.coreGet("player", "mood").first);
+
+	// Branch: a different change from the start doesn't touch the other snapshots.
+	zd.mapData.coreData.coreSet("player", "mood", Variant("grumpy"), false);
+
+	zd.restore(talking);
+	TEST(zd.currentRoom().entityID == "MAIN_HALL");
+	TEST(zd.mode() == ZoneDriver::Mode::kText);
+	TEST(zd.text().text == "Hello there!");
+	TEST(zd.mapData.coreData.coreGet("player", "mood").second == Variant("happy"));
+
+	zd.restore(looted);
+	TEST(zd.currentRoom().entityID == "FOYER");
+	TEST(assets.getInventory(container).emtpy());
+
+	// Restoring in the middle of a script doesn't run its code again.
+	ScriptBridge gateBridge;
+	ConstScriptAssets gateCSA = gateBridge.readCSA("script/testzones.lua");
+	ScriptAssets gateAssets(gateCSA);
+	ZoneDriver gate(gateAssets, gateBridge, "TEST_ZONE_3");
+	const Item& gold = gateAssets.getItem("GOLD");
+	TEST(gate.mode() == ZoneDriver::Mode::kText);
+	TEST(gate.mapData.coreData.coreGet("player", "visits").second == Variant(1));
+
+	ZoneDriver::Snapshot atText = gate.snapshot();
+	gate.restore(atText);
+	gate.restore(atText);
+	TEST(gate.mode() == ZoneDriver::Mode::kText);
+	TEST(gate.text().text == "The gatekeeper hands you a coin.");
+	TEST(gate.mapData.coreData.coreGet("player", "visits").second == Variant(1));
+	TEST(gate.getInventory(gate.getPlayer()).numItems(gold) == 1);
+	Random random = atText.random;
+	TEST(gate.mapData.random.rand() == random.rand());
+
+	gate.restore(atText);
+	gate.advance();
+	TEST(gate.text().text == "Visit 1.");
+	gate.advance();
+	TEST(gate.mode() == ZoneDriver::Mode::kChoices);
+	ZoneDriver::Snapshot atChoices = gate.snapshot();
+	TEST(atChoices.script->choicesStack.size() == 1);
+
+	gate.restore(atChoices);
+	gate.restore(atChoices);
+	TEST(gate.mode() == ZoneDriver::Mode::kChoices);
+	TEST(gate.choices().choices.size() == 2);
+	TEST(gate.snapshot().script->choicesStack == atChoices.script->choicesStack);
+	TEST(gate.mapData.coreData.coreGet("player", "visits").second == Variant(1));
+	gate.choose(0);
+	TEST(gate.mode() == ZoneDriver::Mode::kNavigation);
+	TEST(gate.mapData.coreData.coreGet("player", "polite").second == Variant(true));
+}
+
 static void TestCodeEval()
 {
 	ScriptBridge bridge;
@@ -497,19 +757,132 @@ static void TestCodeEval()
 		ScriptDriver driver(assets, mapData, bridge, env2);
 		VarBinder binder = driver.varBinder();
 		TEST(driver.type() == ScriptType::kText);
-		TEST(binder.get("player.mystery").type == LUA_TBOOLEAN);
-		TEST(binder.get("player.mystery").boolean == true);
+		TEST(binder.get("player.mystery").type() == LUA_TBOOLEAN);
+		TEST(binder.get("player.mystery").boolean() == true);
 		driver.advance();
 		TEST(driver.type() == ScriptType::kChoices);
 		TEST(driver.choices().choices.size() == 1);
 		driver.choose(0);
 		TEST(driver.type() == ScriptType::kText);
-		TEST(binder.get("player.arcaneGlow").boolean == true);
+		TEST(binder.get("player.arcaneGlow").boolean() == true);
 		driver.advance();
 		TEST(driver.done());
 	}
 }
 
+static void TestVariant()
+{
+	size_t nInterned = EntityID::numInterned();
+	Variant s0("short");
+	Variant s1(std::string("a string that is longer than the inline storage"));
+	Variant s2(std::string("a string that is longer than the inline storage"));
+	TEST(s0.type() == LUA_TSTRING);
+	TEST(s0.str() == "short");
+	TEST(s1 == s2);
+	TEST(s1.str() == "a string that is longer than the inline storage");
+	TEST(s0 != s1);
+	TEST(Variant("") != Variant());
+	TEST(!Variant("").isTruthy());
+
+	TEST(Variant(3) == Variant(3.0));
+	TEST(Variant(3).num() == 3.0);
+	TEST(Variant(1) != Variant("1"));
+	TEST(Variant(true).boolean());
+	TEST(Variant(false) != Variant());
+	TEST(Variant().isNil());
+	TEST(Variant(2.5).toLuaString() == "2.5");
+
+	// Long strings are shared by copies, and aren't interned.
+	{
+		Variant s3 = s1;
+		Variant s4 = std::move(s3);
+		TEST(s3.isNil());
+		TEST(s4 == s1);
+		s4 = s0;
+		TEST(s4 == s0);
+		s0 = s1;
+		TEST(s0.str() == s2.str());
+	}
+	TEST(s1.str() == "a string that is longer than the inline storage");
+	TEST(EntityID::numInterned() == nInterned);
+}
+
+static void TestCoreData()
+{
+	CoreData coreData;
+	for (int i = 0; i < 200; i++) {
+		coreData.coreSet(fmt::format("ENTITY_{}", i % 7), fmt::format("path{}", i), Variant(i), false);
+	}
+	bool okay = true;
+	for (int i = 0; i < 200; i++) {
+		std::pair<bool, Variant> r = coreData.coreGet(fmt::format("ENTITY_{}", i % 7), fmt::format("path{}", i));
+		okay = okay && r.first && r.second.num() == i;
+	}
+	TEST(okay);
+	TEST(!coreData.coreGet("ENTITY_0", "path1").first);
+	TEST(!coreData.coreGet("ENTITY_0", "neverInternedPath").first);
+
+	coreData.coreSet(_SCRIPTENV, "path0", Variant(true), false);
+	TEST(coreData.coreBool(_SCRIPTENV, "path0", false));
+	uint64_t version = coreData.coreVersion();
+	coreData.clearScriptEnv();
+	TEST(!coreData.coreGet(_SCRIPTENV, "path0").first);
+	TEST(coreData.coreGet("ENTITY_0", "path0").first);
+	TEST(coreData.coreVersion() != version);
+}
+
+static void TestEvalCache()
+{
+	ScriptBridge bridge;
+	ConstScriptAssets csa = bridge.readCSA("script/testscript.lua");
+	ScriptAssets assets(csa);
+	MapData mapData(56);
+	ScriptEnv env = { "TEST_MAGIC_BOOK", NO_ENTITY, NO_ENTITY, NO_ENTITY };
+
+	const Choices* choices = nullptr;
+	for (const Choices& c : csa.choices) {
+		if (c.choices.size() == 2 && c.choices[0].text == "Grad the book and run")
+			choices = &c;
+	}
+	TEST(choices);
+	if (!choices) return;
+	int fighter = choices->choices[0].eval;
+	int wizard = choices->choices[1].eval;
+
+	bridge.setIAsset(&assets);
+	bridge.setICore(&mapData.coreData);
+	const EvalCache& cache = bridge.evalCache();
+	{
+		mapData.coreData.coreSet("player", "class", Variant("fighter"), false);
+		ScriptHelper helper(bridge, mapData.coreData, env);
+		TEST(helper.call(fighter, 1) == true);
+		int hits = cache.hits();
+		TEST(helper.call(fighter, 1) == true);
+		TEST(cache.hits() == hits + 1);
+
+		// Unrelated change: still valid.
+		mapData.coreData.coreSet("player", "unrelated", Variant(1), false);
+		TEST(helper.call(fighter, 1) == true);
+		TEST(cache.hits() == hits + 2);
+
+		// Dependency changed.
+		mapData.coreData.coreSet("player", "class", Variant("wizard"), false);
+		TEST(helper.call(fighter, 1) == false);
+		TEST(helper.call(wizard, 1) == true);
+		TEST(cache.hits() == hits + 2);
+	}
+	{
+		// A new environment with the same key uses the cache.
+		ScriptHelper helper(bridge, mapData.coreData, env);
+		int hits = cache.hits();
+		TEST(helper.call(wizard, 1) == true);
+		TEST(cache.hits() == hits + 1);
+	}
+	bridge.setICore(nullptr);
+	bridge.setIAsset(nullptr);
+	TEST(cache.size() == 0);
+}
+
 static void TestBattle()
 {
 	TEST_FP(BattleSystem::chance(1, Die(1, 4, 0)), 0.75);	// rolling 1 is always failure
@@ -628,6 +1001,49 @@ static void TestScriptBridge()
 		}
 		engine.pop();
 	}
+	{
+		struct Fields {
+			std::string str;
+			int i = 0;
+			bool b = false;
+			std::string notThere = "default";
+			int nOther = 0;
+		};
+		using S = AssetSchema<Fields>;
+		lua_State* L = engine.getLuaState();
+		S schema(L, nullptr, {
+			{ "strField", S::Value<&Fields::str>, true },
+			{ "intField", S::Value<&Fields::i> },
+			{ "boolField", S::Value<&Fields::b> },
+			{ "notThere", S::Value<&Fields::notThere> },
+		}, [](lua_State*, Fields& f) { f.nOther++; return true; });
+		S wrongType(L, nullptr, { { "intField", S::Value<&Fields::str> } });
+		S required(L, nullptr, { { "notThere", S::Value<&Fields::notThere>, true } });
+
+		engine.pushGlobal(gtable);
+		{
+			Fields f;
+			schema.read(f);
+			TEST(f.str == "strValue");
+			TEST(f.i == 42);
+			TEST(f.b == true);
+			TEST(f.notThere == "default");
+			TEST(f.nOther == 5);	// the arrays, subTable, and [1]
+
+			for (const S* bad : { &wrongType, &required }) {
+				bool threw = false;
+				try {
+					bad->read(f);
+				}
+				catch (std::exception&) {
+					threw = true;
+				}
+				TEST(threw);
+				TEST(lua_type(L, -1) == LUA_TTABLE);
+			}
+		}
+		engine.pop();
+	}
 }
 
 static void TestTextSubstitution()
@@ -650,6 +1066,77 @@ static void TestTextSubstitution()
 	TEST(driver.line().text == "Read the first book! (Books read = 1)");
 	driver.advance();
 	TEST(driver.done());
+
+	TextTemplate t = TextTemplate::compile("{npc.name} is {a}{b}.");
+	TEST(t.segments.size() == 4);
+	TEST(t.segments[0].literal.empty() && t.segments[0].var.path == "npc.name");
+	TEST(t.segments[1].literal == " is " && t.segments[1].var.path == "a");
+	TEST(t.segments[2].literal.empty() && t.segments[2].var.path == "b");
+	TEST(t.segments[3].literal == "." && t.segments[3].var.empty());
+	std::string out;
+	t.render(out, [](const VarPath& var, std::string& o) { o += "<" + var.path + ">"; });
+	TEST(out == "<npc.name> is <a><b>.");
+	TEST(!TextTemplate::compile("no vars").hasVars());
+}
+
+static void TestTextRead()
+{
+	// Lines with substitutions are also tracked by hash.
+	{
+		ScriptBridge bridge;
+		ConstScriptAssets ca = bridge.readCSA("script/testscript.lua");
+		ScriptAssets assets(ca);
+		ScriptEnv env;
+		env.script = "_TEST_READING";
+		MapData mapData(56);
+		ScriptDriver driver(assets, mapData, bridge, env);
+		TEST(!driver.allTextRead("_TEST_READING"));
+		while (!driver.done()) {
+			TEST(!driver.line().alreadyRead);
+			TEST(driver.line().alreadyRead);
+			driver.advance();
+		}
+		TEST(mapData.textRead().hashed.size() == 4);
+		TEST(!mapData.textRead().bits.empty());
+
+		// The query doesn't run the Text code.
+		double booksRead = mapData.coreData.coreGet("_ScriptEnv", "booksRead").second.num();
+		TEST(driver.allTextRead("_TEST_READING"));
+		TEST(mapData.coreData.coreGet("_ScriptEnv", "booksRead").second.num() == booksRead);
+
+		// A new driver picks up what was read.
+		ScriptDriver driver2(assets, mapData, bridge, env);
+		TEST(driver2.allTextRead("_TEST_READING"));
+	}
+	// Static lines are a bit, and survive a save.
+	std::vector<uint64_t> bits;
+	std::vector<uint8_t> data;
+	{
+		ScriptBridge bridge;
+		ConstScriptAssets csa = bridge.readCSA("game/example-zone/example-zone.lua");
+		TEST(csa.numTextLines() > 0);
+		for (int i = 0; i < csa.numTextLines(); i++) TEST(csa.textLine(i).id == i);
+
+		ScriptAssets assets(csa);
+		ZoneDriver zd(assets, bridge, "ZONE");
+		TEST(zd.move("MAIN_HALL") == ZoneDriver::MoveResult::kSuccess);
+		zd.startInteraction(zd.getInteractions()[0]);
+		TEST(!zd.text().alreadyRead);
+		TEST(zd.text().alreadyRead);
+		TEST(zd.mapData.textRead().hashed.empty());
+		bits = zd.mapData.textRead().bits;
+		TEST(!bits.empty());
+		data = SaveFile::write(zd);
+	}
+	{
+		ScriptBridge bridge;
+		ConstScriptAssets csa = bridge.readCSA("game/example-zone/example-zone.lua");
+		ScriptAssets assets(csa);
+		ZoneDriver zd(assets, bridge, "ZONE");
+		TEST(SaveFile::read(data.data(), data.size(), zd));
+		TEST(zd.mapData.textRead().bits == bits);
+		TEST(zd.text().alreadyRead);
+	}
 }
 
 static void TestTextTest()
@@ -817,15 +1304,22 @@ static void ChoiceMode2Test()
 	driver.choose(0);
 	driver.line();		// actually marks text as read when it is fetched
 	driver.advance();
+	TEST(driver.allTextRead("CHOICE_MODE_2") == false);
 
 	driver.choose(1);
 	driver.line();
 	driver.advance();
+	TEST(driver.allTextRead("CHOICE_MODE_2") == true);
 
 	TEST(driver.type() == ScriptType::kChoices);
 	TEST(driver.choices().choices.size() == 3);
 	driver.choose(2);
 	TEST(driver.done());
+
+	// The tree is built once, and shared.
+	ScriptDriver driver2(assets, mapData, bridge, env);
+	TEST(driver2.getTree() == driver.getTree());
+	TEST(driver2.getTree() == &ca.tree("CHOICE_MODE_2_TEST"));
 }
 
 static void FlagTest()
@@ -838,14 +1332,14 @@ static void FlagTest()
 	ZoneDriver driver(assets, bridge, "TEST_ZONE_1");
 
 	TEST(driver.mode() == Mode::kText);
-	TEST(driver.mapData.coreData.coreGet("TEST_ACTOR_1", "npcFlag").second.boolean == true);
-	TEST(driver.mapData.coreData.coreGet("_ScriptEnv", "scriptFlag").second.boolean == true);
-	TEST(driver.mapData.coreData.coreGet("_ScriptEnv", "npcName").second.str == "TestActor1");
+	TEST(driver.mapData.coreData.coreGet("TEST_ACTOR_1", "npcFlag").second.boolean() == true);
+	TEST(driver.mapData.coreData.coreGet("_ScriptEnv", "scriptFlag").second.boolean() == true);
+	TEST(driver.mapData.coreData.coreGet("_ScriptEnv", "npcName").second.str() == "TestActor1");
 	driver.advance();
 	TEST(driver.mode() == Mode::kNavigation);
 
-	TEST(driver.mapData.coreData.coreGet("TEST_ACTOR_1", "npcFlag").second.boolean == true);
-	TEST(driver.mapData.coreData.coreGet("_ScriptEnv", "scriptFlag").second.type == LUA_TNIL);
+	TEST(driver.mapData.coreData.coreGet("TEST_ACTOR_1", "npcFlag").second.boolean() == true);
+	TEST(driver.mapData.coreData.coreGet("_ScriptEnv", "scriptFlag").second.type() == LUA_TNIL);
 }
 
 
@@ -873,6 +1367,19 @@ static void TestInventoryScript()
 }
 #endif 
 
+static int gSetupScriptEnvCount = 0;
+
+// Counts the calls, and forwards them to the SetupScriptEnv in the upvalue.
+static int CountSetupScriptEnv(lua_State* L)
+{
+	gSetupScriptEnvCount++;
+	int n = lua_gettop(L);
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_insert(L, 1);
+	lua_call(L, n, LUA_MULTRET);
+	return lua_gettop(L);
+}
+
 static void TestContainers()
 {
 	ScriptBridge bridge;
@@ -902,6 +1409,45 @@ static void TestContainers()
 	TEST(zone.transferAll(chestA.entityID, player.entityID) == ZoneDriver::TransferResult::kSuccess);
 	TEST(zone.getInventory(player).numItems(assets.getItem("GOLD")) == 100);
 	TEST(zone.mapData.newsQueue.size() == 2);	// unlocked and have gold
+
+	// All the evals of a query share one script environment, and give the same
+	// results as evaluating each one on its own.
+	lua_State* L = bridge.getLuaState();
+	lua_getglobal(L, "SetupScriptEnv");
+	lua_pushcclosure(L, CountSetupScriptEnv, 1);
+	lua_setglobal(L, "SetupScriptEnv");
+
+	zone.setZone("TEST_ZONE_2", "TEST_ROOM_EVALS");
+	ScriptEnv env = { NO_ENTITY, "TEST_ZONE_2", "TEST_ROOM_EVALS", NO_ENTITY };
+	auto evalEach = [&](int func) {
+		ScriptHelper helper(bridge, zone.mapData.coreData, env);
+		return helper.call(func, 1);
+	};
+	for (bool flag : { false, true }) {
+		zone.mapData.coreData.coreSet("player", "evalFlag", Variant(flag), false);
+
+		gSetupScriptEnvCount = 0;
+		ContainerVec containers = zone.getContainers();
+		TEST(gSetupScriptEnvCount == 1);
+		gSetupScriptEnvCount = 0;
+		InteractionVec interactions = zone.getInteractions();
+		TEST(gSetupScriptEnvCount == 1);
+
+		TEST(containers.size() == (flag ? 3 : 2));
+		TEST(interactions.size() == (flag ? 1 : 2));
+
+		ContainerVec eachContainers;
+		InteractionVec eachInteractions;
+		for (const EntityID& e : zone.entities()) {
+			ScriptRef ref = assets.getScriptRef(e);
+			if (ref.type == ScriptType::kContainer && evalEach(ca.containers[ref.index].eval))
+				eachContainers.push_back(&ca.containers[ref.index]);
+			if (ref.type == ScriptType::kInteraction && evalEach(ca.interactions[ref.index].eval))
+				eachInteractions.push_back(&ca.interactions[ref.index]);
+		}
+		TEST(containers == eachContainers);
+		TEST(interactions == eachInteractions);
+	}
 }
 
 static void TestWalkabout()
@@ -964,24 +1510,49 @@ static void TestLuaCore()
 
 	TEST(driver.type() == ScriptType::kText);
 	CoreData& cd = mapData.coreData;
-	TEST(cd.coreGet("ACTOR_01", "STR").second.num == 17.0);
+	TEST(cd.coreGet("ACTOR_01", "STR").second.num() == 17.0);
 	TEST(cd.coreGet("ACTOR_01", "attributes").first == false);
 	cd.coreSet("ACTOR_01", "STR", Variant(18.0), false);
 
+	// The core table reads and writes the core from C, and falls back to the source.
+	{
+		lua_State* L = bridge.getLuaState();
+		ScriptBridge::LuaStackCheck check(L);
+		lua_getglobal(L, "Entity");
+		lua_pushstring(L, "ACTOR_01");
+		lua_call(L, 1, 1);
+		TEST(lua_getmetatable(L, -1));
+		lua_getfield(L, -1, "__index");
+		TEST(lua_iscfunction(L, -1));
+		lua_pop(L, 2);
+
+		lua_getfield(L, -1, "STR");
+		TEST(lua_tonumber(L, -1) == 18.0);
+		lua_getfield(L, -2, "attributes");
+		TEST(lua_istable(L, -1));
+		lua_pop(L, 2);
+
+		lua_pushinteger(L, 19);
+		lua_setfield(L, -2, "STR");
+		TEST(cd.coreGet("ACTOR_01", "STR").second.num() == 19.0);
+		cd.coreSet("ACTOR_01", "STR", Variant(18.0), false);
+		lua_pop(L, 1);
+	}
+
 	driver.advance();
 	TEST(driver.done());
-	TEST(cd.coreGet("ACTOR_01", "STR").second.num == 18.0);
+	TEST(cd.coreGet("ACTOR_01", "STR").second.num() == 18.0);
 
 	// Test the path works the same as the Core
 	VarBinder binder = driver.varBinder();
-	TEST(binder.get("ACTOR_01.STR").num == 18.0);
-	TEST(binder.get("ACTOR_01.DEX").num == 10.0);
-	TEST(binder.get("ACTOR_01.attributes.sings").boolean == true);
-	TEST(binder.get("player.name").str == "Test Player");
+	TEST(binder.get("ACTOR_01.STR").num() == 18.0);
+	TEST(binder.get("ACTOR_01.DEX").num() == 10.0);
+	TEST(binder.get("ACTOR_01.attributes.sings").boolean() == true);
+	TEST(binder.get("player.name").str() == "Test Player");
 
 	// Make sure we can't set a read-only value
 	binder.set("player.name", "Foozle");
-	TEST(binder.get("player.name").str == "Test Player");
+	TEST(binder.get("player.name").str() == "Test Player");
 
 	// At this point we can't save the 'driver' because
 	// it is done(). But we can test save/load of the CoreData
@@ -1669,6 +2240,394 @@ static void TestLoadMarkDown()
 	TEST(text[0].lines[4].text == "I'm not interested.");
 }
 
+static void TestEntityID()
+{
+	EntityID a("TEST_ENTITY_ID_A");
+	EntityID b(std::string("TEST_ENTITY_ID_B"));
+	EntityID a2(std::string_view("TEST_ENTITY_ID_A"));
+
+	TEST(a == a2);
+	TEST(a.handle() == a2.handle());
+	TEST(a != b);
+	TEST(a == "TEST_ENTITY_ID_A");
+	TEST(std::string("TEST_ENTITY_ID_B") == b);
+	TEST(a.str() == "TEST_ENTITY_ID_A");
+	TEST(std::hash<EntityID>()(a) == std::hash<EntityID>()(a2));
+	TEST(fmt::format("{}", b) == "TEST_ENTITY_ID_B");
+
+	EntityID empty;
+	TEST(empty.empty());
+	TEST(empty == EntityID(""));
+	TEST(empty.handle() == 0);
+
+	size_t n = EntityID::numInterned();
+	EntityID a3("TEST_ENTITY_ID_A");
+	TEST(EntityID::numInterned() == n);
+}
+
+static void TestGraph()
+{
+	Graph<int, int> g0;
+	g0.addEdge(2, 3, 23, true);
+	g0.addEdge(1, 2, 12, true);
+	g0.addEdge(1, 3, 13);
+
+	Graph<int, int> g1;
+	g1.beginBuild(5);
+	g1.addEdge(2, 3, 23, true);
+	g1.addEdge(1, 2, 12, true);
+	g1.addEdge(1, 3, 13);
+	g1.endBuild();
+
+	for (int n = 0; n < 4; n++) {
+		auto v0 = g0.adjacentVec(n);
+		auto v1 = g1.adjacentVec(n);
+		TEST(v0.size() == v1.size());
+		for (size_t i = 0; i < v0.size() && i < v1.size(); i++) {
+			TEST(v0[i].node1 == v1[i].node1);
+			TEST(v0[i].edge == v1[i].edge);
+		}
+	}
+	TEST(!g1.hasNode(0));
+	TEST(g1.adjacentVec(1).size() == 2);
+	TEST(g1.adjacentVec(1)[0].edge == 12);	// insertion order is kept
+	TEST(g1.adjacentVec(3).size() == 1);
+	TEST(g1.adjacentVec(0).empty());
+	Graph<int, int> g2 = g1;	// rows are offsets, so they survive a copy
+	g1.clear();
+	TEST(g2.adjacentVec(2).size() == 2);
+	TEST(!g1.hasNode(2));
+
+	ScriptBridge bridge;
+	ConstScriptAssets csa = bridge.readCSA("script/testzones.lua");
+
+	ConstScriptAssets::Location loc = csa.locate("TEST_ZONE_0_CHEST_01");
+	TEST(loc.zone == "TEST_ZONE_0");
+	TEST(loc.room == "TEST_ZONE_0_ROOM_A");
+	loc = csa.locate("TEST_ROOM_1");
+	TEST(loc.zone == "TEST_ZONE_1");
+	TEST(loc.room == "TEST_ROOM_1");
+	loc = csa.locate("TEST_ZONE_2");
+	TEST(loc.zone == "TEST_ZONE_2");
+	TEST(loc.room.empty());
+	loc = csa.locate("player");
+	TEST(loc.zone.empty() && loc.room.empty());
+	TEST(csa.owner("TEST_ROOM_2") == "TEST_ZONE_2");
+
+	for (const Room& room : csa.rooms) {
+		size_t n = 0;
+		for (const Edge& e : csa.edges) {
+			if (e.room1 == room.entityID || e.room2 == room.entityID) n++;
+		}
+		TEST(csa.roomGraph().adjacentVec(room.entityID).size() == n);
+	}
+}
+
+// Two sessions on the same assets.
+static void RunSharedAssets(const ConstScriptAssets& csa, ScriptBridge& bridge0, ScriptBridge& bridge1)
+{
+	ScriptAssets assets0(csa);
+	ScriptAssets assets1(csa);
+	TEST(assets0.changedInventories().empty());
+
+	ZoneDriver zone0(assets0, bridge0, "TEST_ZONE_2");
+	ZoneDriver zone1(assets1, bridge1, "TEST_ZONE_2");
+	zone0.setZone("TEST_ZONE_2", "TEST_ROOM_2");
+	zone1.setZone("TEST_ZONE_2", "TEST_ROOM_2");
+
+	const Actor& player = zone0.getPlayer();
+	const Item& key = assets0.getItem("KEY_01");
+	ContainerVec containers = zone0.getContainers();
+	TEST(containers.size() == 2);
+
+	// Changes in one session don't leak to the other, or to the shared assets.
+	TEST(zone0.transferAll(containers[1]->entityID, player.entityID) == ZoneDriver::TransferResult::kSuccess);
+	TEST(zone0.getInventory(player).hasItem(key));
+	TEST(!zone1.getInventory(player).hasItem(key));
+	TEST(zone1.getInventory(*containers[1]).hasItem(key));
+	TEST(containers[1]->inventory.hasItem(key));
+	TEST(assets0.changedInventories().size() == 2);
+	TEST(assets1.changedInventories().empty());
+
+	// Functions work with the second bridge.
+	zone1.setZone("TEST_ZONE_0", "TEST_ZONE_0_ROOM_B");
+	assets1.getInventory(player).addItem(key);
+	InteractionVec interactions = zone1.getInteractions();
+	TEST(interactions.size() == 2);
+	zone1.startInteraction(interactions[1]);	// teleport button
+	while (zone1.mode() == ZoneDriver::Mode::kText) {
+		zone1.advance();
+	}
+	TEST(zone1.currentRoom().entityID == "TEST_ROOM_1");
+	TEST(zone0.currentRoom().entityID == "TEST_ROOM_2");
+}
+
+static void TestSharedAssets()
+{
+	const std::string gameFile = "script/testzones.lua";
+	ScriptBridge bridge0;
+	const ConstScriptAssets csa = bridge0.readCSA(gameFile);
+	ScriptBridge bridge1;
+	bridge1.bindCSA(gameFile, csa);
+	RunSharedAssets(csa, bridge0, bridge1);
+}
+
+static void TestSessions()
+{
+	const std::string gameFile = "script/testzones.lua";
+	ScriptBridge host;
+	const ConstScriptAssets csa = host.readCSA(gameFile);
+	{
+		ScriptBridge session0(host);
+		ScriptBridge session1(host);
+		TEST(session0.isSession());
+		TEST(session0.host() == &host);
+		TEST(session0.getLuaState() != session1.getLuaState());
+
+		// Globals written by a session are its own; the game's are shared.
+		session0.setGlobal("SessionValue", 1);
+		for (ScriptBridge* b : { &session0, &session1, &host }) {
+			lua_State* L = b->getLuaState();
+			lua_getglobal(L, "SessionValue");
+			TEST(lua_isnil(L, -1) == (b != &session0));
+			lua_getglobal(L, "Entities");
+			TEST(lua_istable(L, -1));
+			lua_pop(L, 2);
+		}
+
+		// code() in one session can change Lua state they all share, so it
+		// clears every session's caches, and the host's.
+		session1.varCache()[1] = Variant(1);
+		host.varCache()[1] = Variant(1);
+		{
+			ScriptAssets assets(csa);
+			ZoneDriver gate(assets, session0, "TEST_ZONE_3");
+			TEST(gate.mode() == ZoneDriver::Mode::kText);
+		}
+		TEST(session1.varCache().empty());
+		TEST(host.varCache().empty());
+
+		RunSharedAssets(csa, session0, session1);
+	}
+	// The host still works after its sessions are gone.
+	ScriptAssets assets(csa);
+	ZoneDriver zone(assets, host, "TEST_ZONE_2");
+	zone.setZone("TEST_ZONE_2", "TEST_ROOM_2");
+	TEST(zone.getContainers().size() == 2);
+}
+
+static void TestSessionTemplate()
+{
+	SessionTemplate tmpl("script/testzones.lua", "TEST_ZONE_2");
+	TEST(tmpl.baseline().zone.type == ScriptType::kZone);
+	{
+		std::unique_ptr<SessionTemplate::Session> s0 = tmpl.spawn();
+		std::unique_ptr<SessionTemplate::Session> s1 = tmpl.spawn();
+		TEST(s0->bridge.isSession());
+		TEST(s0->driver.currentZone().entityID == "TEST_ZONE_2");
+		TEST(s1->driver.currentRoom().entityID == s0->driver.currentRoom().entityID);
+
+		ZoneDriver& zone0 = s0->driver;
+		zone0.setZone("TEST_ZONE_2", "TEST_ROOM_2");
+		const Actor& player = zone0.getPlayer();
+		const Item& key = s0->assets.getItem("KEY_01");
+		ContainerVec containers = zone0.getContainers();
+		TEST(containers.size() == 2);
+		TEST(zone0.transferAll(containers[1]->entityID, player.entityID) == ZoneDriver::TransferResult::kSuccess);
+		TEST(zone0.getInventory(player).hasItem(key));
+		TEST(!s1->driver.getInventory(player).hasItem(key));
+
+		// A session spawned later still starts at the baseline.
+		std::unique_ptr<SessionTemplate::Session> s2 = tmpl.spawn();
+		TEST(!s2->driver.getInventory(player).hasItem(key));
+		TEST(s2->driver.currentRoom().entityID == s1->driver.currentRoom().entityID);
+		TEST(s2->assets.changedInventories().empty());
+	}
+	{
+		// Spawning at a start interaction doesn't run its code again: a session
+		// is the same as a game just started.
+		SessionTemplate gateTmpl("script/testzones.lua", "TEST_ZONE_3");
+		std::unique_ptr<SessionTemplate::Session> s = gateTmpl.spawn();
+
+		ScriptBridge bridge;
+		ConstScriptAssets csa = bridge.readCSA("script/testzones.lua");
+		ScriptAssets assets(csa);
+		ZoneDriver fresh(assets, bridge, "TEST_ZONE_3");
+
+		std::ostringstream spawnedCore, freshCore;
+		s->driver.mapData.coreData.save(spawnedCore);
+		fresh.mapData.coreData.save(freshCore);
+		TEST(spawnedCore.str() == freshCore.str());
+		TEST(s->driver.mapData.coreData.coreGet("player", "visits").second == Variant(1));
+		TEST(s->assets.changedInventories() == assets.changedInventories());
+		TEST(s->driver.mapData.random.rand() == fresh.mapData.random.rand());
+
+		ZoneDriver::Snapshot spawnedSnap = s->driver.snapshot();
+		ZoneDriver::Snapshot freshSnap = fresh.snapshot();
+		TEST(spawnedSnap.room.index == freshSnap.room.index);
+		TEST(spawnedSnap.script && freshSnap.script);
+		TEST(spawnedSnap.script->treeIndex == freshSnap.script->treeIndex);
+		TEST(spawnedSnap.script->textSubIndex == freshSnap.script->textSubIndex);
+		TEST(spawnedSnap.script->node == freshSnap.script->node);
+		TEST(spawnedSnap.script->choicesStack == freshSnap.script->choicesStack);
+		TEST(s->driver.mode() == ZoneDriver::Mode::kText);
+		TEST(s->driver.text().text == fresh.text().text);
+	}
+}
+
+static void TestBundle()
+{
+	const std::string gameFile = "game/chullu/chullu.lua";
+	std::filesystem::path bundlePath = std::filesystem::temp_directory_path() / "lurp_test_chullu.lurpb";
+	{
+		ScriptBridge bridge;
+		TEST(bridge.compileCSA(gameFile, bundlePath));
+	}
+	{
+		// The bundle depends on the files the game loads, and only those.
+		MappedFile file(bundlePath);
+		TEST(file.valid());
+		std::vector<std::string> files = Bundle::sourceFiles(file.data(), file.size());
+		TEST(files.size() == 3);
+		TEST(files[0] == "script/_map.lua");
+		TEST(files[1] == gameFile);
+		TEST(files[2] == "game/chullu/chullu.md");
+		ConstScriptAssets csa;
+		TEST(Bundle::read(file.data(), file.size(), csa));
+		TEST(!csa.funcs.empty());
+	}
+
+	ScriptBridge luaBridge;
+	ConstScriptAssets luaCSA = luaBridge.readCSA(gameFile, "does_not_exist.lurpb");
+
+	{
+		// Out of date bundles are rejected; changes to other files don't matter.
+		std::filesystem::path dir = std::filesystem::temp_directory_path();
+		const std::string source = (dir / "lurp_test_bundle_source.lua").string();
+		const std::string other = (dir / "lurp_test_bundle_other.lua").string();
+		std::filesystem::path stalePath = dir / "lurp_test_stale.lurpb";
+		auto writeFile = [](const std::string& path, const std::string& src) {
+			std::ofstream stream(path, std::ios::out | std::ios::binary);
+			stream << src;
+		};
+		auto readBundle = [&stalePath]() {
+			MappedFile file(stalePath);
+			ConstScriptAssets csa;
+			return file.valid() && Bundle::read(file.data(), file.size(), csa);
+		};
+		writeFile(source, "-- 1");
+		writeFile(other, "-- 1");
+		TEST(Bundle::write(stalePath, luaCSA, { source }));
+		TEST(readBundle());
+		writeFile(other, "-- 2");
+		TEST(readBundle());
+		writeFile(source, "-- 2");
+		TEST(!readBundle());
+
+		// An enum out of range is corrupt, even if the hash matches.
+		TEST(!luaCSA.edges.empty());
+		Edge::Dir edgeDir = luaCSA.edges[0].dir;
+		luaCSA.edges[0].dir = Edge::Dir(200);
+		TEST(Bundle::write(stalePath, luaCSA, { source }));
+		luaCSA.edges[0].dir = edgeDir;
+		TEST(!readBundle());
+
+		std::filesystem::remove(source);
+		std::filesystem::remove(other);
+		std::filesystem::remove(stalePath);
+	}
+
+	ScriptBridge bridge;
+	ConstScriptAssets csassets = bridge.readCSA(gameFile, bundlePath);
+
+	TEST(csassets.scripts.size() == luaCSA.scripts.size());
+	TEST(csassets.texts.size() == luaCSA.texts.size());
+	TEST(csassets.choices.size() == luaCSA.choices.size());
+	TEST(csassets.rooms.size() == luaCSA.rooms.size());
+	TEST(csassets.edges.size() == luaCSA.edges.size());
+	TEST(csassets.containers.size() == luaCSA.containers.size());
+	for (size_t i = 0; i < luaCSA.texts.size(); i++) {
+		TEST(csassets.texts[i].entityID == luaCSA.texts[i].entityID);
+		TEST(csassets.texts[i].lines.size() == luaCSA.texts[i].lines.size());
+	}
+	for (size_t i = 0; i < luaCSA.containers.size(); i++) {
+		TEST(csassets.containers[i].inventory.size() == luaCSA.containers[i].inventory.size());
+	}
+
+	// The functions need to work, too.
+	ScriptAssets assets(csassets);
+	ZoneDriver driver(assets, bridge, NO_ENTITY);
+	TEST(driver.currentRoom().name == "Your Apartment");
+	FlushText(driver);
+	TEST(driver.move("SF_CAFE") == ZoneDriver::MoveResult::kSuccess);
+	FlushText(driver);
+	TEST(driver.move("SF_LIBRARY") == ZoneDriver::MoveResult::kSuccess);
+	FlushText(driver);
+	TEST(driver.mode() == ZoneDriver::Mode::kChoices);	// "Steal it?"
+	TEST(driver.choices().choices.size() == 1);
+	driver.choose(0);
+	FlushText(driver);
+	TEST(driver.getInventory(driver.getPlayer()).numItems(assets.getItem("HAIRPIN")) == 1);
+
+	std::filesystem::remove(bundlePath);
+}
+
+static void TestChunkCache()
+{
+	ChunkCache& cache = ChunkCache::instance();
+	std::filesystem::path oldDir = cache.dir();
+	std::filesystem::path dir = SavePath("test", "luac", true, "");
+	std::filesystem::path file = std::filesystem::temp_directory_path() / "lurp_test_chunk.lua";
+	std::filesystem::remove_all(dir);
+	cache.setDir(dir);
+	cache.clear();
+
+	auto writeFile = [&file](const std::string& src) {
+		std::ofstream stream(file, std::ios::out | std::ios::binary);
+		stream << src;
+	};
+	// Runs the file, and returns the value it set. 'counter' is the change to check.
+	auto run = [&](int (ChunkCache::*counter)() const) {
+		ScriptBridge bridge;
+		int before = (cache.*counter)();
+		bridge.doFile(file.string());
+		TEST((cache.*counter)() == before + 1);
+
+		lua_State* L = bridge.getLuaState();
+		lua_getglobal(L, "ChunkValue");
+		int value = (int)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		return value;
+	};
+
+	writeFile("ChunkValue = 1");
+	TEST(run(&ChunkCache::numCompiled) == 1);
+	TEST(run(&ChunkCache::numMemoryHits) == 1);
+	cache.clear();
+	TEST(run(&ChunkCache::numDiskHits) == 1);
+
+	writeFile("ChunkValue = 22");
+	TEST(run(&ChunkCache::numCompiled) == 22);
+
+	// Touched, but not changed: the contents match.
+	cache.clear();
+	std::filesystem::last_write_time(file, std::filesystem::last_write_time(file) + std::chrono::hours(1));
+	int nCompiled = cache.numCompiled();
+	TEST(run(&ChunkCache::numDiskHits) == 22);
+	TEST(cache.numCompiled() == nCompiled);
+
+#ifndef _WIN32
+	// A directory others can write to isn't trusted.
+	cache.clear();
+	std::filesystem::permissions(dir, std::filesystem::perms::all);
+	TEST(run(&ChunkCache::numCompiled) == 22);
+#endif
+
+	cache.setDir(oldDir);
+	std::filesystem::remove(file);
+	std::filesystem::remove_all(dir);
+}
+
 int RunTests()
 {
 	RUN_TEST(BridgeWorkingTest());
@@ -1681,9 +2640,13 @@ int RunTests()
 	RUN_TEST(TestInventory2());
 	RUN_TEST(TestScriptAccess());
 	RUN_TEST(TestCodeEval());
+	RUN_TEST(TestVariant());
+	RUN_TEST(TestCoreData());
+	RUN_TEST(TestEvalCache());
 	RUN_TEST(TestBattle());
 	RUN_TEST(TestTextSubstitution());
 	RUN_TEST(TestTextTest());
+	RUN_TEST(TestTextRead());
 	RUN_TEST(CallScriptTest());
 	RUN_TEST(ChoiceMode1RepeatTest());
 	RUN_TEST(ChoiceMode1RewindTest());
@@ -1693,6 +2656,10 @@ int RunTests()
 	RUN_TEST(TestScriptSave());
 	RUN_TEST(TestScriptSaveMutated());
 	RUN_TEST(TestZoneSave());
+	RUN_TEST(TestBinarySave());
+	RUN_TEST(TestAutoSave());
+	RUN_TEST(TestJournal());
+	RUN_TEST(TestSnapshot());
 	RUN_TEST(TestWalkabout());
 	RUN_TEST(TestLuaCore());
 	RUN_TEST(TestContainers());
@@ -1710,6 +2677,13 @@ int RunTests()
 	RUN_TEST(TestChullu());
 	RUN_TEST(TestMarkDown());
 	RUN_TEST(TestLoadMarkDown());
+	RUN_TEST(TestEntityID());
+	RUN_TEST(TestGraph());
+	RUN_TEST(TestSharedAssets());
+	RUN_TEST(TestSessions());
+	RUN_TEST(TestSessionTemplate());
+	RUN_TEST(TestBundle());
+	RUN_TEST(TestChunkCache());
 
 	assert(gNTestPass > 0);
 	assert(gNTestFail == 0);
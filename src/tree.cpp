@@ -5,7 +5,7 @@
 
 namespace lurp {
 
-void walkTree(const ScriptAssets& assets, const EntityID& entityID, int depth, std::vector<NodeRef>& tree)
+void walkTree(const ConstScriptAssets& assets, const EntityID& entityID, int depth, std::vector<NodeRef>& tree)
 {
 	if (entityID.empty()) {
 		// happens when we create an empty script for loading.
@@ -30,33 +30,33 @@ void walkTree(const ScriptAssets& assets, const EntityID& entityID, int depth, s
 
 	switch (ref.type) {
 	case ScriptType::kScript: {
-		const Script& script = assets._csa.scripts[ref.index];
+		const Script& script = assets.scripts[ref.index];
 		for (const Script::Event& e : script.events) {
 			walkTree(assets, e.entityID, depth + 1, tree);
 		}
 		break;
 	}
 	case ScriptType::kChoices: {
-		const Choices& choices = assets._csa.choices[ref.index];
+		const Choices& choices = assets.choices[ref.index];
 		for (const Choices::Choice& c : choices.choices) {
 			walkTree(assets, c.next, depth + 1, tree);
 		}
 		break;
 	}
 	case ScriptType::kInteraction: {
-		const Interaction& interaction = assets._csa.interactions[ref.index];
+		const Interaction& interaction = assets.interactions[ref.index];
 		walkTree(assets, interaction.next, depth + 1, tree);
 		break;
 	}
 	case ScriptType::kZone: {
-		const Zone& zone = assets._csa.zones[ref.index];
+		const Zone& zone = assets.zones[ref.index];
 		for (const EntityID& e : zone.objects) {
 			walkTree(assets, e, depth + 1, tree);
 		}
 		break;
 	}
 	case ScriptType::kCallScript: {
-		const CallScript& callScript = assets._csa.callScripts[ref.index];
+		const CallScript& callScript = assets.callScripts[ref.index];
 		walkTree(assets, callScript.scriptID, depth + 1, tree);
 		break;
 	}
@@ -74,16 +74,71 @@ void walkTree(const ScriptAssets& assets, const EntityID& entityID, int depth, s
 	tree.push_back({ ref, entityID, depth, false });
 }
 
-std::vector<NodeRef> createTree(const ScriptAssets& assets, const EntityID& scriptID)
+std::vector<NodeRef> createTree(const ConstScriptAssets& assets, const EntityID& scriptID)
 {
 	std::vector<NodeRef> tree;
 	walkTree(assets, scriptID, 0, tree);
 	return tree;
 }
 
-Tree::Tree(const ScriptAssets& assets, const EntityID& entityID)
+Tree::Tree(const ConstScriptAssets& assets, const EntityID& entityID)
 {
 	_tree = createTree(assets, entityID);
+	buildTables();
+}
+
+void Tree::clear()
+{
+	_tree.clear();
+	_match.clear();
+	_parent.clear();
+	_childStart.clear();
+	_children.clear();
+	_find.clear();
+}
+
+void Tree::buildTables()
+{
+	const int n = size();
+	_match.assign(n, -1);
+	_parent.assign(n, -1);
+	_childStart.assign(n, 0);
+	_children.clear();
+	_children.reserve(n / 2);
+	_find.clear();
+
+	// Children are contiguous when grouped by parent. Count, then fill.
+	std::vector<int> nChildren(n, 0);
+	std::vector<int> open;
+	for (int i = 0; i < n; i++) {
+		if (_tree[i].leading) {
+			_parent[i] = open.empty() ? -1 : open.back();
+			if (_parent[i] >= 0) nChildren[_parent[i]]++;
+			_find.emplace(_tree[i].entityID, i);
+			open.push_back(i);
+		}
+		else {
+			assert(!open.empty() && _tree[open.back()].depth == _tree[i].depth);
+			int le = open.back();
+			open.pop_back();
+			_match[le] = i;
+			_match[i] = le;
+			_parent[i] = _parent[le];
+		}
+	}
+	assert(open.empty());
+
+	int offset = 0;
+	for (int i = 0; i < n; i++) {
+		_childStart[i] = offset;
+		offset += nChildren[i];
+	}
+	_children.resize(offset);
+	std::vector<int> fill = _childStart;
+	for (int i = 0; i < n; i++) {
+		if (_tree[i].leading && _parent[i] >= 0)
+			_children[fill[_parent[i]]++] = i;
+	}
 }
 
 void Tree::log() const
@@ -107,12 +162,12 @@ void Tree::write(std::ostream& stream) const
 ScriptRef TreeIt::next()
 {
 	_index++;
-	return _index < _tree.size() ? _tree._tree[_index].ref : ScriptRef();
+	return _index < _tree->size() ? _tree->_tree[_index].ref : ScriptRef();
 }
 
 bool TreeIt::done() const
 {
-	return _index >= _tree.size();
+	return _index >= _tree->size();
 }
 
 void Tree::dump(const ScriptAssets& assets) const
@@ -128,22 +183,13 @@ void Tree::dump(const ScriptAssets& assets) const
 
 void TreeIt::rewindLE()
 {
-	int depth = cDepth(_index);
-	while (true) {
-		if (_tree._tree[_index].depth == depth && _tree._tree[_index].leading == true)
-			break;
-		_index--;
-	}
+	_index = _tree->leIndex(_index);
 }
 
 void TreeIt::forwardTE()
 {
-	int depth = cDepth(_index);
-	while (true) {
-		if (_tree._tree[_index].depth == depth && _tree._tree[_index].leading == false)
-			break;
-		_index++;
-	}
+	if (_tree->_tree[_index].leading)
+		_index = _tree->_match[_index];
 }
 
 void TreeIt::firstSibLE()
@@ -161,7 +207,7 @@ void TreeIt::lastSibTE()
 {
 	int depth = cDepth(_index);
 	if (depth == 0) {
-		_index = (int)(_tree.size() - 1);
+		_index = (int)(_tree->size() - 1);
 		return;
 	}
 	parentTE();
@@ -170,83 +216,57 @@ void TreeIt::lastSibTE()
 
 void TreeIt::parentTE()
 {
-	_index = _tree.getParentTE(_index);
+	_index = _tree->getParentTE(_index);
 }
 
 void TreeIt::parentLE()
 {
-	_index = _tree.getParentLE(_index);
+	_index = _tree->getParentLE(_index);
 }
 
 int Tree::getParentTE(int index) const
 {
-	int depth = cDepth(index);
-	if (depth == 0) {
+	int parent = _parent[index];
+	if (parent < 0) {
 		return (int)_tree.size() - 1;
 	}
-	while (true) {
-		if (_tree[index].depth == depth - 1 && _tree[index].leading == false)
-			break;
-		index++;
-	}
-	return index;
+	return _match[parent];
 }
 
 int Tree::getParentLE(int index) const
 {
-	int depth = cDepth(index);
-	if (depth == 0) {
-		return 0;
-	}
-	while (true) {
-		if (_tree[index].depth == depth - 1 && _tree[index].leading == true)
-			break;
-		index--;
-	}
-	return index;
+	int parent = _parent[index];
+	return parent < 0 ? 0 : parent;
 }
 
-void TreeIt::childLE(int n)
+int Tree::numChildren(int index) const
 {
-	int depth = cDepth(_index);
-	rewindLE();
-	assert(cDepth(_index) == depth);
-	while (true) {
-		if (_tree._tree[_index].depth == depth + 1 && _tree._tree[_index].leading == true) {
-			if (n == 0)
-				return;
-			n--;
-		}
-		_index++;
-	}
+	int le = leIndex(index);
+	int end = le + 1 < size() ? _childStart[le + 1] : (int)_children.size();
+	return end - _childStart[le];
 }
 
-int Tree::getNodeTE(int index) const
+int Tree::getChildLE(int index, int n) const
 {
-	assert(_tree[index].leading == true);
-	int depth = cDepth(index);
-	while (true) {
-		if (_tree[index].depth == depth && _tree[index].leading == false)
-			break;
-		index++;
-	}
-	return index;
+	assert(n >= 0 && n < numChildren(index));
+	return _children[_childStart[leIndex(index)] + n];
 }
 
+void TreeIt::childLE(int n)
+{
+	_index = _tree->getChildLE(_index, n);
+}
 
 ScriptRef TreeIt::getParent() const
 {
-	int index = _tree.getParentTE(_index);
-	return _tree.get(index);
+	int index = _tree->getParentTE(_index);
+	return _tree->get(index);
 }
 
 int Tree::find(const EntityID& entityID) const
 {
-	for (int i = 0; i < (int)_tree.size(); i++) {
-		if (_tree[i].entityID == entityID)
-			return i;
-	}
-	return -1;	
+	auto it = _find.find(entityID);
+	return it == _find.end() ? -1 : it->second;
 }
 
 } // namespace lurp
@@ -4,10 +4,12 @@
 
 #include <assert.h>
 #include <vector>
+#include <unordered_map>
 
 namespace lurp {
 
 struct ScriptAssets;
+struct ConstScriptAssets;
 class TreeIt;
 
 struct NodeRef {
@@ -19,22 +21,27 @@ struct NodeRef {
 
 using TreeVec = std::vector<NodeRef>;
 
-TreeVec createTree(const ScriptAssets& assets, const EntityID& entityID);
+TreeVec createTree(const ConstScriptAssets& assets, const EntityID& entityID);
 
 class Tree {
 	friend TreeIt;
 public:
-	Tree(const ScriptAssets& assets, const EntityID& entityID);
+	Tree() = default;
+	Tree(const ConstScriptAssets& assets, const EntityID& entityID);
 
 	const TreeVec& tree() const { return _tree; }
-	void clear() { _tree.clear(); }
+	void clear();
 	void dump(const ScriptAssets& assets) const;
 
 	int size() const { return (int)_tree.size(); }
 
-	int getNodeTE(int index) const;	// given the LE, return TE index
+	// Navigation is O(1); the tables are built with the tree.
+	int getNodeTE(int index) const { assert(_tree[index].leading); return _match[index]; }	// given the LE, return TE index
+	int getNodeLE(int index) const { assert(!_tree[index].leading); return _match[index]; }	// given the TE, return LE index
 	int getParentTE(int index) const;
 	int getParentLE(int index) const;
+	int numChildren(int index) const;	// of the node at index (LE or TE)
+	int getChildLE(int index, int n) const;
 
 	ScriptRef get(int index) const { assert(index >= 0 && index < size()); return _tree[index].ref; }
 	NodeRef getNode(int index) const { assert(index >= 0 && index < size());  return _tree[index]; }
@@ -44,17 +51,25 @@ public:
 	void write(std::ostream& stream) const;
 
 private:
+	void buildTables();
 	int cDepth(int index) const { return _tree[index].depth; }
+	int leIndex(int index) const { return _tree[index].leading ? index : _match[index]; }
+
 	TreeVec _tree;
+	std::vector<int> _match;		// LE <-> TE of the same node
+	std::vector<int> _parent;		// LE of the parent, or -1 at the root
+	std::vector<int> _childStart;	// by LE: offset of the first child in _children
+	std::vector<int> _children;		// LE of the children of each node, contiguous
+	std::unordered_map<EntityID, int> _find;	// LE of the first node with the entityID
 };
 
 class TreeIt {
 public:
-	TreeIt(const Tree& tree) : _tree(tree) {}
+	TreeIt(const Tree& tree) : _tree(&tree) {}
 
-	ScriptRef get() const { return _tree.get(_index); }
+	ScriptRef get() const { return _tree->get(_index); }
 	ScriptRef getParent() const;
-	NodeRef getNode() const { return _tree.getNode(_index); }
+	NodeRef getNode() const { return _tree->getNode(_index); }
 
 	ScriptRef next();
 	bool done() const;
@@ -70,9 +85,9 @@ public:
 	int index() const { return _index; }
 	void setIndex(int i) { _index = i; }
 private:
-	int cDepth(int index) const { return _tree._tree[index].depth; }
+	int cDepth(int index) const { return _tree->_tree[index].depth; }
 
-	const Tree& _tree;
+	const Tree* _tree;
 	int _index = 0;
 };
 
@@ -8,6 +8,7 @@
 #include <unordered_set>
 #include <queue>
 #include <mutex>
+#include <memory>
 
 namespace lurp {
 
@@ -131,6 +132,15 @@ T clamp(T value, T min, T max) {
 	return value;
 }
 
+// Copy-on-write: returns the object for writing, first copying it if it is
+// shared (with a snapshot.) Single threaded only.
+template <typename T>
+T& CowWrite(std::shared_ptr<T>& p) {
+	if (!p) p = std::make_shared<T>();
+	else if (p.use_count() > 1) p = std::make_shared<T>(*p);
+	return *p;
+}
+
 uint64_t Hash(const std::string& a, const std::string& b = "", const std::string& c = "", const std::string& d = "");
 
 // NOTE: checks if value is in [low, high)
@@ -14,44 +14,44 @@ VarBinder::~VarBinder()
 {
 }
 
-// This is the read-only fallback to the lua script.
-std::string VarBinder::pushPath(const std::string& path) const
+// This is the read-only fallback to the lua script. Pushes the table that
+// holds the last key.
+void VarBinder::pushPath(const VarPath& path) const
 {
 	lua_State* L = _bridge.getLuaState();
 	ScriptBridge::LuaStackCheck check(L, 1);
 
-	std::vector<std::string_view> parts = splitSV(path, '.');
-	assert(parts.size() > 0);
-
-    for (int i = 0; i<int(parts.size()) - 1; i++) {
-        const auto& part = parts[i];
-        std::string p(part);
-        if (i == 0) {
-            // i == 0 is an Entity
-            // But is it referenced by entityID or a special value?
-            // Check the EntityID first, then drop back to the 'specials'
-            _bridge.pushGlobal("Entities");
-            lua_pushstring(L, p.c_str());
-            lua_gettable(L, -2);
-            lua_remove(L, -2);
-            
-            if (lua_type(L, -1) == LUA_TTABLE) {
-                // we got a lua table from the Entities table - good to go.
-            }
-            else {
-                // See if it refers to a special, named entity? (script, player, npc, etc.)
-                lua_pop(L, 1);
-                _bridge.pushGlobal(p);
-            }
-            bool isCoreTable = _bridge.getBoolField("_isCoreTable", { false });
-            if (!isCoreTable) {
-                PLOG(plog::debug) << "pushPath() trying to read " << p << " and it is not a CoreTable";
-            }
-        }
-        else {
-            _bridge.pushTable(p);
-        }
-    }
+	const std::vector<std::string>& parts = path.keys;
+	assert(parts.size() > 1);
+
+	for (int i = 0; i<int(parts.size()) - 1; i++) {
+		const std::string& p = parts[i];
+		if (i == 0) {
+			// i == 0 is an Entity
+			// But is it referenced by entityID or a special value?
+			// Check the EntityID first, then drop back to the 'specials'
+			_bridge.pushGlobal("Entities");
+			lua_pushstring(L, p.c_str());
+			lua_gettable(L, -2);
+			lua_remove(L, -2);
+
+			if (lua_type(L, -1) == LUA_TTABLE) {
+				// we got a lua table from the Entities table - good to go.
+			}
+			else {
+				// See if it refers to a special, named entity? (script, player, npc, etc.)
+				lua_pop(L, 1);
+				_bridge.pushGlobal(p);
+			}
+			bool isCoreTable = _bridge.getBoolField("_isCoreTable", { false });
+			if (!isCoreTable) {
+				PLOG(plog::debug) << "pushPath() trying to read " << p << " and it is not a CoreTable";
+			}
+		}
+		else {
+			_bridge.pushTable(p);
+		}
+	}
 
 	// we only need the final table. everything else can come off the stack
 	// ex: npc.subDesc.accessory
@@ -63,132 +63,124 @@ std::string VarBinder::pushPath(const std::string& path) const
 		lua_remove(L, -2);
 	}
 	assert(lua_type(L, -1) == LUA_TTABLE);
-	return parts.empty() ? std::string("") : std::string(parts.back());
 }
 
-void VarBinder::corePath(const std::string& in, EntityID& entityID, std::string& path) const
+Variant VarBinder::get(const VarPath& path) const
 {
-	entityID.clear();
-	path.clear();
-
-	size_t pos = in.find('.');
-	if (pos == std::string::npos) {
-		assert(false); // not sure how this would happen
-		return;
+	EntityID entity = path.resolve(_env);
+	if (entity.empty() || path.var.empty()) {
+		assert(false);	// not sure how this would happen
+		return Variant();
 	}
 
-	std::string first = in.substr(0, pos);
-	// VarBinder can't do the substitutions:
-	assert(first != "script");
-	//assert(first != "player");	// player often called "player". oops.
-	assert(first != "npc");
-	assert(first != "zone");
-	assert(first != "room");
-
-	entityID = first;
-	path = in.substr(pos + 1);
-}
-
-Variant VarBinder::get(const std::string& in) const
-{
-	std::string path = evalPath(_env, in);
-	EntityID entity;
-	std::string var;
-	corePath(path, entity, var);
-
 	// 1. const var on the entity
 	if (_assets.isAsset(entity)) {
 		const Entity* e = _assets.get(entity);
-		std::pair<bool, Variant> p = e->getVar(var);
+		std::pair<bool, Variant> p = e->getVar(path.varID);
 		if (p.first) {
-			PLOG(plog::debug) << fmt::format("Entity get{}.{} -> {}", entity, var, p.second.toLuaString());
+			PLOG(plog::debug) << fmt::format("Entity get{}.{} -> {}", entity, path.var, p.second.toLuaString());
 			return p.second;
 		}
 	}
 
 	// 2. core data
-	std::pair<bool, Variant> p = _coreData.coreGet(entity, var);
+	std::pair<bool, Variant> p = _coreData.coreGetInterned(entity, path.varID);
 	if (p.first) {
-		PLOG(plog::debug) << fmt::format("CoreData get{}.{} -> {}", entity, var, p.second.toLuaString());
+		PLOG(plog::debug) << fmt::format("CoreData get{}.{} -> {}", entity, path.var, p.second.toLuaString());
 		return p.second;
 	}
 
-	// 3. lua script
+	// 3. lua script. Writes go to the CoreData, so this is the immutable
+	// source data, and the result (even nil) can be cached. Except for the
+	// 'script' table, which is a different table for each script.
+	const bool cacheable = path.slot != VarPath::Slot::kScript;
+	uint64_t key = (uint64_t(entity.handle()) << 32) | path.varID.handle();
+	ScriptBridge::VarCache& cache = _bridge.varCache();
+	if (cacheable) {
+		auto it = cache.find(key);
+		if (it != cache.end())
+			return it->second;
+	}
+
 	lua_State* L = _bridge.getLuaState();
 	ScriptBridge::LuaStackCheck check(L);
 
-	std::string key = pushPath(in);
-	Variant v = ScriptBridge::getField(L, key, -1, true);
+	pushPath(path);
+	Variant v = ScriptBridge::getField(L, path.keys.back(), -1, true);
 	lua_pop(L, 1);
-	PLOG(plog::debug) << fmt::format("Lua get {}.{} -> {}", entity, var, v.toLuaString());
+	PLOG(plog::debug) << fmt::format("Lua get {}.{} -> {}", entity, path.var, v.toLuaString());
+	if (cacheable)
+		cache.emplace(key, v);
 	return v;
 }
 
-void VarBinder::set(const std::string& in, const Variant& v) const
+void VarBinder::set(const VarPath& path, const Variant& v) const
 {
-	std::string path = evalPath(_env, in);
-
-	EntityID entity;
-	std::string var;
-	corePath(path, entity, var);
+	EntityID entity = path.resolve(_env);
+	if (entity.empty() || path.var.empty()) {
+		assert(false);
+		return;
+	}
 
 	// 1. const var on the entity
 	if (_assets.isAsset(entity)) {
 		const Entity* e = _assets.get(entity);
-		std::pair<bool, Variant> p = e->getVar(var);
+		std::pair<bool, Variant> p = e->getVar(path.varID);
 		// Can't set immutable data.
 		if (p.first)
 			return;
 	}
 
 	// 2. core data
-	_coreData.coreSet(entity, var, v, false);
-	PLOG(plog::debug) << fmt::format("CoreData set {}.{} = {}", entity, var, v.toLuaString());
+	_coreData.coreSet(entity, path.var, v, false);
+	PLOG(plog::debug) << fmt::format("CoreData set {}.{} = {}", entity, path.var, v.toLuaString());
 }
 
-std::string VarBinder::evalPath(const ScriptEnv& env, const std::string& in) const
+VarPath::VarPath(const std::string& in) : path(in)
 {
 	size_t pos = in.find('.');
 	if (pos == std::string::npos) {
 		assert(false); // not sure how this would happen
-		return in;
+		return;
 	}
 
 	std::string first = in.substr(0, pos);
-	if (first == "script") {
-		// Note we don't use the actual name of the script, because scripts
-		// can call other scripts and what a mess. Use the special magic name.
-		first = std::string(_SCRIPTENV);
-	}
-//	else if (first == "player") {
-//		if (env.player.empty()) {
-//			PLOG(plog::warning) << "Attempt to access player variable '" << in << "' with no " << first;
-//			assert(false);
-//		}
-//		first = env.player;
-//	}
-	else if (first == "npc") {
-		if (env.npc.empty()) {
-			PLOG(plog::warning) << "Attempt to access player variable '" << in << "' with no " << first;
-			assert(false);
-		}
-		first = env.npc;
-	}
-	else if (first == "zone") {
-		if (env.zone.empty()) {
-			PLOG(plog::warning) << "Attempt to access player variable '" << in << "' with no " << first;
-			assert(false);
-		}
-		first = env.zone;
+	// Note we don't use the actual name of the script, because scripts
+	// can call other scripts and what a mess. Use the special magic name.
+	if (first == "script") slot = Slot::kScript;
+	else if (first == "npc") slot = Slot::kNpc;
+	else if (first == "zone") slot = Slot::kZone;
+	else if (first == "room") slot = Slot::kRoom;
+	else entity = EntityID(first);
+	// "player" is an entityID.
+
+	var = in.substr(pos + 1);
+	varID = EntityID(var);
+	for (std::string_view part : splitSV(in, '.'))
+		keys.emplace_back(part);
+}
+
+VarPath::VarPath(const EntityID& e, const std::string& v) : path(e.str() + "." + v), entity(e), var(v), varID(v)
+{
+	keys = { e.str(), v };
+}
+
+EntityID VarPath::resolve(const ScriptEnv& env) const
+{
+	static const EntityID scriptEnv(_SCRIPTENV);
+	const EntityID* e = &entity;
+	switch (slot) {
+	case Slot::kEntity: return entity;
+	case Slot::kScript: return scriptEnv;
+	case Slot::kNpc: e = &env.npc; break;
+	case Slot::kZone: e = &env.zone; break;
+	case Slot::kRoom: e = &env.room; break;
 	}
-	else if (first == "room") {
-		if (env.room.empty()) {
-			PLOG(plog::warning) << "Attempt to access player variable '" << in << "' with no " << first;
-			assert(false);
-		}
-		first = env.room;
+	if (e->empty()) {
+		PLOG(plog::warning) << "Attempt to access variable '" << path << "' with no " << keys[0];
+		assert(false);
 	}
-	return first + "." + in.substr(pos + 1);
+	return *e;
 }
 
 } // namespace lurp
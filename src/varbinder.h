@@ -1,6 +1,7 @@
 #pragma once
 
 #include "scripttypes.h"
+#include "varpath.h"
 
 #include <vector>
 #include <string>
@@ -20,6 +21,10 @@ struct ScriptEnv;
 // Still digging out some old code paths - everything should go
 // through the VarBinder.
 //
+// Paths that are used often should be compiled (VarPath) once. The Lua
+// fallback results, including misses, are cached in the ScriptBridge
+// (see ScriptBridge::varCache()).
+//
 class VarBinder
 {
 public:
@@ -31,20 +36,20 @@ public:
 									// Can be the default object, but then no substitution is possible.
 	~VarBinder();
 
-	Variant get(const std::string& path) const;
+	Variant get(const VarPath& path) const;
+	Variant get(const std::string& path) const { return get(VarPath(path)); }
 	Variant get(const std::string& path, const std::string& var) const {
 		return get(path + "." + var);
 	}
 
-	void set(const std::string& path, const Variant& value) const;
+	void set(const VarPath& path, const Variant& value) const;
+	void set(const std::string& path, const Variant& value) const { set(VarPath(path), value); }
 	void set(const std::string& path, const std::string& var, const Variant& value) const {
 		return set(path + "." + var, value);
 	}
 
 private:
-	std::string pushPath(const std::string& path) const;
-	void corePath(const std::string& in, EntityID& entityID, std::string& path) const;
-	std::string evalPath(const ScriptEnv& env, const std::string& in) const;
+	void pushPath(const VarPath& path) const;
 
 	const ScriptAssets& _assets;
 	ScriptBridge& _bridge;
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "defs.h"
+
+#include <string>
+#include <vector>
+
+namespace lurp {
+
+// A variable path, like "npc.subDesc.accessory", parsed once so VarBinder
+// doesn't have to split and concatenate strings on every access.
+//
+// The first part is the entity: an EntityID, or one of the ScriptEnv names
+// (script, npc, zone, room), which is resolved when the path is used. 'var'
+// is the rest of the path; it is the key for the entity's const vars and
+// CoreData. 'keys' is the whole path split for the Lua fallback.
+struct VarPath {
+	enum class Slot {
+		kEntity,
+		kScript,
+		kNpc,
+		kZone,
+		kRoom,
+	};
+
+	VarPath() = default;
+	explicit VarPath(const std::string& path);
+	VarPath(const EntityID& entity, const std::string& var);
+
+	bool empty() const { return path.empty(); }
+	// The entity the path starts at, in the given environment.
+	EntityID resolve(const ScriptEnv& env) const;
+
+	std::string path;	// as written
+	Slot slot = Slot::kEntity;
+	EntityID entity;	// if slot == kEntity
+	std::string var;
+	EntityID varID;		// 'var', interned for CoreData
+	std::vector<std::string> keys;
+};
+
+} // namespace lurp
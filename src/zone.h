@@ -24,10 +24,13 @@ struct Container : Entity {
 		return fmt::format("Container {} {}", entityID, name);
 	};
 
-	virtual std::pair<bool, Variant> getVar(const std::string& k) const override {
-		if (k == "name") return { true, Variant(name) };
-		if (k == "key") return { true, Variant(key) };
-		return { false ,Variant() };
+	virtual const FieldTable& fields() const override {
+		static constexpr EntityField kFields[] = {
+			{ "name", FieldValue<&Container::name> },
+			{ "key", FieldValue<&Container::key> },
+		};
+		static const FieldTable table(kFields);
+		return table;
 	}
 
 	virtual ScriptType getType() const override {
@@ -61,14 +64,17 @@ struct Edge : Entity {
 		return fmt::format("Edge {}   {} <-> {}", name, room1, room2);
 	};
 
-	virtual std::pair<bool, Variant> getVar(const std::string& k) const override {
-		if (k == "name") return { true, Variant(name) };
-		if (k == "dir") return { true, Variant(dirToShortName(dir)) };
-		if (k == "room1") return { true, Variant(room1) };
-		if (k == "room2") return { true, Variant(room2) };
-		if (k == "key") return { true, Variant(key) };
-		if (k == "locked") return { true, Variant()};	// the original value is never the desired value
-		return { false, Variant() };
+	virtual const FieldTable& fields() const override {
+		static constexpr EntityField kFields[] = {
+			{ "name", FieldValue<&Edge::name> },
+			{ "dir", [](const Entity& e) { return Variant(dirToShortName(static_cast<const Edge&>(e).dir)); } },
+			{ "room1", FieldValue<&Edge::room1> },
+			{ "room2", FieldValue<&Edge::room2> },
+			{ "key", FieldValue<&Edge::key> },
+			{ "locked", [](const Entity&) { return Variant(); } },	// the original value is never the desired value
+		};
+		static const FieldTable table(kFields);
+		return table;
 	}
 
 	virtual ScriptType getType() const override {
@@ -102,10 +108,13 @@ struct Room : Entity {
 		return fmt::format("Room {} {}", entityID, name);
 	};
 
-	virtual std::pair<bool, Variant> getVar(const std::string& k) const override {
-		if (k == "name") return { true, Variant(name) };
-		if (k == "desc") return { true, Variant(desc) };
-		return { false, Variant() };
+	virtual const FieldTable& fields() const override {
+		static constexpr EntityField kFields[] = {
+			{ "name", FieldValue<&Room::name> },
+			{ "desc", FieldValue<&Room::desc> },
+		};
+		static const FieldTable table(kFields);
+		return table;
 	}
 
 	virtual ScriptType getType() const override {
@@ -126,9 +135,7 @@ struct Zone : Entity {
 		return fmt::format("Zone name: {}", entityID);
 	}
 
-	virtual std::pair<bool, Variant> getVar(const std::string&) const override {
-		return { false, Variant() };
-	};
+	virtual const FieldTable& fields() const override { return FieldTable::empty(); }
 
 	virtual ScriptType getType() const override {
 		return type;
@@ -151,12 +158,15 @@ struct Interaction : Entity {
 		return fmt::format("Interaction entityID: {} '{}'", entityID, name);
 	}
 
-	virtual std::pair<bool, Variant> getVar(const std::string& k) const override {
-		if (k == "name") return { true, Variant(name) };
-		if (k == "next") return { true, Variant(next) };
-		if (k == "npc") return { true, Variant(npc) };
-		if (k == "required") return { true, Variant(required) };
-		return { false, Variant() };
+	virtual const FieldTable& fields() const override {
+		static constexpr EntityField kFields[] = {
+			{ "name", FieldValue<&Interaction::name> },
+			{ "next", FieldValue<&Interaction::next> },
+			{ "npc", FieldValue<&Interaction::npc> },
+			{ "required", FieldValue<&Interaction::required> },
+		};
+		static const FieldTable table(kFields);
+		return table;
 	}
 
 	virtual ScriptType getType() const override {
@@ -182,10 +192,13 @@ struct CallScript : Entity {
 		return fmt::format("CallScript entityID: {} npc={} scriptID={}", entityID, npc, scriptID);
 	}
 
-	virtual std::pair<bool, Variant> getVar(const std::string& k) const override {
-		if (k == "scriptID") return { true, Variant(scriptID) };
-		if (k == "npc") return { true, Variant(npc) };
-		return { false, Variant() };
+	virtual const FieldTable& fields() const override {
+		static constexpr EntityField kFields[] = {
+			{ "scriptID", FieldValue<&CallScript::scriptID> },
+			{ "npc", FieldValue<&CallScript::npc> },
+		};
+		static const FieldTable table(kFields);
+		return table;
 	}
 
 	virtual ScriptType getType() const override {
@@ -1,16 +1,40 @@
 #include <assert.h>
 #include <algorithm>
+#include <utility>
+#include <optional>
 #include <fmt/core.h>
 #include <fmt/ostream.h>
+#include <plog/Log.h>
 
 #include "zonedriver.h"
 #include "items.h"
 #include "scriptasset.h"
 #include "scripthelper.h"
 #include "scriptbridge.h"
+#include "binio.h"
+#include "autosave.h"
 
 namespace lurp {
 
+class ZoneDriver::EvalScope {
+public:
+	EvalScope(ZoneDriver& driver) : _driver(driver) {}
+
+	bool eval(int func) {
+		if (func < 0) return true;
+		if (!_helper) {
+			_env = { NO_ENTITY, _driver.zoneID(), _driver.roomID(), NO_ENTITY };
+			_helper.emplace(_driver._bridge, _driver.mapData.coreData, _env);
+		}
+		return _helper->call(func, 1);
+	}
+
+private:
+	ZoneDriver& _driver;
+	ScriptEnv _env;
+	std::optional<ScriptHelper> _helper;
+};
+
 ZoneDriver::ZoneDriver(ScriptAssets& assets, ScriptBridge& bridge, const EntityID& zone) 
 	: _assets(assets), _bridge(bridge), mapData(MapData::kSeed)
 {
@@ -21,6 +45,15 @@ ZoneDriver::ZoneDriver(ScriptAssets& assets, ScriptBridge& bridge, const EntityI
 	checkScriptDriver();
 }
 
+ZoneDriver::ZoneDriver(ScriptAssets& assets, ScriptBridge& bridge, const Snapshot& start)
+	: _assets(assets), _bridge(bridge), mapData(MapData::kSeed)
+{
+	_bridge.setIMap(this);
+	_bridge.setIAsset(&assets);
+	_bridge.setICore(&mapData.coreData);
+	restore(start);
+}
+
 ZoneDriver::~ZoneDriver()
 {
 	_scriptDriver.reset(nullptr);
@@ -31,10 +64,10 @@ ZoneDriver::~ZoneDriver()
 
 const Container* ZoneDriver::getContainer(const EntityID& id)
 {
-	for (const Container& c : _assets._csa.containers) {
-		if (c.entityID == id) return &c;
-	}
-	return nullptr;
+	if (!_assets.isAsset(id)) return nullptr;
+	ScriptRef ref = _assets.getScriptRef(id);
+	if (ref.type != ScriptType::kContainer) return nullptr;
+	return &_assets._csa.containers[ref.index];
 }
 
 void ZoneDriver::setZone(const EntityID& cz, EntityID room)
@@ -79,9 +112,10 @@ std::vector<Edge> ZoneDriver::edges(EntityID room) const
 		room = _assets._csa.rooms[_room.index].entityID;
 
 	std::vector<Edge> result;
-	std::copy_if(_assets._csa.edges.begin(), _assets._csa.edges.end(), std::back_inserter(result), [&](const Edge& e) {
-		return e.room1 == room || e.room2 == room;
-	});
+	const auto range = _assets._csa.roomGraph().adjacent(room);
+	for (auto it = range.first; it != range.second; ++it) {
+		result.push_back(_assets._csa.edges[it->edge.edge]);
+	}
 	return result;
 }
 
@@ -91,18 +125,10 @@ std::vector<DirEdge> ZoneDriver::dirEdges(EntityID room) const
 		room = _assets._csa.rooms[_room.index].entityID;
 
 	std::vector<DirEdge> result;
-	for (const Edge& e : _assets._csa.edges) {
-		bool found = false;
-		bool flip = false;
-		if (e.room1 == room) {
-			found = true;
-			flip = false;
-		}
-		else if (e.room2 == room) {
-			found = true;
-			flip = true;
-		}
-		if (!found) continue;
+	const auto range = _assets._csa.roomGraph().adjacent(room);
+	for (auto it = range.first; it != range.second; ++it) {
+		const Edge& e = _assets._csa.edges[it->edge.edge];
+		const bool flip = it->edge.flip;
 
 		DirEdge de;
 		de.entityID = e.entityID;
@@ -112,7 +138,7 @@ std::vector<DirEdge> ZoneDriver::dirEdges(EntityID room) const
 			de.dirShort = Edge::dirToShortName(de.dir);
 			de.dirLong = Edge::dirToLongName(de.dir);
 		}
-		de.dstRoom = flip ? e.room1 : e.room2;
+		de.dstRoom = it->node1;
 		de.locked = mapData.coreData.coreBool(e.entityID, "locked", e.locked);
 		de.key = e.key;
 		result.push_back(de);
@@ -156,33 +182,23 @@ ContainerVec ZoneDriver::getContainers(EntityID room)
 
 	const std::vector<EntityID>& eArr = this->entities(room);
 	ContainerVec result;
+	EvalScope scope(*this);
 	for (const auto& e : eArr) {
 		ScriptRef ref = _assets.getScriptRef(e);
 		if (ref.type == ScriptType::kContainer) {
 			const Container& c = _assets._csa.containers[ref.index];
-			bool eval = true;
-
-			ScriptEnv env = { NO_ENTITY, zoneID(), roomID(), NO_ENTITY };
-			ScriptHelper helper(_bridge, mapData.coreData, env);
-			eval = helper.call(c.eval, 1);
-\
-			if (eval)
+			if (scope.eval(c.eval))
 				result.push_back(&c);
 		}
 	}
 	return result;
 }
 
-bool ZoneDriver::filterInteraction(const Interaction& i)
+bool ZoneDriver::filterInteraction(const Interaction& i, EvalScope& scope)
 {
 	// This should only be at the zone level - no ScriptDriver
 	assert(!_scriptDriver.get());
-
-	bool eval = true;
-	ScriptEnv env = { NO_ENTITY, zoneID(), roomID(), NO_ENTITY };
-	ScriptHelper helper(_bridge, mapData.coreData, env);
-	eval = helper.call(i.eval, 1);
-	return eval;
+	return scope.eval(i.eval);
 }
 
 InteractionVec ZoneDriver::getInteractions(EntityID room)
@@ -192,12 +208,13 @@ InteractionVec ZoneDriver::getInteractions(EntityID room)
 
 	const std::vector<EntityID>& eArr = this->entities(room);
 	InteractionVec result;
+	EvalScope scope(*this);
 	for (const auto& e : eArr) {
 		ScriptRef ref = _assets.getScriptRef(e);
 		if (ref.type == ScriptType::kInteraction) {
 			const Interaction* iact = &_assets._csa.interactions[ref.index];
 			bool done = mapData.coreData.coreBool(iact->entityID, "done", false);
-			if (iact->active(done) && filterInteraction(*iact)) {
+			if (iact->active(done) && filterInteraction(*iact, scope)) {
 				result.push_back(iact);
 			}
 		}
@@ -209,12 +226,13 @@ const Interaction* ZoneDriver::getRequiredInteraction()
 {
 	EntityID roomID = _assets._csa.rooms[_room.index].entityID;
 	const std::vector<EntityID>& eArr = this->entities(roomID);
+	EvalScope scope(*this);
 	for (const auto& e : eArr) {
 		ScriptRef ref = _assets.getScriptRef(e);
 		if (ref.type == ScriptType::kInteraction) {
 			const Interaction* iact = &_assets._csa.interactions[ref.index];
 			bool done = mapData.coreData.coreBool(iact->entityID, "done", false);
-			if (iact->required && iact->active(done) && filterInteraction(*iact))
+			if (iact->required && iact->active(done) && filterInteraction(*iact, scope))
 				return iact;
 		}
 	}
@@ -271,27 +289,13 @@ void ZoneDriver::teleport(const EntityID& room)
 	_room = _assets.getScriptRef(room);
 	assert(_room.type == ScriptType::kRoom);
 	
-	const Zone& zone = _assets._csa.zones[_zone.index];
-
-	for (size_t i = 0; i < zone.objects.size(); ++i) {
-		if (zone.objects[i] == room) {
-			// All good; in the same zone.
-			return;
-		}
-	}
-
-	// Need to change zones. Find the new zone.
-	// FIXME: This is a a big slow linear search.
-	for (size_t i = 0; i < _assets._csa.zones.size(); ++i) {
-		const Zone& z = _assets._csa.zones[i];
-		for (size_t j = 0; j < z.objects.size(); ++j) {
-			if (z.objects[j] == room) {
-				_zone = _assets.getScriptRef(z.entityID);
-				return;
-			}
-		}
+	const EntityID& zone = _assets._csa.owner(room);
+	if (zone.empty()) {
+		FatalError(fmt::format("Room '{}' is not in a Zone", room));
+		return;
 	}
-	assert(false);	// We didn't find the zone.
+	_zone = _assets.getScriptRef(zone);
+	assert(_zone.type == ScriptType::kZone);
 }
 
 /* ScriptCBHandler */
@@ -338,11 +342,11 @@ void ZoneDriver::setLocked(const EntityID& id, bool locked)
 void ZoneDriver::deltaItem(const EntityID& id, const EntityID& itemID, int n)
 {
 	const Item& item = _assets.getItem(itemID);
-	if (_assets.inventories.find(id) == _assets.inventories.end()) {
+	if (!_assets.hasInventory(id)) {
 		fmt::print("[LOG] Map::deltaItem (add/remove): invalid entity. entity={} item={} n={}\n", id, itemID, n);
 		return;
 	}
-	Inventory& inv = _assets.inventories.at(id);
+	Inventory& inv = _assets.getInventory(*_assets.get(id));
 	inv.deltaItem(item, n);
 }
 
@@ -350,11 +354,11 @@ void ZoneDriver::deltaItem(const EntityID& id, const EntityID& itemID, int n)
 int ZoneDriver::numItems(const EntityID& id, const EntityID& itemID) const
 {
 	const Item& item = _assets.getItem(itemID);
-	if (_assets.inventories.find(id) == _assets.inventories.end()) {
+	if (!_assets.hasInventory(id)) {
 		fmt::print("[LOG] Map::numItems: invalid entity. entity={} item={}\n", id, itemID);
 		return 0;
 	}
-	Inventory& inv = _assets.inventories.at(id);
+	const Inventory& inv = std::as_const(_assets).getInventory(*_assets.get(id));
 	return inv.numItems(item);
 }
 
@@ -390,7 +394,7 @@ bool ZoneDriver::tryUnlock(const Entity& e)
 		return false;
 
 	const Item& key = _assets.getItem(keyName);
-	Inventory& inv = _assets.inventories.at("player");
+	const Inventory& inv = std::as_const(_assets).getInventory(getPlayer());
 	if (inv.hasItem(key)) {
 		mapData.coreData.coreSet(e.entityID, "locked", false, false);
 		if (edge)
@@ -404,27 +408,24 @@ bool ZoneDriver::tryUnlock(const Entity& e)
 
 ZoneDriver::MoveResult ZoneDriver::move(const EntityID& roomEntityID)
 {
-	// Find an edge - brute force. May want to optimize. FIXME
-	EntityID a = roomEntityID;
-	EntityID b = _assets._csa.rooms[_room.index].entityID;
-
-	const auto it = std::find_if(_assets._csa.edges.begin(), _assets._csa.edges.end(), [&](const Edge& e) {
-		return (a == e.room1 && b == e.room2) || (a == e.room2 && b == e.room1);
+	// Find the edge from the current room.
+	const EntityID& current = _assets._csa.rooms[_room.index].entityID;
+	const auto range = _assets._csa.roomGraph().adjacent(current);
+	const auto it = std::find_if(range.first, range.second, [&](const RoomGraph::Segment& s) {
+		return s.node1 == roomEntityID;
 		});
 
-	if (it == _assets._csa.edges.end()) {
+	if (it == range.second) {
 		FatalError(fmt::format("Can not find Room with entityID='{}'", roomEntityID));
-	}
-
-	assert(it != _assets._csa.edges.end());
-	if (it == _assets._csa.edges.end())
 		return MoveResult::kNoConnection;
+	}
 
-	if (isLocked(*it))
-		tryUnlock(*it);
+	const Edge& edge = _assets._csa.edges[it->edge.edge];
+	if (isLocked(edge))
+		tryUnlock(edge);
 
-	if (isLocked(*it)) {
-		mapData.newsQueue.push(NewsItem::edgeLocked(*it));
+	if (isLocked(edge)) {
+		mapData.newsQueue.push(NewsItem::edgeLocked(edge));
 		return MoveResult::kLocked;
 	}
 
@@ -460,7 +461,15 @@ void ZoneDriver::save(std::ostream& stream) const
 {
 	mapData.coreData.save(stream);
 	_assets.save(stream);
-	ZoneDriver::saveTextRead(stream, mapData.textRead);
+	// The debug format uses hashes for all the text, so it doesn't depend on the line ids.
+	std::unordered_set<uint64_t> textRead = mapData.textRead().hashed;
+	for (int id = 0; id < _assets._csa.numTextLines(); id++) {
+		if (mapData.isLineRead(id)) {
+			const Text::Line& line = _assets._csa.textLine(id);
+			textRead.insert(Hash(line.speaker, line.text));
+		}
+	}
+	ZoneDriver::saveTextRead(stream, textRead);
 
 	fmt::print(stream, "Map = {{\n");
 	fmt::print(stream, "  currentZone = '{}',\n", _assets._csa.zones[_zone.index].entityID);
@@ -477,7 +486,17 @@ EntityID ZoneDriver::load(ScriptBridge& loader)
 	EntityID script;
 	mapData.coreData.load(loader);
 	_assets.load(loader);
-	ZoneDriver::loadTextRead(loader, mapData.textRead);
+	std::unordered_set<uint64_t> textRead;
+	ZoneDriver::loadTextRead(loader, textRead);
+	for (int id = 0; id < _assets._csa.numTextLines(); id++) {
+		const Text::Line& line = _assets._csa.textLine(id);
+		auto it = textRead.find(Hash(line.speaker, line.text));
+		if (it != textRead.end()) {
+			mapData.markLineRead(id);
+			textRead.erase(it);
+		}
+	}
+	for (uint64_t hash : textRead) mapData.markTextRead(hash);
 
 	lua_State* L = loader.getLuaState();
 	ScriptBridge::LuaStackCheck check(L);
@@ -502,6 +521,194 @@ EntityID ZoneDriver::load(ScriptBridge& loader)
 	return script;
 }
 
+static constexpr uint32_t kSectionCore = BinTag("CORE");
+static constexpr uint32_t kSectionInventory = BinTag("INVN");
+static constexpr uint32_t kSectionTextRead = BinTag("TEXT");
+static constexpr uint32_t kSectionMap = BinTag("MAP_");
+static constexpr uint32_t kSectionScript = BinTag("SCRD");
+
+void ZoneDriver::save(BinWriter& w) const
+{
+	size_t s = w.beginSection(kSectionCore);
+	mapData.coreData.save(w);
+	w.endSection(s);
+
+	s = w.beginSection(kSectionInventory);
+	_assets.save(w);
+	w.endSection(s);
+
+	// The bits are only valid for the same text (the ids would change), so
+	// the text hash is checked on load.
+	const MapData::TextRead& textRead = mapData.textRead();
+	s = w.beginSection(kSectionTextRead);
+	w.u64(_assets._csa.textHash());
+	w.u32(uint32_t(textRead.bits.size()));
+	for (uint64_t bits : textRead.bits) w.u64(bits);
+	w.u32(uint32_t(textRead.hashed.size()));
+	for (uint64_t t : textRead.hashed) w.u64(t);
+	w.endSection(s);
+
+	saveLocation(w);
+}
+
+void ZoneDriver::saveChanges(BinWriter& w)
+{
+	size_t s = w.beginSection(kSectionCore);
+	mapData.coreData.saveChanges(w);
+	w.endSection(s);
+
+	s = w.beginSection(kSectionInventory);
+	_assets.saveChanges(w);
+	w.endSection(s);
+
+	s = w.beginSection(kSectionTextRead);
+	w.u64(_assets._csa.textHash());
+	w.u32(uint32_t(mapData.newLinesRead.size()));
+	for (int id : mapData.newLinesRead) w.u32(uint32_t(id));
+	w.u32(uint32_t(mapData.newTextRead.size()));
+	for (uint64_t t : mapData.newTextRead) w.u64(t);
+	w.endSection(s);
+	mapData.newLinesRead.clear();
+	mapData.newTextRead.clear();
+
+	// The location and script position are small, so always written in full.
+	saveLocation(w);
+}
+
+void ZoneDriver::saveLocation(BinWriter& w) const
+{
+	size_t s = w.beginSection(kSectionMap);
+	w.str(_assets._csa.zones[_zone.index].entityID.str());
+	w.str(_assets._csa.rooms[_room.index].entityID.str());
+	w.endSection(s);
+
+	if (_scriptDriver) {
+		s = w.beginSection(kSectionScript);
+		_scriptDriver->save(w);
+		w.endSection(s);
+	}
+}
+
+bool ZoneDriver::load(BinReader& r)
+{
+	return loadSections(r, false);
+}
+
+bool ZoneDriver::loadChanges(BinReader& r)
+{
+	return loadSections(r, true);
+}
+
+void ZoneDriver::setJournaling(bool on)
+{
+	mapData.coreData.setJournaling(on);
+	_assets.setJournaling(on);
+	mapData.journaling = on;
+	mapData.newTextRead.clear();
+}
+
+bool ZoneDriver::loadSections(BinReader& r, bool changes)
+{
+	BinReader core = r.section(kSectionCore);
+	BinReader inventory = r.section(kSectionInventory);
+	BinReader textRead = r.section(kSectionTextRead);
+	BinReader map = r.section(kSectionMap);
+	if (!core.ok() || !inventory.ok() || !textRead.ok() || !map.ok())
+		return false;
+
+	EntityID zone(map.str());
+	EntityID room(map.str());
+	if (!map.ok() || !_assets.isAsset(zone) || !_assets.isAsset(room))
+		return false;
+
+	if (changes) {
+		if (!mapData.coreData.loadChanges(core) || !_assets.loadChanges(inventory))
+			return false;
+	}
+	else {
+		if (!mapData.coreData.load(core) || !_assets.load(inventory))
+			return false;
+		mapData.mutableTextRead().clear();
+	}
+
+	MapData::TextRead& read = mapData.mutableTextRead();
+	bool sameText = textRead.u64() == _assets._csa.textHash();
+	if (!sameText)
+		PLOG(plog::warning) << "The game text has changed since the save; read text is reset";
+	int nLines = _assets._csa.numTextLines();
+	if (changes) {
+		uint32_t n = textRead.count(4);
+		for (uint32_t i = 0; i < n; i++) {
+			int id = int(textRead.u32());
+			if (sameText && id >= 0 && id < nLines) read.setLineRead(id);
+		}
+	}
+	else {
+		uint32_t n = textRead.count(8);
+		for (uint32_t i = 0; i < n; i++) {
+			uint64_t bits = textRead.u64();
+			if (sameText && i < (uint32_t(nLines) + 63) / 64) {
+				if (read.bits.size() <= i) read.bits.resize(i + 1, 0);
+				read.bits[i] |= bits;
+			}
+		}
+	}
+	uint32_t n = textRead.count(8);
+	for (uint32_t i = 0; i < n; i++) read.hashed.insert(textRead.u64());
+	if (!textRead.ok())
+		return false;
+
+	_zone = _assets.getScriptRef(zone);
+	_room = _assets.getScriptRef(room);
+
+	_scriptDriver.reset(nullptr);
+	BinReader script = r.section(kSectionScript);
+	if (script.ok()) {
+		_scriptDriver = std::make_unique<ScriptDriver>(this->_assets, this->mapData, _bridge, ScriptEnv());
+		bool okay = _scriptDriver->load(script);
+		if (!okay) {
+			_scriptDriver.reset(nullptr);
+		}
+	}
+	return true;
+}
+
+ZoneDriver::Snapshot ZoneDriver::snapshot() const
+{
+	Snapshot snapshot;
+	snapshot.core = mapData.coreData.snapshot();
+	snapshot.inventories = _assets.snapshot();
+	snapshot.textRead = mapData.snapshotTextRead();
+	snapshot.random = mapData.random;
+	snapshot.zone = _zone;
+	snapshot.room = _room;
+	if (_scriptDriver)
+		snapshot.script = _scriptDriver->position();
+	snapshot.endGameMsg = _endGameMsg;
+	snapshot.endGameBias = _endGameBias;
+	return snapshot;
+}
+
+void ZoneDriver::restore(const Snapshot& snapshot)
+{
+	mapData.coreData.restore(snapshot.core);
+	_assets.restore(snapshot.inventories);
+	mapData.restoreTextRead(snapshot.textRead);
+	mapData.random = snapshot.random;
+	_zone = snapshot.zone;
+	_room = snapshot.room;
+	_endGameMsg = snapshot.endGameMsg;
+	_endGameBias = snapshot.endGameBias;
+
+	_scriptDriver.reset(nullptr);
+	if (snapshot.script) {
+		_scriptDriver = std::make_unique<ScriptDriver>(this->_assets, this->mapData, _bridge, ScriptEnv());
+		if (!_scriptDriver->setPosition(*snapshot.script)) {
+			_scriptDriver.reset(nullptr);
+		}
+	}
+}
+
 void ZoneDriver::saveTextRead(std::ostream& stream, const std::unordered_set<uint64_t>& text)
 {
 	int N = 4;
@@ -574,6 +781,11 @@ void ZoneDriver::checkScriptDriver()
 			_scriptDriver = std::make_unique<ScriptDriver>(this->_assets, this->mapData, _bridge, env, iact->code);
 		}
 	}
+
+	// Every call here follows a change of state, so a battle now is a battle starting.
+	if (_autoSave && _scriptDriver && _scriptDriver->type() == ScriptType::kBattle) {
+		_autoSave->save(*this);
+	}
 }
 
 void ZoneDriver::startInteraction(const Interaction* interaction)
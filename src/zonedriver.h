@@ -12,12 +12,16 @@
 #include <map>
 #include <optional>
 #include <set>
+#include <utility>
 
 namespace lurp {
 
 struct ScriptAssets;
 class ScriptBridge;
 class ScriptDriver;
+class AutoSave;
+class BinWriter;
+class BinReader;
 
 using ContainerVec = std::vector<const Container*>;
 using InteractionVec = std::vector<const Interaction*>;
@@ -68,7 +72,7 @@ public:
 	void setZone(const EntityID& zone, EntityID room);
 
 	const Inventory& getInventory(const Entity& e) const {
-		return _assets.getInventory(e);
+		return std::as_const(_assets).getInventory(e);
 	}
 
 	enum class TransferResult {
@@ -104,6 +108,7 @@ public:
 	virtual int numItems(const EntityID& id, const EntityID& item) const;
 	virtual void movePlayer(const EntityID& dst, bool teleport);
 	virtual void endGame(const std::string& msg, int bias);
+	virtual uint64_t inventoryVersion() const { return _assets.inventoryVersion(); }
 
 	bool isLocked(const Entity& e) const { return isLocked(e.entityID);  }
 	bool tryUnlock(const Entity& e);
@@ -118,18 +123,66 @@ public:
 
 	// Note that for save AND load, the ScriptAssets must already be loaded.
 	// The save and load apply a delta on the ScriptAssets.
+	// The Lua text format is for debugging; see SaveFile for the binary format.
 	void save(std::ostream& stream) const;
 	EntityID load(ScriptBridge& loader);
 
+	// Binary, in sections. Loading replaces the session state (CoreData,
+	// inventories, text read, location, and script.) Returns false if the
+	// data is corrupt.
+	void save(BinWriter& w) const;
+	bool load(BinReader& r);
+
+	// Journaling (see Journal): saveChanges() writes the same sections as save(),
+	// but only with what changed since the last saveChanges(). loadChanges()
+	// applies them on top of the current state.
+	void setJournaling(bool on);
+	void saveChanges(BinWriter& w);
+	bool loadChanges(BinReader& r);
+
+	// Copy-on-write snapshot of all the session state: CoreData, inventories,
+	// text read, random state, location, and script position. Taking one is
+	// O(1) (the data is shared until it changes) and any number can be kept,
+	// for undo, or branching "what if" play. restore() can go to any of them.
+	// (The news queue and the Lua state aren't part of it.) After a restore,
+	// a Journal needs to be compacted.
+	struct Snapshot {
+		CoreData::Snapshot core;
+		std::shared_ptr<const ScriptAssets::InventoryMap> inventories;
+		std::shared_ptr<const MapData::TextRead> textRead;
+		Random random;
+		ScriptRef zone;
+		ScriptRef room;
+		std::optional<ScriptPosition> script;
+		std::string endGameMsg;
+		int endGameBias = 0;
+	};
+	Snapshot snapshot() const;
+	void restore(const Snapshot& snapshot);
+
+	// Starts at a snapshot, rather than in a zone. The game's code and evals
+	// aren't run again; see restore().
+	ZoneDriver(ScriptAssets& assets, ScriptBridge& bridge, const Snapshot& start);
+
+	// If set, the game is auto-saved at safe points: currently when a battle starts.
+	// The AutoSave must outlive the driver (or be cleared.)
+	void setAutoSave(AutoSave* autoSave) { _autoSave = autoSave; }
+
 	static void saveTextRead(std::ostream& stream, const std::unordered_set<uint64_t>& text);
 	static void loadTextRead(ScriptBridge& loader, std::unordered_set<uint64_t>& text);
 
 	const ScriptAssets& assets() const { return _assets; }
 
 private:
+	// The zone level script environment for one navigation query. It is set up
+	// on the first eval() that needs Lua and shared by the rest.
+	class EvalScope;
+
 	std::vector<Edge> edges(EntityID room = "") const;
-	bool filterInteraction(const Interaction&);	// true if interaction should be included
+	bool filterInteraction(const Interaction&, EvalScope& scope);	// true if interaction should be included
 	void checkScriptDriver();
+	void saveLocation(BinWriter& w) const;
+	bool loadSections(BinReader& r, bool changes);
 
 	const EntityID& zoneID() const;
 	const EntityID& roomID() const;
@@ -142,6 +195,7 @@ private:
 	ScriptRef _zone;
 	ScriptRef _room;
 	std::unique_ptr<ScriptDriver> _scriptDriver;
+	AutoSave* _autoSave = nullptr;
 	std::string _endGameMsg;
 	int _endGameBias = 0;
 };